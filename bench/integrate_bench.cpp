@@ -0,0 +1,78 @@
+//
+// Integrator benchmark: how many bodies per second each code path can
+// integrate and bounce, next to a plain memcpy moving the same number of
+// bytes (the best this stage could ever do).
+//
+// Usage: integrate_bench [bodies] [steps]
+//
+
+
+#include "../physics/integrate.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdlib.h>
+
+// Fill a store with bodies scattered around the arena
+void fill(BodyStore& bodies, int count) {
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        Vector p(rand() % 1000, rand() % 1000);
+        Vector v(rand() % 400 - 200, rand() % 400 - 200);
+        bodies.add(Circle(p, 5 + rand() % 20, Color(), Vector(0, -200.0f), v));
+    }
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int steps = argc > 2 ? atoi(argv[2]) : 200;
+    AABB walls{Vector(0, 40), Vector(1000, 960)};
+    float dt = 1 / 120.0f;
+
+    // Each body reads 8 floats and writes 4
+    double bytesPerBody = 12 * sizeof(float);
+
+    // Baseline: copy the same number of bytes around
+    std::vector<char> from(count * bytesPerBody / 2), to(from.size());
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) {
+        memcpy(to.data(), from.data(), from.size());
+        from[s % from.size()] = to[(s * 7) % to.size()];
+    }
+    std::chrono::duration<double> copyTime =
+        std::chrono::steady_clock::now() - start;
+    double copyRate = (double)count * steps / copyTime.count();
+    std::cout << "memcpy: " << copyRate / 1e6 << "M bodies/s ("
+              << copyRate * bytesPerBody / 1e9 << " GB/s)\n";
+
+    // Run every path this machine supports
+    BodyStore reference;
+    SimdLevel best = detectSimdLevel();
+    for (int l = 0; l <= (int)best; l++) {
+        SimdLevel level = (SimdLevel)l;
+        BodyStore bodies;
+        fill(bodies, count);
+
+        start = std::chrono::steady_clock::now();
+        for (int s = 0; s < steps; s++) {
+            integrateBodies(bodies, 0, bodies.size(), dt, walls, level);
+        }
+        std::chrono::duration<double> time =
+            std::chrono::steady_clock::now() - start;
+        double rate = (double)count * steps / time.count();
+
+        // Every path should land on exactly the same numbers
+        bool same = true;
+        if (l == 0) {
+            reference = bodies;
+        } else {
+            same = reference.px == bodies.px && reference.py == bodies.py &&
+                   reference.vx == bodies.vx && reference.vy == bodies.vy;
+        }
+
+        std::cout << simdLevelName(level) << ": " << rate / 1e6
+                  << "M bodies/s (" << rate * bytesPerBody / 1e9 << " GB/s, "
+                  << 100 * rate / copyRate << "% of memcpy)"
+                  << (same ? "" : " MISMATCH") << "\n";
+    }
+}
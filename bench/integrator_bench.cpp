@@ -0,0 +1,97 @@
+//
+// Integrator scheme benchmark: drops a pile of shapes into the world at a
+// few gravities and timesteps with each integrator, walls, contacts and all,
+// and prints what a step costs next to what happened to the energy. Nothing
+// in the world should add energy (walls and contacts only take it away), so
+// every step that ends with more than it started with is the scheme pumping
+// it in, and a pile that's still moving at the end (or still awake) is the
+// same thing seen another way. Makes it easy to pick the cheapest scheme
+// that's still stable at a given dt.
+//
+// Usage: integrator_bench [bodies] [seconds] [threads]
+//
+
+
+#include "../physics/world.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+
+// Kinetic energy of every body, and the potential on top of that, measured
+// up from the floor (gravity points down the screen, to the walls' max y)
+double energy(const World& world, bool potential = true) {
+    const BodyStore& b = world.get_bodies();
+    double floor = world.get_walls().max.y;
+    double total = 0;
+    for (uint32_t i = 0; i < b.size(); i++) {
+        double mass = 1 / b.inverseMass(i);
+        double vx = b.vx[i], vy = b.vy[i];
+        double height = floor - b.py[i] - b.hy[i];
+        total += mass * 0.5 * (vx * vx + vy * vy);
+        if (potential) {
+            total -= mass * b.ay[i] * height;
+        }
+    }
+    return total;
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 300;
+    float seconds = argc > 2 ? atof(argv[2]) : 4;
+    unsigned threads =
+        argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    const Integrator integrators[] = {Integrator::SemiImplicitEuler,
+                                      Integrator::Verlet};
+    const int gravities[] = {1, 10, 50};
+    const int rates[] = {30, 60, 120, 240};
+
+    std::cout << "(" << count << " bodies, " << seconds << " seconds)\n";
+    for (int g : gravities) {
+        std::cout << "gravity " << g << "G:\n";
+        for (int rate : rates) {
+            float dt = 1.0f / rate;
+            for (Integrator integrator : integrators) {
+                World world(dt, threads);
+                world.set_integrator(integrator);
+                SpawnSettings spawn;
+                spawn.minRadius = 8;
+                spawn.maxRadius = 16;
+                spawn.minSize = Vector(16, 12);
+                spawn.maxSize = Vector(36, 28);
+                spawn.acceleration = Vector(0, -200.0f * g);
+                world.spawn(count, spawn);
+
+                // Add up every step's gain
+                double start = energy(world);
+                double last = start;
+                double added = 0;
+                int steps = (int)(seconds * rate);
+                double time = 0;
+                for (int s = 0; s < steps; s++) {
+                    auto begin = std::chrono::steady_clock::now();
+                    world.step(dt);
+                    std::chrono::duration<double> took =
+                        std::chrono::steady_clock::now() - begin;
+                    time += took.count();
+                    double now = energy(world);
+                    added += std::max(now - last, 0.0);
+                    last = now;
+                }
+
+                const BodyStore& bodies = world.get_bodies();
+                double gained = 100 * added / start;
+                std::cout << "  dt 1/" << rate << " "
+                          << integratorName(integrator) << ": "
+                          << 1e6 * time / steps << "us/step, energy added "
+                          << gained << "%, still moving "
+                          << 100 * energy(world, false) / start << "%, "
+                          << bodies.awakeCount() << "/" << bodies.size()
+                          << " awake" << (gained > 1 ? " UNSTABLE" : "")
+                          << "\n";
+            }
+        }
+    }
+}
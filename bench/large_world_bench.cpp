@@ -0,0 +1,137 @@
+//
+// Large world benchmark: a row of floored chunks a million chunks out from
+// the origin, with bodies dropped into a few of them at a time. Shows that
+// chunks in memory and chunks stepped follow where things are moving, not
+// how big the world is, and that paged out chunks come back as they were.
+// Before any of that, it stacks a box on another one across a seam and fails
+// if they haven't settled without overlapping.
+//
+// Usage: large_world_bench [chunks] [bodies per drop] [threads]
+//
+
+
+#include "../physics/chunks.h"
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    return time.count();
+}
+
+// Drop a box from chunk (0, 1) onto one resting on a floor in chunk (0, 0),
+// with gravity pointing back at (0, 0), and see if they settle into a stack
+static bool seamStack(const std::string& directory, unsigned threads) {
+    ChunkedWorld world(directory, 1000, 1 / 120.0f, threads);
+    Vector gravity(0, 200); // Accelerations get subtracted, so this is -y
+    world.addStatic(ChunkCoord{0, 0},
+                    Rectangle(Vector(500, 780), Vector(1000, 40)));
+    ChunkBody lower = world.add(
+        ChunkCoord{0, 0},
+        Rectangle(Vector(500, 900), Vector(200, 200), Color(), gravity));
+    ChunkBody upper = world.add(
+        ChunkCoord{0, 1},
+        Rectangle(Vector(500, 300), Vector(200, 200), Color(), gravity));
+    for (int s = 0; s < 600; s++) {
+        world.step(1 / 120.0f);
+    }
+
+    // The boxes stay in their chunks, so the seam's between them the whole
+    // way down
+    const BodyStore& a = world.get_chunk(lower.chunk)->get_bodies();
+    const BodyStore& b = world.get_chunk(upper.chunk)->get_bodies();
+    uint32_t i = a.indexOf(lower.handle), j = b.indexOf(upper.handle);
+    float overlap = (a.py[i] + a.hy[i]) - (b.py[j] - b.hy[j] + 1000);
+    float sunk = 800 - (a.py[i] - a.hy[i]);
+    float speed = fabsf(a.vy[i]) + fabsf(b.vy[j]);
+    bool settled = overlap < 2 && sunk < 2 && speed < 1;
+    std::cout << "stack across a seam: overlap " << overlap
+              << ", sunk into the floor " << sunk << ", speed " << speed
+              << (settled ? "" : " FAILED") << "\n";
+    return settled;
+}
+
+// Drop piles onto a long floor a long way out, and check that chunks come
+// back from disk the way they went out
+static bool largeWorld(const std::string& directory, int count, int drop,
+                       unsigned threads) {
+    ChunkedWorld world(directory, 1000, 1 / 120.0f, threads);
+    world.set_page_out_steps(120);
+
+    // One long floor, split up between every chunk it crosses
+    ChunkCoord far{1000000, 1000000};
+    for (int c = 0; c < count; c++) {
+        world.addStatic(ChunkCoord{far.x + c, far.y},
+                        Rectangle(Vector(500, 940), Vector(1000, 40)));
+    }
+
+    // Every so often a pile of bodies lands on a different stretch of it,
+    // and the last pile goes to sleep while the next one's falling
+    Random random(1);
+    int drops = 8;
+    for (int d = 0; d < drops; d++) {
+        ChunkCoord at{far.x + (int32_t)random.below(count - 3), far.y};
+        for (int i = 0; i < drop; i++) {
+            Vector p(random.below(3000), 100 + random.below(700));
+            if (i % 2) {
+                world.add(at, Circle(p, 5 + random.below(10), Color(),
+                                     Vector(0, -200)));
+            } else {
+                world.add(at, Rectangle(p,
+                                        Vector(10 + random.below(20),
+                                               10 + random.below(20)),
+                                        Color(), Vector(0, -200)));
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        int steps = 600;
+        uint32_t maxLoaded = 0, maxStepped = 0;
+        for (int s = 0; s < steps; s++) {
+            world.step(1 / 120.0f);
+            maxLoaded = std::max(maxLoaded, world.get_loaded_count());
+            maxStepped = std::max(maxStepped, world.get_stepped_count());
+        }
+        double time = seconds(start);
+        std::cout << "drop " << d << ": " << time / steps * 1000
+                  << " ms/step, " << world.get_body_count() << " bodies in "
+                  << world.get_chunk_count() << " chunks, at most "
+                  << maxLoaded << " loaded and " << maxStepped
+                  << " stepped, " << world.get_loaded_count()
+                  << " loaded now\n";
+    }
+
+    // Page everything back in and make sure nothing moved while it was out
+    uint64_t hash = world.hash();
+    for (int c = 0; c < count; c++) {
+        world.get_chunk(ChunkCoord{far.x + c, far.y});
+    }
+    bool kept = hash == world.hash();
+    std::cout << "paged out " << world.get_page_outs() << " times, in "
+              << world.get_page_ins() << " times, hash "
+              << (kept ? "kept" : "CHANGED") << "\n";
+    return kept;
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    int drop = argc > 2 ? atoi(argv[2]) : 300;
+    unsigned threads =
+        argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    // Chunks get paged out to a directory of their own (the worlds delete
+    // their files when they go away, so it's empty again by the end)
+    char directory[] = "/tmp/large_world_XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::cerr << "couldn't make a directory for the chunks\n";
+        return 1;
+    }
+    bool stacked = seamStack(directory, threads);
+    bool kept = largeWorld(directory, count, drop, threads);
+    rmdir(directory);
+    return stacked && kept ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+//
+// Particle benchmark: a dam break of uniform particles (a block of them let go
+// in one corner of a box), stepped with every pair kernel this machine
+// supports. Prints steps per second, particles per second and contacts, and
+// checks every kernel lands on exactly the same particles.
+//
+// Usage: particle_bench [particles] [steps] [threads]
+//
+
+
+#include "../physics/world.h"
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int steps = argc > 2 ? atoi(argv[2]) : 20;
+    unsigned threads =
+        argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    // A square block of particles in a box twice as wide, so it has
+    // somewhere to fall
+    float spacing = ParticleSettings().radius * 2;
+    float side = ceilf(sqrtf((float)count)) * spacing;
+    AABB walls{Vector(0, 0), Vector(side * 2, side + 40)};
+    AABB block{Vector(0, 40), Vector(side, side + 40)};
+
+    uint64_t reference = 0;
+    SimdLevel best = detectSimdLevel();
+    for (int l = 0; l <= (int)best; l++) {
+        SimdLevel level = (SimdLevel)l;
+        World world(1 / 120.0f, threads);
+        world.set_walls(walls);
+        world.set_simd_level(level);
+        ParticleSystem& particles = world.get_particles();
+        particles.fill(block);
+
+        // Let it get going first, so there's something to collide
+        for (int s = 0; s < 10; s++) {
+            world.step(1 / 120.0f);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int s = 0; s < steps; s++) {
+            world.step(1 / 120.0f);
+        }
+        std::chrono::duration<double> time =
+            std::chrono::steady_clock::now() - start;
+        double rate = steps / time.count();
+
+        // Every kernel should come out the same
+        bool same = true;
+        if (l == 0) {
+            reference = particles.hash();
+        } else {
+            same = reference == particles.hash();
+        }
+
+        std::cout << simdLevelName(level) << ": " << particles.size()
+                  << " particles, " << rate << " steps/s ("
+                  << rate * particles.size() / 1e6 << "M particles/s, "
+                  << particles.get_contact_count() << " contacts)"
+                  << (same ? "" : " MISMATCH") << "\n";
+    }
+}
@@ -0,0 +1,117 @@
+//
+// Query benchmark: how many raycasts, point, box and nearest queries a
+// second the world can answer through its AABB trees, next to checking
+// every body one by one, and how long keeping the body tree up to date
+// takes after a step.
+//
+// Usage: query_bench [bodies] [queries]
+//
+
+
+#include "../physics/world.h"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    return time.count();
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int queries = argc > 2 ? atoi(argv[2]) : 100000;
+
+    // Small bodies scattered over a big arena, with a platform every so
+    // often, and gravity off so they drift
+    World world(1 / 120.0f);
+    float size = sqrtf(count) * 40;
+    world.set_walls(AABB{Vector(0, 0), Vector(size, size)});
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        Vector p(rand() % (int)size, rand() % (int)size);
+        Vector v(rand() % 40 - 20, rand() % 40 - 20);
+        if (i % 2) {
+            world.get_bodies().add(
+                Circle(p, 2 + rand() % 8, Color(), Vector(), v));
+        } else {
+            world.get_bodies().add(Rectangle(
+                p, Vector(4 + rand() % 16, 4 + rand() % 16), Color(),
+                Vector(), v));
+        }
+    }
+    for (int i = 0; i < count / 100; i++) {
+        Vector p(rand() % (int)size, rand() % (int)size);
+        world.addStatic(Rectangle(p, Vector(60, 8)));
+    }
+    world.step(world.get_timestep());
+
+    // The first query builds the tree, later ones after a step refit it
+    auto start = std::chrono::steady_clock::now();
+    QueryHit hit;
+    world.pointQuery(Vector(), hit);
+    double build = seconds(start);
+    world.step(world.get_timestep());
+    start = std::chrono::steady_clock::now();
+    world.pointQuery(Vector(), hit);
+    double refit = seconds(start);
+    std::cout << "tree build: " << build * 1000 << " ms, refit after a step: "
+              << refit * 1000 << " ms\n";
+
+    // Same random queries for every kind
+    std::vector<Vector> points(queries), ends(queries);
+    for (int i = 0; i < queries; i++) {
+        points[i] = Vector(rand() % (int)size, rand() % (int)size);
+        ends[i] = Vector(points[i].x + rand() % 400 - 200,
+                         points[i].y + rand() % 400 - 200);
+    }
+    int found = 0;
+    auto report = [&](const char* name, double time) {
+        std::cout << name << ": " << queries / time / 1e6 << "M queries/s ("
+                  << time / queries * 1e9 << " ns each, " << found
+                  << " hits)\n";
+        found = 0;
+    };
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        found += world.raycast(points[i], ends[i], hit);
+    }
+    report("raycast", seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        found += world.pointQuery(points[i], hit);
+    }
+    report("point", seconds(start));
+
+    std::vector<QueryHit> hits;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        hits.clear();
+        found += world.aabbQuery(
+            AABB{points[i], Vector(points[i].x + 50, points[i].y + 50)}, hits);
+    }
+    report("box (50x50)", seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        found += world.nearest(points[i], 100, hit);
+    }
+    report("nearest (within 100)", seconds(start));
+
+    // Baseline: point queries checking every body's box
+    const BodyStore& bodies = world.get_bodies();
+    int linear = std::min(queries, 1000);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < linear; i++) {
+        AABB box{points[i], points[i]};
+        for (uint32_t b = 0; b < bodies.size(); b++) {
+            found += bodies.bounds(b).overlaps(box);
+        }
+    }
+    double time = seconds(start);
+    std::cout << "point, checking every body: " << linear / time / 1e6
+              << "M queries/s (" << time / linear * 1e9 << " ns each)\n";
+}
@@ -0,0 +1,155 @@
+//
+// Scene benchmark: steps a few canned, seeded scenes at sizes from 100 up to
+// 1M bodies and prints the results as JSON, so runs from different versions
+// can be compared.
+//
+// Usage: scene_bench [max bodies] [threads] [seed]
+//
+
+
+#include "../physics/world.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+
+// Random float in [lo, hi)
+float random(float lo, float hi) {
+    return lo + (hi - lo) * (rand() / ((float)RAND_MAX + 1));
+}
+
+// Everything a scene needs to know to lay itself out
+struct Scene {
+    const char* name;
+    float slot;    // Each body gets its own square this big
+    float fill;    // Fraction of the arena height the slots fill
+    float gravity; // In Gs
+    float speed;   // Largest starting speed
+    float circles; // Fraction of bodies that are circles
+    float minRadius, maxRadius;
+    Vector minSize, maxSize; // Rectangle sizes
+};
+
+const Scene scenes[] = {
+    // Same shapes as createRandomShape, spread out and dropped
+    {"random", 150, 1, 1, 0, 0.5f, 20, 50, Vector(40, 40), Vector(140, 100)},
+    // Small bodies packed right up against each other at the bottom
+    {"pile", 24, 0.5f, 1, 0, 0.5f, 11, 12.5f, Vector(22, 16), Vector(25, 25)},
+    // Tiny circles far apart, bouncing around with no gravity
+    {"gas", 60, 1, 0, 200, 1, 3, 8, Vector(), Vector()},
+    // Circles and rectangles of all sizes, thrown around under gravity
+    {"mixed", 50, 1, 1, 100, 0.5f, 6, 22, Vector(12, 8), Vector(44, 30)},
+};
+
+// Lay out a scene with count bodies, each in its own slot so nothing starts
+// overlapping
+void build(World& world, const Scene& scene, int count) {
+    int cols = ceil(sqrt(count / scene.fill));
+    int rows = (count + cols - 1) / cols;
+    float width = cols * scene.slot;
+    float height = rows * scene.slot / scene.fill;
+    world.set_walls(AABB{Vector(0, 0), Vector(width, height)});
+
+    BodyStore& bodies = world.get_bodies();
+    bodies.reserve(count);
+    Vector a(0, -200.0f * scene.gravity);
+    for (int i = 0; i < count; i++) {
+        // Fill from the bottom up
+        float x = (i % cols + 0.5f) * scene.slot;
+        float y = height - (i / cols + 0.5f) * scene.slot;
+        Vector v(random(-1, 1) * scene.speed, random(-1, 1) * scene.speed);
+        Color color(rand() % 256, rand() % 256, rand() % 256);
+        bool circle = random(0, 1) < scene.circles;
+        Vector size = circle ? Vector(2, 2) * random(scene.minRadius,
+                                                     scene.maxRadius)
+                             : Vector(random(scene.minSize.x, scene.maxSize.x),
+                                      random(scene.minSize.y, scene.maxSize.y));
+
+        // Jitter within whatever room the slot has left
+        float roomX = std::max(scene.slot - size.x, 0.0f) / 2;
+        float roomY = std::max(scene.slot - size.y, 0.0f) / 2;
+        Vector p(x + random(-roomX, roomX), y + random(-roomY, roomY));
+        if (circle) {
+            bodies.add(Circle(p, size.x / 2, color, a, v));
+        } else {
+            bodies.add(Rectangle(p, size, color, a, v));
+        }
+    }
+}
+
+// Most memory the process has used so far
+long peakMemory() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss; // Already in bytes on MacOS
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+}
+
+int main(int argc, char** argv) {
+    int maxBodies = argc > 1 ? atoi(argv[1]) : 1000000;
+    unsigned threads =
+        argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    unsigned seed = argc > 3 ? atoi(argv[3]) : 1;
+    float dt = 1 / 120.0f;
+
+    std::cout << "{\n"
+              << "  \"threads\": " << threads << ",\n"
+              << "  \"seed\": " << seed << ",\n"
+              << "  \"timestep\": " << dt << ",\n"
+              << "  \"simd\": \"" << simdLevelName(detectSimdLevel())
+              << "\",\n"
+              << "  \"results\": [";
+
+    // Smallest first, so the peak memory of each run is (about) its own
+    bool first = true;
+    for (int count = 100; count <= maxBodies; count *= 10) {
+        for (const Scene& scene : scenes) {
+            srand(seed);
+            World world(dt, threads);
+            build(world, scene, count);
+
+            // Enough steps to time properly without the big runs taking
+            // forever, after a few to let things get going
+            int steps = std::clamp(2000000 / count, 5, 1000);
+            for (int i = 0; i < std::min(steps, 10); i++) {
+                world.step(dt);
+            }
+
+            uint64_t pairs = 0;
+            uint64_t contacts = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < steps; i++) {
+                world.step(dt);
+                pairs += world.get_broad_phase().get_pairs().size();
+                contacts += world.get_contact_count();
+            }
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            double seconds = elapsed.count();
+
+            std::cout << (first ? "\n" : ",\n") << "    {\"scene\": \""
+                      << scene.name << "\", \"bodies\": " << count
+                      << ", \"steps\": " << steps
+                      << ", \"seconds\": " << seconds
+                      << ", \"steps_per_second\": " << steps / seconds
+                      << ", \"ns_per_body_step\": "
+                      << seconds * 1e9 / ((double)steps * count)
+                      << ", \"pairs_per_step\": " << pairs / steps
+                      << ", \"contacts_per_step\": " << contacts / steps
+                      << ", \"awake\": " << world.get_bodies().awakeCount()
+                      << ", \"scratch_peak_bytes\": "
+                      << world.get_scratch().get_peak()
+                      << ", \"peak_memory_bytes\": " << peakMemory() << "}"
+                      << std::flush;
+            first = false;
+        }
+    }
+    std::cout << "\n  ]\n}\n";
+}
@@ -1,6 +1,20 @@
+# Build the physics library (no graphics needed, so this works anywhere)
+mkdir -p build
+for src in physics/*.cpp; do
+    g++ -std=c++17 -O2 -c "$src" -o "build/$(basename "${src%.cpp}").o"
+done
+ar rcs build/libphysics.a build/*.o
+g++ -std=c++17 -O2 headless.cpp -Lbuild -lphysics -lpthread -o build/headless
+g++ -std=c++17 -O2 bench/integrate_bench.cpp -Lbuild -lphysics -lpthread -o build/integrate_bench
+g++ -std=c++17 -O2 bench/integrator_bench.cpp -Lbuild -lphysics -lpthread -o build/integrator_bench
+g++ -std=c++17 -O2 bench/scene_bench.cpp -Lbuild -lphysics -lpthread -o build/scene_bench
+g++ -std=c++17 -O2 bench/query_bench.cpp -Lbuild -lphysics -lpthread -o build/query_bench
+g++ -std=c++17 -O2 bench/large_world_bench.cpp -Lbuild -lphysics -lpthread -o build/large_world_bench
+g++ -std=c++17 -O2 bench/particle_bench.cpp -Lbuild -lphysics -lpthread -o build/particle_bench
+
 wget https://raw.githubusercontent.com/benonymity/CMP-201/main/homework/Assignment%205/tigr.c -q -O tigr.c
 wget https://raw.githubusercontent.com/benonymity/CMP-201/main/homework/Assignment%205/tigr.h -q -O tigr.h
 if [[ "$OSTYPE" == "darwin"* ]]; then
-    g++ -std=c++17 main.cpp tigr.c -o physics -framework OpenGL -framework Cocoa
+    g++ -std=c++17 main.cpp tigr.c -Lbuild -lphysics -lpthread -o physics -framework OpenGL -framework Cocoa
     ./physics
-fi
\ No newline at end of file
+fi
@@ -0,0 +1,110 @@
+//
+// Headless runner: steps a seeded random scene with a fixed timestep and
+// prints where everything ended up. No window needed, so this runs anywhere.
+//
+// Usage: headless [shapes] [steps] [seed] [threads] [trace.json] [frame.ppm]
+//        headless --replay input.log [threads]
+//
+
+
+#include "physics/lockstep.h"
+#include "physics/profile.h"
+#include "physics/render.h"
+#include "physics/world.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+
+// Play an input log back as fast as possible and check every tick's hash
+int replay(const char* path, unsigned threads) {
+    InputLog log;
+    if (!log.load(path)) {
+        std::cerr << "Couldn't read " << path << "\n";
+        return 1;
+    }
+    World world(log.timestep, threads);
+    Lockstep lockstep(world, log);
+    auto start = std::chrono::steady_clock::now();
+    while (!lockstep.is_finished()) {
+        lockstep.tick();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << "Shapes: " << world.get_bodies().size() << "\n"
+              << "Inputs: " << log.events.size() << "\n"
+              << "Ticks: " << log.hashes.size() << "\n"
+              << "Ticks per second: " << log.hashes.size() / elapsed.count()
+              << "\n";
+    if (lockstep.get_diverged() != UINT64_MAX) {
+        std::cout << "Diverged at tick " << lockstep.get_diverged() << "\n";
+        return 1;
+    }
+    std::cout << "Every tick matched\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        return replay(argv[2], argc > 3 ? atoi(argv[3])
+                                        : std::thread::hardware_concurrency());
+    }
+
+    int shapeCount = argc > 1 ? atoi(argv[1]) : 100;
+    int steps = argc > 2 ? atoi(argv[2]) : 1000;
+    unsigned seed = argc > 3 ? atoi(argv[3]) : 1;
+    unsigned threads =
+        argc > 4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+
+    // Build the scene
+    World world(1 / 120.0f, threads);
+    world.get_random().set_seed(seed);
+    for (int i = 0; i < shapeCount; i++) {
+        createRandomShape(world.get_bodies(), world.get_random(),
+                          Vector(0, -200.0f), 1);
+    }
+
+    // Step it (recording a trace if there's somewhere to put it, "-" for
+    // nowhere)
+    const char* trace = argc > 5 && strcmp(argv[5], "-") != 0 ? argv[5]
+                                                              : nullptr;
+    Profiler::get().set_recording(trace != nullptr);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        world.step(world.get_timestep());
+        PROFILE_FRAME();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    // Hash the final positions and velocities so runs are easy to compare
+    const BodyStore& bodies = world.get_bodies();
+    std::cout << "Shapes: " << bodies.size() << "\n"
+              << "Awake: " << bodies.awakeCount() << "\n"
+              << "Threads: " << world.get_thread_count() << "\n"
+              << "Steps: " << steps << "\n"
+              << "Steps per second: " << steps / elapsed.count() << "\n"
+              << "Checksum: " << std::hex << world.hash() << "\n";
+
+    if (trace && !Profiler::get().writeTrace(trace)) {
+        std::cerr << "Couldn't write " << trace << "\n";
+        return 1;
+    }
+
+    // Draw the last frame off screen, same as the window would show it
+    if (argc > 6) {
+        Image frame(1000, 1000);
+        Renderer renderer;
+        start = std::chrono::steady_clock::now();
+        renderer.render(bodies, frame);
+        elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Render ms: " << std::dec << elapsed.count() * 1000
+                  << "\n";
+        if (!frame.savePPM(argv[6])) {
+            std::cerr << "Couldn't write " << argv[6] << "\n";
+            return 1;
+        }
+    }
+}
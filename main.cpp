@@ -6,91 +6,28 @@
 //
 
 
+#include "physics/async.h"
+#include "physics/lockstep.h"
+#include "physics/profile.h"
+#include "physics/render.h"
+#include "physics/snapshot.h"
+#include "physics/trajectory.h"
+#include "physics/world.h"
 #include "tigr.h"
-#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <math.h>
+#include <stdio.h>
 #include <string>
-#include <vector>
+#include <string.h>
 
-// Define the vector class with nice math
-class Vector {
-  public:
-    // Constructor
-    Vector(float x = 0.0f, float y = 0.0f)
-        : x(x), y(y) {
-    }
-
-    // Vector variables
-    float x;
-    float y;
-
-    // Overloaded operators
-    Vector operator+(Vector v) {
-        return Vector(x + v.x, y + v.y);
-    }
-
-    Vector operator+=(Vector v) {
-        x += v.x;
-        y += v.y;
-        return Vector(x, y);
-    }
-
-    Vector operator-(Vector v) {
-        return Vector(x - v.x, y - v.y);
-    }
-
-    Vector operator-=(Vector v) {
-        x -= v.x;
-        y -= v.y;
-        return Vector(x, y);
-    }
-
-    Vector operator*(float b) {
-        return Vector(x * b, y * b);
-    }
-
-    Vector operator*=(float b) {
-        x *= b;
-        y *= b;
-        return Vector(x, y);
-    }
-
-    Vector operator/(float b) {
-        return Vector(x / b, y / b);
-    }
-
-    Vector operator/=(float b) {
-        x /= b;
-        y /= b;
-        return Vector(x, y);
-    }
-
-    // Get the dot product
-    float dot(const Vector& other) const {
-        return x * other.x + y * other.y;
-    }
-
-    // Get the cross product
-    float cross(const Vector& other) const {
-        return x * other.y - y * other.x;
-    }
-
-    // Get the length of the vector
-    float length() {
-        return sqrt(x * x + y * y);
-    }
-
-    // Get the normal of the vector
-    Vector normal() {
-        float len = length();
-        if (len > 0) {
-            return Vector(x / len, y / len);
-        }
-        return Vector(0, 0);
-    }
-};
+// Convert an engine color to a tigr pixel
+TPixel toPixel(Color c) {
+    return tigrRGBA(c.r, c.g, c.b, c.a);
+}
 
+// The renderer writes Colors straight into tigr's pixels
+static_assert(sizeof(Color) == sizeof(TPixel), "Color has to match TPixel");
 
 class Display {
   public:
@@ -121,6 +58,31 @@ class Display {
         tigrFillCircle(screen, (int)p.x, (int)p.y, r, color);
     }
 
+    // Draw a frame's bodies (clearing only what the last frame drew)
+    void draw_bodies(const RenderState& state) {
+        renderer.render(state, (Color*)screen->pix, screen->w, screen->h);
+    }
+
+    // Print white text, and make sure it gets cleared next frame
+    void print(int x, int y, const std::string& text) {
+        tigrPrint(screen, tfont, x, y, tigrRGB(0xff, 0xff, 0xff), "%s",
+                  text.c_str());
+        renderer.markDirty(x, y, tigrTextWidth(tfont, text.c_str()),
+                           tigrTextHeight(tfont, text.c_str()));
+    }
+
+    // Draw a body from its fields (half is the radius twice for circles)
+    void draw_body(ShapeType type, Vector center, Vector half, Color color) {
+        if (type == ShapeType::Circle) {
+            draw_circle(center, half.x, toPixel(color));
+        } else {
+            Vector topLeft = center - half;
+            Vector size = half * 2;
+            tigrFillRect(screen, topLeft.x, topLeft.y, size.x, size.y,
+                         toPixel(color));
+        }
+    }
+
     // Reutrn the screen
     Tigr* get_screen() {
         return screen;
@@ -141,523 +103,305 @@ class Display {
     int height;
     std::string title;
     Tigr* screen;
+    Renderer renderer;
 };
 
-// Base shape class
-class Shape {
-  public:
-    // Constructor
-    virtual ~Shape() {
+// Print the last frame's phase timings and counters under the stats
+void drawProfile(Display& d) {
+    std::string text = "\nProfile (ms):";
+    char line[64];
+    for (auto& scope : Profiler::get().get_scopes()) {
+        snprintf(line, sizeof(line), "\n %s: %.2f", scope.name, scope.value);
+        text += line;
     }
-
-    // Shape variables
-    Vector center;
-    Vector acceleration;
-    Vector velocity;
-    TPixel color;
-    bool intersecting = false;
-
-    // Universal shape functions
-    virtual void draw(Display& d) = 0;
-    virtual void update(float dt, const std::vector<Shape*>& shapes) = 0;
-    virtual bool intersects(Shape& other) = 0;
-};
-
-// Circle class extending shape
-class Circle : public Shape {
-  public:
-    // Constructor
-    Circle(Vector p, float r, TPixel c = tigrRGB(0xFF, 0xFF, 0xFF),
-           Vector a = Vector(0, -200.0f), Vector v = Vector(0, 0))
-        : radius(r) {
-        center = p;
-        color = c;
-        acceleration = a;
-        velocity = v;
-    }
-
-    // Circle variables
-    float radius;
-
-    // Intersection delegator (causes issues with random spawning because it
-    // can't run a square collision check and forward declaration doesn't work
-    // with big classes for some reason)
-    bool intersects(Shape& other) override {
-        if (auto circle = dynamic_cast<Circle*>(&other)) {
-            return intersectCircle(*circle);
-        }
-        return false;
+    for (auto& counter : Profiler::get().get_counters()) {
+        snprintf(line, sizeof(line), "\n%s: %.0f", counter.name,
+                 counter.value);
+        text += line;
     }
-
-    // Ensure the distance check for collision is correct
-    bool intersectCircle(const Circle& other) {
-        float distance = (center - other.center).length();
-        return distance < (radius + other.radius);
+    if (Profiler::get().get_recording()) {
+        text += "\nRecording...";
     }
+    d.print(890, 230, text);
+}
 
-    // Draw the circle (handled by display class)
-    void draw(Display& d) override {
-        d.draw_circle(center, radius, color);
+// Play back a recorded trajectory instead of simulating
+int replay(Display& d, const char* path) {
+    TrajectoryReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "Couldn't read " << path << "\n";
+        return 1;
     }
+    float t = 0;
+    bool paused = false;
+    // One second's worth of frames, for skipping around
+    uint64_t second = std::max<uint64_t>(1, 1 / reader.get_timestep());
+    uint64_t frame = 0;
+    reader.next();
+    while (!tigrClosed(d.get_screen()) &&
+           !tigrKeyDown(d.get_screen(), TK_ESCAPE)) {
+        tigrClear(d.get_screen(), tigrRGB(0, 0, 0));
 
-    // Update the circle
-    void update(float dt, const std::vector<Shape*>& shapes) override {
-        velocity -= acceleration * dt; // Apply acceleration
-        center += velocity * dt;       // Apply velocity
-
-        // Bounce off walls
-        if (center.x - radius < 0 || center.x + radius > 1000) {
-            velocity.x = -velocity.x * 0.9; // Reflect and dampen velocity
-            center.x = velocity.x < 0 ? 1000 - radius : 0 + radius;
+        // Space pauses, left and right skip a second either way
+        if (tigrKeyDown(d.get_screen(), TK_SPACE)) {
+            paused = !paused;
+        }
+        uint64_t target = frame;
+        if (tigrKeyDown(d.get_screen(), TK_LEFT)) {
+            target = frame > second ? frame - second : 0;
         }
-        if (center.y - radius - 40 < 0 || center.y + radius + 40 > 1000) {
-            velocity.y = -velocity.y * 0.9; // Reflect and dampen velocity
-            center.y = velocity.y < 0 ? 1000 - radius - 40 : radius + 40;
+        if (tigrKeyDown(d.get_screen(), TK_RIGHT)) {
+            target = std::min(frame + second, reader.get_frame_count() - 1);
+        }
+        if (target != frame && reader.seek(target) && reader.next()) {
+            frame = target;
         }
 
-        // Update intersect flag
-        intersecting = false;
-
-        // Check for collisions with other circles
-        // (I can't do rectangle checks because the class hasn't been declared
-        // yet, and I'm too lazy to declare everything then define it later)
-        for (auto shape : shapes) {
-            if (shape == this)
-                continue;
-            Circle* other = dynamic_cast<Circle*>(shape);
-            if (other && intersects(*other)) {
-                intersecting = true;
-                handleCollision(*other);
+        // Play at the speed it was recorded
+        t += paused ? 0 : tigrTime();
+        while (t >= reader.get_timestep()) {
+            t -= reader.get_timestep();
+            if (frame + 1 < reader.get_frame_count() && reader.next()) {
+                frame++;
             }
         }
-    }
 
-    // Handle circle collisions
-    void handleCollision(Circle& other) {
-        // Calculate the distance between the circles and the normal vector
-        Vector normal = (other.center - center).normal();
-        float distance = (center - other.center).length();
-        float penetration = (radius + other.radius) - distance;
-
-        // Calculate their relative velocity
-        Vector relativeVelocity = velocity - other.velocity;
-        float velocityAlongNormal = relativeVelocity.dot(normal);
-
-        // Make sure the circles are moving towards each other
-        if (velocityAlongNormal < 0)
-            return;
-
-        float e = 0.9; // Resistution coefficient
-        float impulseScalar = -(1 + e) * velocityAlongNormal;
-        impulseScalar /=
-            (1 / (radius * radius) + 1 / (other.radius * other.radius));
-        // Calculate the impulse
-        Vector impulse = normal * impulseScalar;
-
-        // Apply impulse to the circles' velocities
-        velocity += impulse / (radius * radius) * 0.9;
-        other.velocity -= impulse / (other.radius * other.radius);
-
-        // Actually move the circles
-        center -= (1 / (radius * radius));
-        other.center += (1 / (other.radius * other.radius));
+        const TrajectoryFrame& f = reader.get_frame();
+        for (uint32_t s = 0; s < f.get_slot_count(); s++) {
+            if (f.alive(s)) {
+                d.draw_body(f.type[s], Vector(f.px[s], f.py[s]),
+                            Vector(f.hx[s], f.hy[s]), f.color[s]);
+            }
+        }
+        // The path goes in as an argument, since it could have a % in it
+        std::string text = "Replaying " + std::string(path) + "\nFrame: " +
+                           std::to_string(frame + 1) + " / " +
+                           std::to_string(reader.get_frame_count()) +
+                           (paused ? " (paused)" : "") +
+                           "\n\nCommands:\n   Space: Pause\n   "
+                           "Left/Right: Skip a second\n   Esc: Quit";
+        tigrPrint(d.get_screen(), tfont, 10, 50, tigrRGB(0xff, 0xff, 0xff),
+                  "%s", text.c_str());
+        tigrUpdate(d.get_screen());
     }
-};
+    return 0;
+}
 
-// Inheritance!
-class Rectangle : public Shape {
-  public:
-    // Constructors
-    Rectangle() {
+// Say what's at a point, for the stats
+std::string describePoint(const World& world, Vector p) {
+    QueryHit hit;
+    if (!world.pointQuery(p, hit)) {
+        return "";
     }
-
-    Rectangle(Vector pos, Vector e, TPixel c = tigrRGB(0xFF, 0xFF, 0xFF),
-              Vector a = Vector(0, -200.0f), Vector v = Vector(0, 0))
-        : size(e) {
-        center = pos;
-        color = c;
-        acceleration = a;
-        velocity = v;
+    std::string text = "\nPointing at: ";
+    if (hit.staticId != UINT32_MAX) {
+        return text + "platform";
     }
+    const BodyStore& bodies = world.get_bodies();
+    uint32_t i = bodies.indexOf(hit.body);
+    text += bodies.type[i] == ShapeType::Circle ? "circle" : "rectangle";
+    return text + (bodies.asleep(i) ? " (asleep)" : "");
+}
 
-    Vector size;
-
-    // Get the center of the rectangle (don't really use this)
-    Vector get_center() {
-        return center + size * 0.5f;
+// Handle keyboard input. The world's on the simulation thread, so anything
+// that touches it gets queued there, and inputs go through lockstep so they
+// land on a tick and can be recorded and played back.
+void handleKeyboard(Display& d, AsyncWorld& sim, bool logging,
+                    bool& showProfile, TrajectoryRecorder& recorder,
+                    bool& recording) {
+    // Start recording every step, or stop and finish the file (the recorder
+    // gets every step on the simulation thread, so it's switched there too)
+    if (tigrKeyDown(d.get_screen(), 'T')) {
+        recording = !recording;
+        sim.post([&recorder, start = recording](World& w) {
+            if (start) {
+                recorder.start("trajectory.traj", w.get_timestep());
+            } else {
+                recorder.stop();
+            }
+        });
     }
 
-    // Polymorphism!
-    // Delegate the intersection checks depending on shape type
-    bool intersects(Shape& other) override {
-        if (auto circle = dynamic_cast<Circle*>(&other)) {
-            return intersectCircle(*circle);
-        } else if (auto rect = dynamic_cast<Rectangle*>(&other)) {
-            return intersectRect(*rect);
-        }
-        return false;
+    // Toggle the profiler overlay
+    if (tigrKeyDown(d.get_screen(), 'P')) {
+        showProfile = !showProfile;
     }
 
-    // Check for intersection with a rectangle
-    bool intersectRect(const Rectangle& other) const {
-        return !(center.x + size.x / 2 < other.center.x - other.size.x / 2 ||
-                 center.x - size.x / 2 > other.center.x + other.size.x / 2 ||
-                 center.y + size.y / 2 < other.center.y - other.size.y / 2 ||
-                 center.y - size.y / 2 > other.center.y + other.size.y / 2);
+    // Start recording a trace, or stop and save it
+    if (tigrKeyDown(d.get_screen(), 'R')) {
+        Profiler& profiler = Profiler::get();
+        if (profiler.get_recording()) {
+            profiler.set_recording(false);
+            profiler.writeTrace("trace.json");
+        } else {
+            profiler.set_recording(true);
+        }
     }
 
-    // Check for intersection with a circle
-    bool intersectCircle(const Circle& circle) const {
-        // Find the closest point to the circle's center on the rectangle
-        float closestX = std::clamp(circle.center.x, center.x - size.x / 2,
-                                    center.x + size.x / 2);
-        float closestY = std::clamp(circle.center.y, center.y - size.y / 2,
-                                    center.y + size.y / 2);
-
-        float distanceX = circle.center.x - closestX;
-        float distanceY = circle.center.y - closestY;
-
-        return (distanceX * distanceX + distanceY * distanceY) <
-               (circle.radius * circle.radius);
+    // Save a checkpoint, or go back to the last one (not while an input log
+    // is going, since it couldn't be played back from the same place)
+    if (tigrKeyDown(d.get_screen(), 'S')) {
+        sim.post([](World& w) { return Snapshot::save(w, "world.snap"); });
     }
-
-    void update(float dt, const std::vector<Shape*>& shapes) override {
-        velocity -= acceleration * dt; // Apply acceleration
-        center += velocity * dt;       // Apply velocity
-
-        // Bounce off walls
-        if (center.x - size.x / 2 < 0 || center.x + size.x / 2 > 1000) {
-            velocity.x = -velocity.x * 0.9; // Reflect and dampen velocity
-            center.x = velocity.x < 0 ? 1000 - size.x / 2 : 0 + size.x / 2;
-        }
-        // (these y adjustments of 40 I think are caused by the header of the
-        // window of MacOS. Not sure if this is true on other OSes, but this
-        // minimal library doesn't provide a nice way to handle screen size.)
-        if (center.y - size.y / 2 - 40 < 0 ||
-            center.y + size.y / 2 + 40 > 1000) {
-            velocity.y = -velocity.y * 0.9; // Reflect and dampen velocity
-            center.y =
-                velocity.y < 0 ? 1000 - size.y / 2 - 40 : 0 + size.y / 2 + 40;
-        }
-
-        // Update the intersect flag
-
-        intersecting = false;
-        // Collision detection and response
-        for (auto shape : shapes) {
-            if (shape == this)
-                continue;
-            if (auto rect = dynamic_cast<Rectangle*>(shape)) {
-                if (this->intersects(*rect)) {
-                    intersecting = true;
-                    handleCollision(*rect);
-                }
-            } else if (auto circ = dynamic_cast<Circle*>(shape)) {
-                if (this->intersects(*circ)) {
-                    intersecting = true;
-                    handleCollision(*circ);
-                }
-            }
-        }
+    if (tigrKeyDown(d.get_screen(), 'L') && !logging) {
+        sim.post([](World& w) {
+            Snapshot snapshot;
+            return snapshot.open("world.snap") && snapshot.restore(w);
+        });
     }
 
-    // Handle rectangular collisions
-    void handleCollision(Rectangle& other) {
-        // Calculate overlap along each axis
-        float overlapX =
-            0.5 * (size.x + other.size.x) - abs(center.x - other.center.x);
-        float overlapY =
-            0.5 * (size.y + other.size.y) - abs(center.y - other.center.y);
-
-        // Calculate the "mass" of each object
-        float mass = size.x * size.y;
-        float otherMass = other.size.x * other.size.y;
-
-        // Make sure the rectangles are colliding
-        if (overlapX > 0 && overlapY > 0) {
-            // Determine which axis has the minimum overlap
-            if (overlapX < overlapY) {
-                // Collision is horizontal
-                // Check the direction of the overlap
-                if (center.x < other.center.x) {
-                    center.x -= overlapX;
-                } else {
-                    center.x += overlapX;
-                }
-                // Calculate the impulse
-                float impulse = velocity.x - other.velocity.x;
-                velocity.x = -impulse * 0.5;
-                other.velocity.x = impulse * 0.5;
-            } else {
-                // Collision is vertical
-                if (center.y < other.center.y) {
-                    center.y -= overlapY;
-                } else {
-                    center.y += overlapY;
-                }
-                // Calculate the impulse
-                float impulse = velocity.y - other.velocity.y;
-                velocity.y = -impulse * 0.5;
-                other.velocity.y = impulse * 0.5;
-            }
-
-            // Apply a small correction to prevent the shapes sticking together
-            // (this seems necessary for the rectangles, but doesn't seem to
-            // work as a good strategy with the circles.)
-            float massTotal = mass + otherMass;
-            Vector correction = (overlapX < overlapY ? Vector(overlapX, 0)
-                                                     : Vector(0, overlapY)) *
-                                0.5;
-            if (center.x < other.center.x) {
-                center -= correction * (otherMass / massTotal);
-                other.center += correction * (mass / massTotal);
-            } else {
-                center += correction * (otherMass / massTotal);
-                other.center -= correction * (mass / massTotal);
-            }
-            if (center.y < other.center.y) {
-                center -= correction * (otherMass / massTotal);
-                other.center += correction * (mass / massTotal);
-            } else {
-                center += correction * (otherMass / massTotal);
-                other.center -= correction * (mass / massTotal);
-            }
-        }
+    // Create a random shape
+    if (tigrKeyDown(d.get_screen(), TK_SPACE)) {
+        sim.input(InputType::Spawn);
     }
 
-    // Handle circular collisions
-    void handleCollision(Circle& circle) {
-        // Find the closest point on the circle to the rectangle
-        float closestX = std::clamp(circle.center.x, center.x - size.x / 2,
-                                    center.x + size.x / 2);
-        float closestY = std::clamp(circle.center.y, center.y - size.y / 2,
-                                    center.y + size.y / 2);
-
-        // Find the point of contact
-        Vector collisionPoint(closestX, closestY);
-        Vector collisionNormal = (circle.center - collisionPoint).normal();
-        float overlap =
-            circle.radius - (circle.center - collisionPoint).length();
-
-        // Check if the circles are colliding
-        if (overlap > 0) {
-            // Calculate impulse to resolve collision
-            Vector relativeVelocity = circle.velocity - velocity;
-            float velocityAlongNormal = relativeVelocity.dot(collisionNormal);
-
-            // Make sure they're moving towards each other
-            if (velocityAlongNormal > 0)
-                return;
-
-            // Calculate the "mass" of the rectangle
-            float mass = size.x * size.y;
-
-            // Restitution coefficient
-            float e = 0.9;
-
-            float combinedMass =
-                (1 / mass) + (1 / (circle.radius * circle.radius));
-
-            float impulseScalar = -(1 + e) * velocityAlongNormal / combinedMass;
-            // Calculate the impulse
-            Vector impulse = collisionNormal * impulseScalar;
-
-            // Apply the impulse
-            velocity -= impulse / mass;
-            circle.velocity += impulse / (circle.radius * circle.radius);
-
-            // Apply a position correction
-            center -= (1 / mass);
-            circle.center += (1 / (circle.radius * circle.radius));
-        }
+    // Clear all the shapes
+    if (tigrKeyDown(d.get_screen(), TK_BACKSPACE)) {
+        sim.input(InputType::Clear);
     }
 
-    // Draw the shape with the built-in rectangle function
-    void draw(Display& d) override {
-        Vector topLeft = center - Vector(size.x / 2, size.y / 2);
-        tigrFillRect(d.get_screen(), topLeft.x, topLeft.y, size.x, size.y,
-                     color);
+    // Create a bunch of small shapes at once
+    if (tigrKeyDown(d.get_screen(), 'M')) {
+        sim.input(InputType::SpawnMany);
     }
-};
 
-// Create a random shape
-Shape* createRandomShape(const std::vector<Shape*>& shapes, Vector a,
-                         int a_const) {
-    // Randomize the shape type
-    int type = rand() % 2;
-    // type = 0;
-    // Randomize the parameters of the shape
-    float radius = 20 + rand() % 30;
-    TPixel color = tigrRGB(rand() % 256, rand() % 256, rand() % 256);
-    Vector size(40 + rand() % 100, 40 + rand() % 60);
-
-    // Randomize the position
-    Vector position(rand() % 940 + 30, rand() % 940 + 30);
-
-    // Set the velocity to 0
-    Vector v = Vector(0, 0);
-
-    // Run the collision check 5 times—if it fails them all, there are probably
-    // too many shapes
-    for (int i = 0; i < 5; i++) {
-        // Check for overlap with existing shapes
-        for (auto existingShape : shapes) {
-            if (type == 0) { // Circle
-                Circle tempCircle(position, radius, color, a * a_const, v);
-                if (std::any_of(shapes.begin(), shapes.end(),
-                                [&tempCircle](Shape* s) {
-                                    return s->intersects(tempCircle);
-                                })) {
-                }
-            } else { // Rectangle
-                Rectangle tempRectangle(position, size, color, a * a_const, v);
-                if (std::any_of(shapes.begin(), shapes.end(),
-                                [&tempRectangle](Shape* s) {
-                                    return s->intersects(tempRectangle);
-                                })) {
-                }
-            }
-        }
-
-        // If there's no overlap, make the shape!
-        if (type == 0) {
-            return new Circle(position, radius, color, a * a_const, v);
-        } else {
-            return new Rectangle(position, size, color, a * a_const, v);
-        }
+    // Add a platform
+    if (tigrKeyDown(d.get_screen(), 'B')) {
+        sim.input(InputType::AddPlatform);
     }
-    return nullptr;
-}
 
-// Handle keyboard input
-void handleKeyboard(Display& d, std::vector<Shape*>& shapes, Vector& a,
-                    int& a_const) {
-    if (tigrKeyDown(d.get_screen(), TK_SPACE)) {
-        // if (shapes.size() < 50) { // Prevent too many shapes for getting
-                                  // spawned, otherwise performance issues
-            // Create a random shape
-            Shape* newShape = createRandomShape(shapes, a, a_const);
-            if (newShape) {
-                shapes.push_back(newShape);
-            }
-        // }
+    // Pour in a block of particles
+    if (tigrKeyDown(d.get_screen(), 'F')) {
+        sim.input(InputType::Pour);
     }
 
-    // Clear all the shapes
-    if (tigrKeyDown(d.get_screen(), TK_BACKSPACE)) {
-        shapes.clear();
+    // Switch broad phases
+    if (tigrKeyDown(d.get_screen(), TK_TAB)) {
+        sim.input(InputType::SwitchBroadPhase);
     }
 
     // Handle directional keys
     if (tigrKeyDown(d.get_screen(), TK_UP)) {
-        a = Vector(0, 200.0f);
-        for (auto shape : shapes) {
-            if (a_const == 0) {
-                shape->velocity -= a;
-            } else {
-                shape->acceleration = a * a_const;
-            }
-        }
+        sim.input(InputType::GravityUp);
     }
     if (tigrKeyDown(d.get_screen(), TK_DOWN)) {
-        a = Vector(0, -200.0f);
-        for (auto shape : shapes) {
-            if (a_const == 0) {
-                shape->velocity -= a;
-            } else {
-                shape->acceleration = a * a_const;
-            }
-        }
+        sim.input(InputType::GravityDown);
     }
     if (tigrKeyDown(d.get_screen(), TK_LEFT)) {
-        a = Vector(200.0f, 0);
-        for (auto shape : shapes) {
-            if (a_const == 0) {
-                shape->velocity -= a;
-            } else {
-                shape->acceleration = a * a_const;
-            }
-        }
+        sim.input(InputType::GravityLeft);
     }
     if (tigrKeyDown(d.get_screen(), TK_RIGHT)) {
-        a = Vector(-200.0f, 0);
-        for (auto shape : shapes) {
-            if (a_const == 0) {
-                shape->velocity -= a;
-            } else {
-                shape->acceleration = a * a_const;
-            }
-        }
+        sim.input(InputType::GravityRight);
     }
 
     // Handle gravity keys
     if (tigrKeyDown(d.get_screen(), TK_MINUS)) {
-        if (a_const > 0) {
-            for (auto shape : shapes) {
-                shape->acceleration /= a_const;
-            }
-            a_const -= 1;
-        }
-        for (auto shape : shapes) {
-            shape->acceleration *= a_const;
-        }
+        sim.input(InputType::GravityLess);
     }
     if (tigrKeyDown(d.get_screen(), TK_EQUALS)) {
-        if (a_const > 0) {
-            for (auto shape : shapes) {
-                shape->acceleration /= a_const;
-            }
-        }
-        a_const += 1;
-        for (auto shape : shapes) {
-            shape->acceleration *= a_const;
-        }
+        sim.input(InputType::GravityMore);
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
     // Initialize the display
     Display d(1000, 1000, "Physics");
 
+    // Given a trajectory, just play that
+    if (argc > 1 && strncmp(argv[1], "--", 2) != 0) {
+        return replay(d, argv[1]);
+    }
+
+    // Otherwise run the simulation, either recording an input log or
+    // playing one back
+    const char* recordPath =
+        argc > 2 && strcmp(argv[1], "--record") == 0 ? argv[2] : nullptr;
+    InputLog played;
+    bool playing = argc > 2 && strcmp(argv[1], "--replay") == 0;
+    if (playing && !played.load(argv[2])) {
+        std::cerr << "Couldn't read " << argv[2] << "\n";
+        return 1;
+    }
+
     // Initialize needed variables
-    std::vector<Shape*> shapes;
-    Vector a = Vector(0, -200.0f);
-    int a_const = 1;
-    float t = 0;
+    World world;
+    Lockstep lockstep = playing ? Lockstep(world, played) : Lockstep(world);
+    float elapsed = 0;
+    bool showProfile = false;
+    TrajectoryRecorder recorder;
+    bool recording = false;
+    world.set_step_listener(
+        [&recorder](const World& w) { recorder.capture(w); });
+
+    // Step on another thread, which owns the world from here on. This
+    // thread never waits on it, it just draws the last finished frame.
+    AsyncWorld sim(world, &lockstep);
+    std::future<int> stepping;
+    std::future<std::string> hovering;
+    std::string pointing;
 
-    bool lastIntersect = false;
-    bool intersect = false;
     // Start the display loop
     while (!tigrClosed(d.get_screen()) &&
            !tigrKeyDown(d.get_screen(), TK_ESCAPE)) {
-        // Reset the screen (looks funny without this)
-        tigrClear(d.get_screen(), tigrRGB(0, 0, 0));
-
-        // Get time since last frame
-        t = tigrTime();
+        // Add up the time since the last frame, and hand it over once the
+        // last lot's been stepped (so a slow world doesn't back up the queue)
+        elapsed += tigrTime();
+        if (!stepping.valid() ||
+            stepping.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready) {
+            stepping = sim.advance_async(elapsed);
+            elapsed = 0;
+        }
 
         // Handle keyboard input
-        handleKeyboard(d, shapes, a, a_const);
-        if (intersect) {
-            lastIntersect = true;
-        } else {
-            lastIntersect = false;
-        }
-        intersect = false;
-        // Update and draw each shapes
-        for (auto shape : shapes) {
-            shape->draw(d);
-            shape->update(t, shapes);
-            if (shape->intersecting) {
-                intersect = true;
+        handleKeyboard(d, sim, playing || recordPath, showProfile, recorder,
+                       recording);
+
+        // Stats for this frame, from the last one the simulation finished
+        std::shared_ptr<const WorldFrame> frame = sim.get_frame();
+        Vector a = frame->gravity;
+        int a_const = frame->gravityScale;
+        std::string replayStatus;
+        if (playing) {
+            replayStatus = "\nReplaying tick " +
+                           std::to_string(frame->state.step) + " / " +
+                           std::to_string(played.hashes.size());
+            if (frame->diverged != UINT64_MAX) {
+                replayStatus += "\nDiverged at tick " +
+                                std::to_string(frame->diverged);
             }
         }
-
-        if (intersect && !lastIntersect) {
-            // Shape* newShape = createRandomShape(shapes, a, a_const);
-            // if (newShape) {
-            //     shapes.push_back(newShape);
-            // }
+        // Whatever's under the mouse, asked of the world's query tree on
+        // the simulation thread (and shown once the answer's back, so it
+        // lags a frame or so behind the mouse)
+        if (hovering.valid() && hovering.wait_for(std::chrono::seconds(0)) ==
+                                    std::future_status::ready) {
+            pointing = hovering.get();
+        }
+        if (!hovering.valid()) {
+            int mouseX, mouseY, buttons;
+            tigrMouse(d.get_screen(), &mouseX, &mouseY, &buttons);
+            hovering = sim.query([p = Vector(mouseX, mouseY)](const World& w) {
+                return describePoint(w, p);
+            });
+        }
+        std::string stats =
+            "Shapes: " + std::to_string(frame->bodyCount) +
+            "\nAwake: " + std::to_string(frame->awakeCount) +
+            "\nParticles: " + std::to_string(frame->particleCount) +
+            "\nGravity: " + std::to_string(a_const) + "G" +
+            ((a.y == 0) > 0 ? ((a.x < 0) ? " Right" : " Left")
+                            : ((a.y < 0) ? " Down" : " Up")) +
+            "\nPairs: " + std::to_string(frame->pairCount) +
+            "\nContacts: " + std::to_string(frame->contactCount) + "\n" +
+            frame->broadPhase +
+            (recording ? "\nRecording trajectories" : "") + replayStatus +
+            pointing;
+
+        // Draw it while the next one steps
+        {
+            PROFILE_SCOPE("draw");
+            d.draw_bodies(frame->state);
         }
 
         // Print some instructions
@@ -672,19 +416,33 @@ int main() {
             "how to solve in an elegant manner.Just don't go too crazy\non the "
             "gravity and number of shapes and you should be "
             "good.\n\nCommands:\n   Space: Spawn new random shape\n   "
+            "M: Spawn a hundred small shapes\n   B: Add a platform\n   "
+            "F: Pour in particles\n   "
             "Backspace: Delete all shapes\n   Up/Down/Left/Right: Change "
             "direction of gravity/Apply impulse\n   -/+: Increase/decrease "
-            "gravity\n   Esc: Quit");
+            "gravity\n   Tab: Switch broad phase\n   P: Show profiler\n   R: "
+            "Start/stop recording a trace (saved to trace.json)\n   S/L: "
+            "Save/load a snapshot (world.snap)\n   T: Start/stop recording "
+            "trajectories (trajectory.traj)\n   Esc: Quit");
 
         // Print some stats
-        tigrPrint(d.get_screen(), tfont, 890, 50, tigrRGB(0xff, 0xff, 0xff),
-                  ("Shapes: " + std::to_string(shapes.size()) +
-                   "\nGravity: " + std::to_string(a_const) + "G" +
-                   ((a.y == 0) > 0 ? ((a.x < 0) ? " Right" : " Left")
-                                   : ((a.y < 0) ? " Down" : " Up")))
-                      .c_str());
+        d.print(890, 50, stats);
+        if (showProfile) {
+            drawProfile(d);
+        }
 
         // Update the screen
-        tigrUpdate(d.get_screen());
+        {
+            PROFILE_SCOPE("present");
+            tigrUpdate(d.get_screen());
+        }
+        PROFILE_FRAME();
+    }
+    // Let whatever's still queued finish before reading the log
+    sim.post([](World&) {}).wait();
+
+    if (recordPath && !lockstep.get_log().save(recordPath)) {
+        std::cerr << "Couldn't write " << recordPath << "\n";
+        return 1;
     }
 }
\ No newline at end of file
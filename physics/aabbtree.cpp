@@ -0,0 +1,247 @@
+// Dynamic AABB tree inserts, removes, moves and rebalancing
+
+#include "aabbtree.h"
+
+// Box covering two boxes
+static AABB combine(const AABB& a, const AABB& b) {
+    return AABB{Vector(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y)),
+                Vector(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y))};
+}
+
+// Perimeter of a box (the tree is built to keep this small, since a query is
+// about as likely to hit a box as its perimeter is big)
+static float perimeter(const AABB& box) {
+    return 2 * (box.max.x - box.min.x + box.max.y - box.min.y);
+}
+
+static bool contains(const AABB& outer, const AABB& inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y &&
+           inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+}
+
+// Slab test: clip the ray against the box one axis at a time
+float AABBTree::rayBox(Vector from, Vector d, const AABB& box) {
+    float enter = 0;
+    float exit = INFINITY;
+    const float start[2] = {from.x, from.y};
+    const float dir[2] = {d.x, d.y};
+    const float low[2] = {box.min.x, box.min.y};
+    const float high[2] = {box.max.x, box.max.y};
+    for (int axis = 0; axis < 2; axis++) {
+        if (dir[axis] == 0) {
+            if (start[axis] < low[axis] || start[axis] > high[axis]) {
+                return INFINITY;
+            }
+            continue;
+        }
+        float inverse = 1 / dir[axis];
+        float t0 = (low[axis] - start[axis]) * inverse;
+        float t1 = (high[axis] - start[axis]) * inverse;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        enter = std::max(enter, t0);
+        exit = std::min(exit, t1);
+        if (enter > exit) {
+            return INFINITY;
+        }
+    }
+    return enter;
+}
+
+uint32_t AABBTree::insert(const AABB& box, uint32_t value) {
+    uint32_t leaf = allocate();
+    Node& node = nodes[leaf];
+    node.box = AABB{Vector(box.min.x - margin, box.min.y - margin),
+                    Vector(box.max.x + margin, box.max.y + margin)};
+    data[leaf] = value;
+    insertLeaf(leaf);
+    count++;
+    return leaf;
+}
+
+void AABBTree::remove(uint32_t proxy) {
+    removeLeaf(proxy);
+    release(proxy);
+    count--;
+}
+
+bool AABBTree::move(uint32_t proxy, const AABB& box) {
+    Node& node = nodes[proxy];
+    if (contains(node.box, box)) {
+        return false;
+    }
+    AABB fat = AABB{Vector(box.min.x - margin, box.min.y - margin),
+                    Vector(box.max.x + margin, box.max.y + margin)};
+
+    // Still near where it was, so its spot in the tree is still a good one.
+    // Just grow the boxes above it to fit.
+    if (fat.overlaps(node.box)) {
+        node.box = fat;
+        refit(node.parent);
+        return true;
+    }
+    removeLeaf(proxy);
+    nodes[proxy].box = fat;
+    insertLeaf(proxy);
+    return true;
+}
+
+uint32_t AABBTree::allocate() {
+    uint32_t id;
+    if (freeList != null) {
+        id = freeList;
+        freeList = nodes[id].parent;
+        nodes[id] = Node();
+    } else {
+        id = (uint32_t)nodes.size();
+        nodes.emplace_back();
+        data.push_back(0);
+    }
+    return id;
+}
+
+void AABBTree::release(uint32_t id) {
+    nodes[id].parent = freeList;
+    nodes[id].height = null; // Marks it free
+    freeList = id;
+}
+
+void AABBTree::insertLeaf(uint32_t leaf) {
+    if (root == null) {
+        root = leaf;
+        nodes[leaf].parent = null;
+        return;
+    }
+
+    // Walk down to the sibling that makes the tree's perimeter grow the
+    // least: at each node, compare making the leaf its sibling right here
+    // against the cheapest it could get going down either child
+    AABB box = nodes[leaf].box;
+    uint32_t index = root;
+    while (!nodes[index].leaf()) {
+        const Node& node = nodes[index];
+        float area = perimeter(node.box);
+        float combined = perimeter(combine(node.box, box));
+        float cost = 2 * combined;
+        float inherited = 2 * (combined - area);
+
+        float childCost[2];
+        uint32_t children[2] = {node.left, node.right};
+        for (int k = 0; k < 2; k++) {
+            const Node& child = nodes[children[k]];
+            float grown = perimeter(combine(child.box, box));
+            childCost[k] = child.leaf()
+                               ? grown + inherited
+                               : grown - perimeter(child.box) + inherited;
+        }
+        if (cost < childCost[0] && cost < childCost[1]) {
+            break;
+        }
+        index = childCost[0] < childCost[1] ? node.left : node.right;
+    }
+
+    // Put a new parent in between the sibling and its old parent
+    uint32_t sibling = index;
+    uint32_t oldParent = nodes[sibling].parent;
+    uint32_t parent = allocate();
+    nodes[parent].parent = oldParent;
+    nodes[parent].box = combine(box, nodes[sibling].box);
+    nodes[parent].height = nodes[sibling].height + 1;
+    nodes[parent].left = sibling;
+    nodes[parent].right = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+    if (oldParent == null) {
+        root = parent;
+    } else if (nodes[oldParent].left == sibling) {
+        nodes[oldParent].left = parent;
+    } else {
+        nodes[oldParent].right = parent;
+    }
+    refit(oldParent);
+}
+
+void AABBTree::removeLeaf(uint32_t leaf) {
+    if (leaf == root) {
+        root = null;
+        return;
+    }
+
+    // The leaf's sibling takes its parent's place
+    uint32_t parent = nodes[leaf].parent;
+    uint32_t grandParent = nodes[parent].parent;
+    uint32_t sibling =
+        nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+    nodes[sibling].parent = grandParent;
+    if (grandParent == null) {
+        root = sibling;
+    } else if (nodes[grandParent].left == parent) {
+        nodes[grandParent].left = sibling;
+    } else {
+        nodes[grandParent].right = sibling;
+    }
+    release(parent);
+    refit(grandParent);
+}
+
+void AABBTree::refit(uint32_t id) {
+    while (id != null) {
+        id = balance(id);
+        Node& node = nodes[id];
+        const Node& left = nodes[node.left];
+        const Node& right = nodes[node.right];
+        node.box = combine(left.box, right.box);
+        node.height = 1 + std::max(left.height, right.height);
+        id = node.parent;
+    }
+}
+
+uint32_t AABBTree::balance(uint32_t a) {
+    Node& A = nodes[a];
+    if (A.leaf() || A.height < 2) {
+        return a;
+    }
+    int difference = (int)nodes[A.right].height - (int)nodes[A.left].height;
+    if (difference >= -1 && difference <= 1) {
+        return a;
+    }
+
+    // Rotate the taller child (c) up into a's spot. a keeps the shorter
+    // child and takes the shorter of c's children, and c keeps the taller.
+    bool rightTaller = difference > 1;
+    uint32_t c = rightTaller ? A.right : A.left;
+    uint32_t other = rightTaller ? A.left : A.right;
+    Node& C = nodes[c];
+    uint32_t f = C.left;
+    uint32_t g = C.right;
+    if (nodes[f].height < nodes[g].height ||
+        (nodes[f].height == nodes[g].height && f > g)) {
+        std::swap(f, g);
+    }
+    // f is the taller (or the one that stays up), g moves down under a
+
+    C.parent = A.parent;
+    if (C.parent == null) {
+        root = c;
+    } else if (nodes[C.parent].left == a) {
+        nodes[C.parent].left = c;
+    } else {
+        nodes[C.parent].right = c;
+    }
+    A.parent = c;
+    C.left = a;
+    C.right = f;
+    if (rightTaller) {
+        A.right = g;
+    } else {
+        A.left = g;
+    }
+    nodes[g].parent = a;
+
+    A.box = combine(nodes[other].box, nodes[g].box);
+    A.height = 1 + std::max(nodes[other].height, nodes[g].height);
+    C.box = combine(A.box, nodes[f].box);
+    C.height = 1 + std::max(A.height, nodes[f].height);
+    return c;
+}
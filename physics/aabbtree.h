@@ -0,0 +1,203 @@
+// Dynamic AABB tree: a balanced binary tree of bounding boxes, for finding
+// what's near a point, a box or a ray without looking at everything. Leaves
+// get fattened boxes, so something moving a little stays inside its leaf's
+// box and the tree doesn't change at all. Something that drifts out just
+// grows its leaf and refits the boxes above it, and only something that
+// jumps well away gets taken out and put back in. Inserting and removing
+// rotate the tree to keep it balanced, so every query is about log n.
+
+#pragma once
+
+#include "vector.h"
+#include <algorithm>
+#include <cstdint>
+#include <math.h>
+#include <vector>
+
+class AABBTree {
+  public:
+    static constexpr uint32_t null = UINT32_MAX;
+
+    // Constructor (margin is how far leaf boxes get fattened on every side)
+    AABBTree(float margin = 4) : margin(margin) {
+    }
+
+    // Add a box and get its proxy id (value is whatever the caller wants back
+    // from queries)
+    uint32_t insert(const AABB& box, uint32_t value);
+
+    void remove(uint32_t proxy);
+
+    // Update a proxy's box. Returns whether the tree had to change.
+    bool move(uint32_t proxy, const AABB& box);
+
+    void clear() {
+        nodes.clear();
+        data.clear();
+        root = null;
+        freeList = null;
+        count = 0;
+    }
+
+    uint32_t get_data(uint32_t proxy) const {
+        return data[proxy];
+    }
+
+    const AABB& get_fat_box(uint32_t proxy) const {
+        return nodes[proxy].box;
+    }
+
+    // Leaves in the tree
+    uint32_t size() const {
+        return count;
+    }
+
+    // Longest path from the root to a leaf
+    uint32_t get_height() const {
+        return root == null ? 0 : nodes[root].height;
+    }
+
+    // Call fn(proxy) for every leaf whose fat box overlaps box. Stops early if
+    // fn returns false.
+    template <typename Fn>
+    void query(const AABB& box, Fn&& fn) const {
+        uint32_t stack[maxDepth];
+        int top = 0;
+        if (root != null) {
+            stack[top++] = root;
+        }
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (!node.box.overlaps(box)) {
+                continue;
+            }
+            if (node.leaf()) {
+                if (!fn((uint32_t)(&node - nodes.data()))) {
+                    return;
+                }
+            } else {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+    }
+
+    // Walk the leaves a ray from from to to passes through. fn(proxy, limit)
+    // checks the actual shape and returns the fraction along the ray it hit
+    // at (which cuts the ray short for everything after), or anything over
+    // limit to ignore it. Returning 0 stops the walk.
+    template <typename Fn>
+    void raycast(Vector from, Vector to, Fn&& fn) const {
+        float limit = 1;
+        Vector d(to.x - from.x, to.y - from.y);
+        uint32_t stack[maxDepth];
+        int top = 0;
+        if (root != null) {
+            stack[top++] = root;
+        }
+        while (top > 0) {
+            uint32_t id = stack[--top];
+            const Node& node = nodes[id];
+            if (rayBox(from, d, node.box) > limit) {
+                continue;
+            }
+            if (node.leaf()) {
+                float hit = fn(id, limit);
+                if (hit == 0) {
+                    return;
+                }
+                limit = std::min(limit, hit);
+            } else {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+    }
+
+    // Find the leaf closest to a point. fn(proxy) gives the distance to the
+    // actual shape (the box is only used to skip branches that can't be any
+    // closer). Returns null if nothing's within maxDistance.
+    template <typename Fn>
+    uint32_t nearest(Vector p, float maxDistance, Fn&& fn) const {
+        uint32_t best = null;
+        float bestDistance = maxDistance;
+        uint32_t stack[maxDepth];
+        int top = 0;
+        if (root != null) {
+            stack[top++] = root;
+        }
+        while (top > 0) {
+            uint32_t id = stack[--top];
+            const Node& node = nodes[id];
+            if (boxDistance(p, node.box) >= bestDistance) {
+                continue;
+            }
+            if (node.leaf()) {
+                float distance = fn(id);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = id;
+                }
+                continue;
+            }
+            // Closer child last, so it comes off the stack first
+            const AABB& l = nodes[node.left].box;
+            const AABB& r = nodes[node.right].box;
+            bool leftFirst = boxDistance(p, l) < boxDistance(p, r);
+            stack[top++] = leftFirst ? node.right : node.left;
+            stack[top++] = leftFirst ? node.left : node.right;
+        }
+        return best;
+    }
+
+    // Distance from a point to a box (0 inside)
+    static float boxDistance(Vector p, const AABB& box) {
+        float dx = std::max({box.min.x - p.x, 0.0f, p.x - box.max.x});
+        float dy = std::max({box.min.y - p.y, 0.0f, p.y - box.max.y});
+        return sqrtf(dx * dx + dy * dy);
+    }
+
+    // Fraction along from + d * t where a ray enters a box (0 if it starts
+    // inside, something over 1 if it misses)
+    static float rayBox(Vector from, Vector d, const AABB& box);
+
+  private:
+    // Deep enough for any balanced tree that fits in memory
+    static constexpr int maxDepth = 256;
+
+    struct Node {
+        AABB box;
+        uint32_t parent = null; // Next free node, for free nodes
+        uint32_t left = null;
+        uint32_t right = null;
+        uint32_t height = 0; // 0 for leaves
+
+        bool leaf() const {
+            return left == null;
+        }
+    };
+
+    uint32_t allocate();
+    void release(uint32_t id);
+
+    // Hang a leaf off the cheapest spot, and take one back out
+    void insertLeaf(uint32_t leaf);
+    void removeLeaf(uint32_t leaf);
+
+    // Redo the boxes and heights from a node up to the root, rebalancing
+    // along the way
+    void refit(uint32_t id);
+
+    // Rotate a node's taller child up if it's unbalanced, and return whatever
+    // ends up in its place
+    uint32_t balance(uint32_t a);
+
+    // Nodes are kept to 32 bytes (two to a cache line), so each leaf's data
+    // goes off to the side
+    std::vector<Node> nodes;
+    std::vector<uint32_t> data;
+    uint32_t root = null;
+    uint32_t freeList = null;
+    uint32_t count = 0;
+    float margin;
+};
@@ -0,0 +1,25 @@
+// Scratch arena
+
+#include "arena.h"
+#include <algorithm>
+
+void FrameArena::reset() {
+    // If the last step spilled over, grow so the next one fits in one block
+    if (!spills.empty()) {
+        capacity = std::max(capacity * 2, peak);
+        buffer.reset(new char[capacity]);
+        spills.clear();
+        spilled = 0;
+    }
+    used = 0;
+}
+
+void* FrameArena::spill(size_t bytes, size_t align) {
+    spills.emplace_back(new char[bytes + align]);
+    spilled += bytes + align;
+    peak = std::max(peak, used + spilled);
+
+    // Line the block up by hand
+    size_t address = (size_t)spills.back().get();
+    return spills.back().get() + ((align - address % align) % align);
+}
@@ -0,0 +1,67 @@
+// Scratch memory for things that only live for one step (island lists, solver
+// jobs, contacts). Allocating is just bumping an offset and everything gets
+// thrown away at once with reset(), so steps don't touch the heap at all once
+// the arena has grown to fit the biggest step so far.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class FrameArena {
+  public:
+    // Constructor
+    FrameArena(size_t bytes = 1 << 20)
+        : buffer(new char[bytes]), capacity(bytes) {
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Get room for count Ts (not constructed, and never freed one at a time)
+    template <typename T>
+    T* allocate(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        size_t start = (used + align - 1) & ~(align - 1);
+        if (start + bytes > capacity) {
+            return spill(bytes, align);
+        }
+        used = start + bytes;
+        peak = std::max(peak, used);
+        return buffer.get() + start;
+    }
+
+    // Throw away everything from the last step
+    void reset();
+
+    size_t get_used() const {
+        return used;
+    }
+
+    size_t get_capacity() const {
+        return capacity;
+    }
+
+    // Most ever used in one step
+    size_t get_peak() const {
+        return peak;
+    }
+
+  private:
+    // Handle a step that didn't fit (gets its own block until the next reset
+    // grows the main buffer)
+    void* spill(size_t bytes, size_t align);
+
+    // Arena variables
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t used = 0;
+    size_t peak = 0;
+    size_t spilled = 0;
+    std::vector<std::unique_ptr<char[]>> spills;
+};
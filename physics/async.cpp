@@ -0,0 +1,126 @@
+// Simulation thread, its command queue and handing frames over
+
+#include "async.h"
+#include <atomic>
+
+AsyncWorld::AsyncWorld(World& world, Lockstep* lockstep)
+    : world(world), lockstep(lockstep) {
+    // Something to read before anything's run
+    publish();
+    thread = std::thread([this] { run(); });
+}
+
+AsyncWorld::~AsyncWorld() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+        commands.clear();
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+std::future<uint64_t> AsyncWorld::step_async(uint32_t n) {
+    auto steps = [this, n](World& w) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (lockstep) {
+                lockstep->tick();
+            } else {
+                w.step(w.get_timestep());
+            }
+        }
+        return w.get_step_count();
+    };
+    // Steps get noticed by the step count, no need to count them as changes
+    return enqueue(steps, false);
+}
+
+std::future<int> AsyncWorld::advance_async(float elapsed) {
+    auto steps = [this, elapsed](World& w) {
+        return lockstep ? lockstep->advance(elapsed) : w.advance(elapsed);
+    };
+    return enqueue(steps, false);
+}
+
+void AsyncWorld::input(InputType type) {
+    auto queue = [this, type] {
+        if (lockstep) {
+            lockstep->input(type);
+        }
+    };
+    // Only queued in the lockstep until the next tick, which is when the
+    // world actually changes
+    push({queue, false});
+}
+
+std::shared_ptr<const WorldFrame> AsyncWorld::get_frame() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return front;
+}
+
+void AsyncWorld::push(Command command) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        commands.push_back(std::move(command));
+    }
+    wake.notify_all();
+}
+
+void AsyncWorld::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return !commands.empty() || quit; });
+        if (quit) {
+            return;
+        }
+        Command command = std::move(commands.front());
+        commands.pop_front();
+
+        // Only this thread touches the world, so run it without the lock
+        // (the host can keep queueing meanwhile)
+        guard.unlock();
+        uint64_t step = world.get_step_count();
+        command.run();
+        dirty = dirty || command.changes || world.get_step_count() != step;
+        guard.lock();
+
+        // Copy the world out after steps, or once the queue's empty for
+        // anything else, so a burst of inputs and posts doesn't copy every
+        // body once each
+        bool stepped = world.get_step_count() != front->state.step;
+        if (dirty && (stepped || commands.empty())) {
+            guard.unlock();
+            publish();
+            dirty = false;
+            guard.lock();
+        }
+    }
+}
+
+void AsyncWorld::publish() {
+    // Fill the spare frame, unless the host's still holding on to it.
+    // use_count() is a relaxed read, so fence to make sure the host's done
+    // reading it before writing over it.
+    if (!spare || spare.use_count() > 1) {
+        spare = std::make_shared<WorldFrame>();
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    WorldFrame& f = *spare;
+    const BodyStore& bodies = world.get_bodies();
+    f.state.capture(bodies, world.get_statics(), &world.get_particles());
+    f.state.step = world.get_step_count();
+    f.bodyCount = bodies.size();
+    f.particleCount = world.get_particles().size();
+    f.awakeCount = bodies.awakeCount();
+    f.pairCount = (uint32_t)world.get_broad_phase().get_pairs().size();
+    f.contactCount = world.get_contact_count();
+    f.broadPhase = world.get_broad_phase().name();
+    if (lockstep) {
+        f.gravity = lockstep->get_gravity();
+        f.gravityScale = lockstep->get_gravity_scale();
+        f.diverged = lockstep->get_diverged();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::swap(front, spare);
+}
@@ -0,0 +1,136 @@
+// Async stepping: the world lives on its own simulation thread and the host
+// only ever talks to it through a queue of commands. Steps, inputs and
+// anything else that changes the world get queued and run in order between
+// steps, and each one hands back a future the host can check whenever it
+// likes (or never). Whenever steps have run (or something else has changed
+// the world and the queue's run dry) the thread copies what the host wants
+// to see into a frame, so drawing and stats read the last finished one,
+// queries come back as futures too, and nothing on the host's side ever
+// waits on physics.
+//
+//   AsyncWorld sim(world, &lockstep);
+//   auto f = sim.step_async(600);            // Off it goes
+//   sim.input(InputType::Spawn);             // Lands before the next step
+//   ...                                      // Do whatever meanwhile
+//   std::shared_ptr<const WorldFrame> frame = sim.get_frame();
+
+#pragma once
+
+#include "lockstep.h"
+#include "render.h"
+#include "world.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Everything the host reads from a finished step, copied off the world.
+// Queries go to the world itself (see AsyncWorld::query), since its trees
+// can answer them far faster than a search through a copy.
+struct WorldFrame {
+    RenderState state; // Statics first, then bodies, then particles
+    uint32_t bodyCount = 0;
+    uint32_t awakeCount = 0;
+    uint32_t particleCount = 0;
+    uint32_t pairCount = 0;
+    uint32_t contactCount = 0;
+    std::string broadPhase;
+
+    // From the lockstep, if there is one
+    Vector gravity;
+    int gravityScale = 0;
+    uint64_t diverged = UINT64_MAX;
+};
+
+class AsyncWorld {
+  public:
+    // Constructor (steps go through lockstep's tick() if there is one, so
+    // inputs get recorded, and world.step() if not). The world and the
+    // lockstep belong to the simulation thread from here on.
+    AsyncWorld(World& world, Lockstep* lockstep = nullptr);
+
+    // Destructor (finishes the command in progress and drops the rest, whose
+    // futures then throw broken_promise)
+    ~AsyncWorld();
+
+    AsyncWorld(const AsyncWorld&) = delete;
+    AsyncWorld& operator=(const AsyncWorld&) = delete;
+
+    // Run n fixed steps after everything already queued. The future gets
+    // the world's step count once they're done.
+    std::future<uint64_t> step_async(uint32_t n);
+
+    // Run as many fixed steps as fit in elapsed real time (like advance())
+    // and get how many ran
+    std::future<int> advance_async(float elapsed);
+
+    // Queue an input for the next step (needs a lockstep)
+    void input(InputType type);
+
+    // Run fn(world) on the simulation thread between steps and get what it
+    // returns. The world might have changed, so a new frame follows.
+    template <typename Fn>
+    auto post(Fn fn) -> std::future<decltype(fn(std::declval<World&>()))> {
+        return enqueue(std::move(fn), true);
+    }
+
+    // Same thing for something that only reads the world (like a query),
+    // which doesn't need a new frame after it
+    template <typename Fn>
+    auto query(Fn fn)
+        -> std::future<decltype(fn(std::declval<const World&>()))> {
+        return enqueue(
+            [fn](World& w) mutable {
+                const World& view = w;
+                return fn(view);
+            },
+            false);
+    }
+
+    // The last finished frame. Holding on to it keeps it around, however
+    // many more get finished meanwhile.
+    std::shared_ptr<const WorldFrame> get_frame() const;
+
+  private:
+    struct Command {
+        std::function<void()> run;
+        bool changes; // Might change the world without stepping it
+    };
+
+    // Wrap fn up as a command and hand back its future
+    template <typename Fn>
+    auto enqueue(Fn fn, bool changes)
+        -> std::future<decltype(fn(std::declval<World&>()))> {
+        using Result = decltype(fn(std::declval<World&>()));
+        auto task = std::make_shared<std::packaged_task<Result()>>(
+            [this, fn]() mutable { return fn(world); });
+        std::future<Result> result = task->get_future();
+        push({[task] { (*task)(); }, changes});
+        return result;
+    }
+
+    // Add a command to the queue
+    void push(Command command);
+
+    // Simulation thread loop
+    void run();
+
+    // Copy the world into a frame and make it the current one
+    void publish();
+
+    World& world;
+    Lockstep* lockstep;
+    std::deque<Command> commands;
+    std::shared_ptr<WorldFrame> front; // Last finished frame
+    std::shared_ptr<WorldFrame> spare; // Filled next, if nobody has it
+    std::thread thread;
+    mutable std::mutex lock;
+    std::condition_variable wake;
+    bool quit = false;
+    bool dirty = false; // Changed since the last frame (simulation thread)
+};
@@ -0,0 +1,577 @@
+// Body storage: shape types, spawn parameters, the structure of arrays store
+// and the Shape view into it
+
+#pragma once
+
+#include "vector.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// RGBA color (same layout as tigr's TPixel, so the app can convert for free)
+struct Color {
+    Color(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0, uint8_t a = 0xFF)
+        : r(r), g(g), b(b), a(a) {
+    }
+
+    uint8_t r, g, b, a;
+};
+
+// Kinds of shapes the body store knows about (Count has to stay last)
+enum class ShapeType : uint8_t { Circle, Rectangle, Count };
+
+// Everything needed to spawn a circle
+class Circle {
+  public:
+    // Constructor
+    Circle(Vector p, float r, Color c = Color(0xFF, 0xFF, 0xFF),
+           Vector a = Vector(0, -200.0f), Vector v = Vector(0, 0))
+        : center(p), radius(r), color(c), acceleration(a), velocity(v) {
+    }
+
+    // Circle variables
+    Vector center;
+    float radius;
+    Color color;
+    Vector acceleration;
+    Vector velocity;
+};
+
+// Everything needed to spawn a rectangle
+class Rectangle {
+  public:
+    // Constructor
+    Rectangle(Vector pos, Vector e, Color c = Color(0xFF, 0xFF, 0xFF),
+              Vector a = Vector(0, -200.0f), Vector v = Vector(0, 0))
+        : center(pos), size(e), color(c), acceleration(a), velocity(v) {
+    }
+
+    // Rectangle variables
+    Vector center;
+    Vector size;
+    Color color;
+    Vector acceleration;
+    Vector velocity;
+};
+
+// Stable reference to a body. Bodies get shuffled around inside the store
+// when others are removed, but a handle always finds the same body (or can
+// tell it's gone, thanks to the generation count).
+struct BodyHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+class Shape;
+
+// Storage for every body, one array per field (structure of arrays) instead
+// of one heap object per shape. The physics loops walk straight through these
+// arrays. Circles store their radius as both half extents, so bounds and wall
+// checks work the same for every shape. It also works as the body pool:
+// removing is O(1), freed slots get reused, and the arrays never shrink, so
+// spawning and removing forever doesn't grow the heap past the busiest point.
+//
+// Bodies that have come to rest get put to sleep, and sleeping bodies are
+// kept at the end of the arrays. Everything that only cares about moving
+// bodies can just loop over [0, awakeCount()).
+class BodyStore {
+  public:
+    // Add a new body and get a handle to it
+    BodyHandle add(const Circle& c) {
+        return add(ShapeType::Circle, c.center, Vector(c.radius, c.radius),
+                   c.color, c.acceleration, c.velocity);
+    }
+
+    BodyHandle add(const Rectangle& r) {
+        return add(ShapeType::Rectangle, r.center,
+                   Vector(r.size.x / 2, r.size.y / 2), r.color, r.acceleration,
+                   r.velocity);
+    }
+
+    // Remove a body by swapping it to the end and dropping it
+    void remove(BodyHandle h) {
+        if (!valid(h)) {
+            return;
+        }
+        // Whatever a sleeping body was holding up is about to fall, so wake
+        // its group first
+        if (asleep(slots[h.index])) {
+            wakeGroup(h.index);
+        }
+        // Swap it to the end of the awake bodies, then to the very end, so
+        // the sleeping ones stay together
+        swapBodies(slots[h.index], awake - 1);
+        swapBodies(awake - 1, size() - 1);
+        awake--;
+        popBack();
+        sleepVersion++;
+        changeCount++;
+
+        // Retire the slot so old handles stop working
+        generations[h.index]++;
+        freeSlots.push_back(h.index);
+    }
+
+    // Make room for this many bodies up front, so spawning up to that many
+    // (and any amount of spawning and removing after) never allocates
+    void reserve(uint32_t count) {
+        for (auto array :
+             {&px, &py, &vx, &vy, &ax, &ay, &hx, &hy, &sleepTime}) {
+            array->reserve(count);
+        }
+        color.reserve(count);
+        type.reserve(count);
+        intersecting.reserve(count);
+        owners.reserve(count);
+        slots.reserve(count);
+        generations.reserve(count);
+        freeSlots.reserve(count);
+        sleepNext.reserve(count);
+        pendingWakes.reserve(count);
+    }
+
+    // Remove every body
+    void clear() {
+        for (uint32_t owner : owners) {
+            generations[owner]++;
+            freeSlots.push_back(owner);
+        }
+        owners.clear();
+        px.clear();
+        py.clear();
+        vx.clear();
+        vy.clear();
+        ax.clear();
+        ay.clear();
+        hx.clear();
+        hy.clear();
+        color.clear();
+        type.clear();
+        intersecting.clear();
+        sleepTime.clear();
+        pendingWakes.clear();
+        awake = 0;
+        sleepVersion++;
+        changeCount++;
+    }
+
+    // Check if a handle still points at a body
+    bool valid(BodyHandle h) const {
+        return h.index < generations.size() &&
+               generations[h.index] == h.generation;
+    }
+
+    // Convert between handles and array indices
+    uint32_t indexOf(BodyHandle h) const {
+        return slots[h.index];
+    }
+
+    BodyHandle handleAt(uint32_t i) const {
+        return BodyHandle{owners[i], generations[owners[i]]};
+    }
+
+    uint32_t size() const {
+        return (uint32_t)px.size();
+    }
+
+    // Handle slots ever handed out (in use or not), so handle indices are
+    // always below this
+    uint32_t get_slot_count() const {
+        return (uint32_t)generations.size();
+    }
+
+    // Bounding box of the body at an index
+    AABB bounds(uint32_t i) const {
+        return AABB{Vector(px[i] - hx[i], py[i] - hy[i]),
+                    Vector(px[i] + hx[i], py[i] + hy[i])};
+    }
+
+    // Whether a body moves far enough in dt to skip past something its own
+    // size (more than half its smallest half extent)
+    bool fast(uint32_t i, float dt) const {
+        float reach = std::min(hx[i], hy[i]) / 2;
+        return (vx[i] * vx[i] + vy[i] * vy[i]) * dt * dt > reach * reach;
+    }
+
+    // Bounding box stretched over everywhere the body goes in dt, for fast
+    // bodies (everything else just gets its normal box)
+    AABB sweptBounds(uint32_t i, float dt) const {
+        AABB box = bounds(i);
+        if (fast(i, dt)) {
+            box.min.x += std::min(vx[i] * dt, 0.0f);
+            box.min.y += std::min(vy[i] * dt, 0.0f);
+            box.max.x += std::max(vx[i] * dt, 0.0f);
+            box.max.y += std::max(vy[i] * dt, 0.0f);
+        }
+        return box;
+    }
+
+    // 1 / mass of the body at an index. Circles weigh their radius squared
+    // and rectangles their area, same as always.
+    float inverseMass(uint32_t i) const {
+        if (type[i] == ShapeType::Circle) {
+            return 1 / (hx[i] * hx[i]);
+        }
+        return 1 / (4 * hx[i] * hy[i]);
+    }
+
+    // Number of awake bodies (they're always the first ones in the arrays)
+    uint32_t awakeCount() const {
+        return awake;
+    }
+
+    bool asleep(uint32_t i) const {
+        return i >= awake;
+    }
+
+    // Put a group of awake bodies to sleep. They get linked together, so
+    // waking any of them wakes the whole group (a stack shouldn't come back
+    // one body at a time). Takes handles since this moves bodies around.
+    void sleep(const BodyHandle* group, uint32_t count) {
+        for (uint32_t k = 0; k < count; k++) {
+            uint32_t slot = group[k].index;
+            sleepNext[slot] = group[(k + 1) % count].index;
+            uint32_t i = slots[slot];
+            vx[i] = 0;
+            vy[i] = 0;
+            intersecting[i] = 0;
+            swapBodies(i, --awake);
+        }
+        sleepVersion++;
+    }
+
+    // Ask for a sleeping body (and its group) to wake up. Nothing moves until
+    // wakePending() runs at the start of the next step, so indices stay put
+    // in the meantime (it's safe to call while looping over the bodies).
+    void wake(uint32_t i) {
+        if (asleep(i)) {
+            pendingWakes.push_back(handleAt(i));
+        }
+    }
+
+    // Move every body asked to wake up back in with the awake ones
+    void wakePending() {
+        for (BodyHandle h : pendingWakes) {
+            if (valid(h) && asleep(slots[h.index])) {
+                wakeGroup(h.index);
+            }
+        }
+        pendingWakes.clear();
+    }
+
+    // Whether anything's waiting on wakePending()
+    bool has_pending_wakes() const {
+        return !pendingWakes.empty();
+    }
+
+    // Bumped whenever the sleeping bodies change or move around in the
+    // arrays, so a broad phase can keep them binned between steps
+    uint64_t get_sleep_version() const {
+        return sleepVersion;
+    }
+
+    // Bumped whenever a body gets added or removed
+    uint64_t get_change_count() const {
+        return changeCount;
+    }
+
+    // Shape view of the body at an index (defined after Shape)
+    Shape at(uint32_t i);
+
+    // Iterate over every body as a Shape
+    class Iterator {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Shape;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Shape;
+
+        Iterator(BodyStore* s, uint32_t i) : store(s), index(i) {
+        }
+
+        Shape operator*() const;
+
+        Iterator& operator++() {
+            index++;
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return index == other.index;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return index != other.index;
+        }
+
+      private:
+        BodyStore* store;
+        uint32_t index;
+    };
+
+    Iterator begin() {
+        return Iterator(this, 0);
+    }
+
+    Iterator end() {
+        return Iterator(this, size());
+    }
+
+    // Body arrays (all indexed the same way)
+    std::vector<float> px, py; // Center
+    std::vector<float> vx, vy; // Velocity
+    std::vector<float> ax, ay; // Acceleration
+    std::vector<float> hx, hy; // Half extents (radius for circles)
+    std::vector<Color> color;
+    std::vector<ShapeType> type;
+    std::vector<uint8_t> intersecting;
+    std::vector<float> sleepTime; // Seconds spent resting
+
+  private:
+    BodyHandle add(ShapeType t, Vector p, Vector half, Color c, Vector a,
+                   Vector v) {
+        // Reuse a retired slot if there is one
+        uint32_t slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = (uint32_t)generations.size();
+            generations.push_back(0);
+            slots.push_back(0);
+            sleepNext.push_back(0);
+        }
+        slots[slot] = size();
+        owners.push_back(slot);
+
+        px.push_back(p.x);
+        py.push_back(p.y);
+        vx.push_back(v.x);
+        vy.push_back(v.y);
+        ax.push_back(a.x);
+        ay.push_back(a.y);
+        hx.push_back(half.x);
+        hy.push_back(half.y);
+        color.push_back(c);
+        type.push_back(t);
+        intersecting.push_back(0);
+        sleepTime.push_back(0);
+
+        // New bodies start awake
+        if (awake + 1 < size()) {
+            swapBodies(size() - 1, awake);
+            sleepVersion++;
+        }
+        awake++;
+        changeCount++;
+        return BodyHandle{slot, generations[slot]};
+    }
+
+    // Swap two bodies' spots in the arrays
+    void swapBodies(uint32_t i, uint32_t j) {
+        if (i == j) {
+            return;
+        }
+        for (auto array :
+             {&px, &py, &vx, &vy, &ax, &ay, &hx, &hy, &sleepTime}) {
+            std::swap((*array)[i], (*array)[j]);
+        }
+        std::swap(color[i], color[j]);
+        std::swap(type[i], type[j]);
+        std::swap(intersecting[i], intersecting[j]);
+        std::swap(owners[i], owners[j]);
+        slots[owners[i]] = i;
+        slots[owners[j]] = j;
+    }
+
+    // Wake a sleeping group, starting from one of its handle slots
+    void wakeGroup(uint32_t slot) {
+        uint32_t s = slot;
+        do {
+            swapBodies(slots[s], awake);
+            sleepTime[awake++] = 0;
+            s = sleepNext[s];
+        } while (s != slot);
+        sleepVersion++;
+    }
+
+    void popBack() {
+        owners.pop_back();
+        px.pop_back();
+        py.pop_back();
+        vx.pop_back();
+        vy.pop_back();
+        ax.pop_back();
+        ay.pop_back();
+        hx.pop_back();
+        hy.pop_back();
+        color.pop_back();
+        type.pop_back();
+        intersecting.pop_back();
+        sleepTime.pop_back();
+    }
+
+    // Snapshots save and restore the bookkeeping too
+    friend class Snapshot;
+
+    // Sleep bookkeeping
+    uint32_t awake = 0;
+    uint64_t sleepVersion = 0;
+    uint64_t changeCount = 0;
+    std::vector<uint32_t> sleepNext; // Handle index -> next in its group
+    std::vector<BodyHandle> pendingWakes;
+
+    // Handle bookkeeping
+    std::vector<uint32_t> slots;       // Handle index -> array index
+    std::vector<uint32_t> owners;      // Array index -> handle index
+    std::vector<uint32_t> generations; // Bumped every time a slot is freed
+    std::vector<uint32_t> freeSlots;
+};
+
+// Check if two circles overlap (without a square root)
+inline bool circlesOverlap(Vector a, float ra, Vector b, float rb) {
+    float radii = ra + rb;
+    return (a - b).length_squared() < radii * radii;
+}
+
+// Check if a rectangle (center and half size) overlaps a circle
+inline bool rectCircleOverlap(Vector rect, Vector half, Vector circle, float r) {
+    // Find the closest point to the circle's center on the rectangle
+    float closestX = std::clamp(circle.x, rect.x - half.x, rect.x + half.x);
+    float closestY = std::clamp(circle.y, rect.y - half.y, rect.y + half.y);
+
+    float distanceX = circle.x - closestX;
+    float distanceY = circle.y - closestY;
+
+    return (distanceX * distanceX + distanceY * distanceY) < (r * r);
+}
+
+// Check if two rectangles (center and half size) overlap
+inline bool rectsOverlap(Vector a, Vector ha, Vector b, Vector hb) {
+    return !(a.x + ha.x < b.x - hb.x || a.x - ha.x > b.x + hb.x ||
+             a.y + ha.y < b.y - hb.y || a.y - ha.y > b.y + hb.y);
+}
+
+// Check if two shapes of any type overlap (half is the radius for circles)
+inline bool shapesOverlap(ShapeType ta, Vector a, Vector ha, ShapeType tb,
+                          Vector b, Vector hb) {
+    if (ta == ShapeType::Circle) {
+        return tb == ShapeType::Circle ? circlesOverlap(a, ha.x, b, hb.x)
+                                       : rectCircleOverlap(b, hb, a, ha.x);
+    }
+    return tb == ShapeType::Circle ? rectCircleOverlap(a, ha, b, hb.x)
+                                   : rectsOverlap(a, ha, b, hb);
+}
+
+// A view of one body in the store that acts like the old shape objects, so
+// code that works with shapes one at a time doesn't need to know about the
+// arrays. It holds a handle, so it stays valid even if bodies are removed.
+// Changing a sleeping body through it wakes the body up.
+class Shape {
+  public:
+    // Constructor
+    Shape(BodyStore& s, BodyHandle h) : store(&s), handle(h) {
+    }
+
+    BodyHandle get_handle() const {
+        return handle;
+    }
+
+    ShapeType type() const {
+        return store->type[i()];
+    }
+
+    // Getters and setters for the body's fields
+    Vector center() const {
+        return Vector(store->px[i()], store->py[i()]);
+    }
+
+    void set_center(Vector p) {
+        store->wake(i());
+        store->px[i()] = p.x;
+        store->py[i()] = p.y;
+    }
+
+    Vector velocity() const {
+        return Vector(store->vx[i()], store->vy[i()]);
+    }
+
+    void set_velocity(Vector v) {
+        store->wake(i());
+        store->vx[i()] = v.x;
+        store->vy[i()] = v.y;
+    }
+
+    Vector acceleration() const {
+        return Vector(store->ax[i()], store->ay[i()]);
+    }
+
+    void set_acceleration(Vector a) {
+        store->wake(i());
+        store->ax[i()] = a.x;
+        store->ay[i()] = a.y;
+    }
+
+    Color color() const {
+        return store->color[i()];
+    }
+
+    bool intersecting() const {
+        return store->intersecting[i()];
+    }
+
+    bool asleep() const {
+        return store->asleep(i());
+    }
+
+    // Radius for circles
+    float radius() const {
+        return store->hx[i()];
+    }
+
+    // Full size for rectangles
+    Vector size() const {
+        return Vector(store->hx[i()], store->hy[i()]) * 2;
+    }
+
+    Vector half() const {
+        return Vector(store->hx[i()], store->hy[i()]);
+    }
+
+    // Check for intersection with a circle
+    bool intersects(const Circle& c) const {
+        if (type() == ShapeType::Circle) {
+            return circlesOverlap(center(), radius(), c.center, c.radius);
+        }
+        return rectCircleOverlap(center(), half(), c.center, c.radius);
+    }
+
+    // Check for intersection with a rectangle
+    bool intersects(const Rectangle& r) const {
+        Vector rHalf(r.size.x / 2, r.size.y / 2);
+        if (type() == ShapeType::Circle) {
+            return rectCircleOverlap(r.center, rHalf, center(), radius());
+        }
+        return rectsOverlap(center(), half(), r.center, rHalf);
+    }
+
+  private:
+    // Current array index of the body
+    uint32_t i() const {
+        return store->indexOf(handle);
+    }
+
+    BodyStore* store;
+    BodyHandle handle;
+};
+
+inline Shape BodyStore::at(uint32_t i) {
+    return Shape(*this, handleAt(i));
+}
+
+inline Shape BodyStore::Iterator::operator*() const {
+    return store->at(index);
+}
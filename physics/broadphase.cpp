@@ -0,0 +1,186 @@
+// Broad phase implementations
+
+#include "broadphase.h"
+#include <algorithm>
+#include <math.h>
+
+// Rebin every awake body and collect the candidate pairs
+void SpatialGrid::build(BodyStore& bodies, float dt) {
+    uint32_t awake = bodies.awakeCount();
+    boxes.resize(bodies.size());
+    ranges.resize(bodies.size());
+    refresh(bodies, 0, awake, dt);
+    bin(0, awake, cellStart, cellEntries);
+
+    // The sleeping bodies only need binning again if they changed
+    if (sleepVersion != bodies.get_sleep_version()) {
+        refresh(bodies, awake, bodies.size(), 0);
+        bin(awake, bodies.size(), sleepStart, sleepEntries);
+        sleepVersion = bodies.get_sleep_version();
+    }
+
+    // Test every pair inside each cell
+    pairs.clear();
+    for (int c = 0; c < cols * rows; c++) {
+        for (int i = cellStart[c]; i < cellStart[c + 1]; i++) {
+            for (int j = i + 1; j < cellStart[c + 1]; j++) {
+                uint32_t a = cellEntries[i];
+                uint32_t b = cellEntries[j];
+                if (boxes[a].overlaps(boxes[b]) &&
+                    cornerCell(ranges[a], ranges[b]) == c) {
+                    pairs.push_back({a, b});
+                }
+            }
+        }
+    }
+
+    // Then check the awake bodies against the sleeping cells they cover
+    sleepers.clear();
+    for (uint32_t a = 0; a < awake; a++) {
+        auto& r = ranges[a];
+        for (int y = r.y0; y <= r.y1; y++) {
+            for (int x = r.x0; x <= r.x1; x++) {
+                int c = y * cols + x;
+                for (int i = sleepStart[c]; i < sleepStart[c + 1]; i++) {
+                    uint32_t s = sleepEntries[i];
+                    if (boxes[a].overlaps(boxes[s]) &&
+                        cornerCell(r, ranges[s]) == c) {
+                        sleepers.push_back(s);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Cache the boxes and the range of cells each one covers
+void SpatialGrid::refresh(const BodyStore& bodies, uint32_t begin,
+                          uint32_t end, float dt) {
+    for (uint32_t i = begin; i < end; i++) {
+        boxes[i] = bodies.sweptBounds(i, dt);
+        ranges[i] = {cellX(boxes[i].min.x), cellY(boxes[i].min.y),
+                     cellX(boxes[i].max.x), cellY(boxes[i].max.y)};
+    }
+}
+
+// Counting sort the shapes into cells (no per-cell vectors to grow)
+void SpatialGrid::bin(uint32_t begin, uint32_t end, std::vector<int>& start,
+                      std::vector<uint32_t>& entries) {
+    start.assign(cols * rows + 1, 0);
+    for (uint32_t i = begin; i < end; i++) {
+        auto& r = ranges[i];
+        for (int y = r.y0; y <= r.y1; y++) {
+            for (int x = r.x0; x <= r.x1; x++) {
+                start[y * cols + x + 1]++;
+            }
+        }
+    }
+    for (size_t c = 1; c < start.size(); c++) {
+        start[c] += start[c - 1];
+    }
+    entries.resize(start.back());
+    cursor.assign(start.begin(), start.end() - 1);
+    for (uint32_t i = begin; i < end; i++) {
+        auto& r = ranges[i];
+        for (int y = r.y0; y <= r.y1; y++) {
+            for (int x = r.x0; x <= r.x1; x++) {
+                entries[cursor[y * cols + x]++] = i;
+            }
+        }
+    }
+}
+
+// Fix up the endpoint order and sweep for overlapping pairs
+void SweepAndPrune::build(BodyStore& bodies, float dt) {
+    sync(bodies);
+
+    // Refresh the boxes and the endpoint values (sleeping bodies haven't
+    // moved, unless they've been shuffled around in the store)
+    uint32_t awake = bodies.awakeCount();
+    bool sleepersMoved = sleepVersion != bodies.get_sleep_version();
+    uint32_t stale = sleepersMoved ? bodies.size() : awake;
+    boxes.resize(bodies.size());
+    for (uint32_t i = 0; i < stale; i++) {
+        boxes[i] = bodies.sweptBounds(i, dt);
+    }
+    sleepVersion = bodies.get_sleep_version();
+    for (auto& e : endpoints) {
+        e.shape = bodies.indexOf(e.handle);
+        if (e.shape < stale) {
+            e.value = e.isMin ? boxes[e.shape].min.x : boxes[e.shape].max.x;
+        }
+    }
+
+    // Insertion sort (cheap since last step's order is almost right)
+    for (size_t i = 1; i < endpoints.size(); i++) {
+        Endpoint e = endpoints[i];
+        size_t j = i;
+        while (j > 0 && before(e, endpoints[j - 1])) {
+            endpoints[j] = endpoints[j - 1];
+            j--;
+        }
+        endpoints[j] = e;
+    }
+
+    // Sweep: every shape whose interval is open when another one starts
+    // overlaps it on x, so only those need the y check. Open sleeping shapes
+    // are kept apart so two of them never get tested.
+    pairs.clear();
+    sleepers.clear();
+    active.clear();
+    activeAsleep.clear();
+    for (auto& e : endpoints) {
+        bool asleep = e.shape >= awake;
+        auto& open = asleep ? activeAsleep : active;
+        if (!e.isMin) {
+            auto it = std::find(open.begin(), open.end(), e.shape);
+            *it = open.back();
+            open.pop_back();
+            continue;
+        }
+        for (uint32_t other : active) {
+            if (!boxes[e.shape].overlaps(boxes[other])) {
+                continue;
+            }
+            if (asleep) {
+                sleepers.push_back(e.shape);
+            } else {
+                pairs.push_back({std::min(e.shape, other),
+                                 std::max(e.shape, other)});
+            }
+        }
+        if (!asleep) {
+            for (uint32_t other : activeAsleep) {
+                if (boxes[e.shape].overlaps(boxes[other])) {
+                    sleepers.push_back(other);
+                }
+            }
+        }
+        open.push_back(e.shape);
+    }
+}
+
+// Match the endpoint list to the store
+void SweepAndPrune::sync(BodyStore& bodies) {
+    auto gone = std::remove_if(
+        endpoints.begin(), endpoints.end(), [this, &bodies](Endpoint& e) {
+            if (bodies.valid(e.handle)) {
+                return false;
+            }
+            tracked[e.handle.index] = 0;
+            return true;
+        });
+    endpoints.erase(gone, endpoints.end());
+
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+        BodyHandle h = bodies.handleAt(i);
+        if (h.index >= tracked.size()) {
+            tracked.resize(h.index + 1, 0);
+        }
+        if (tracked[h.index] != h.generation + 1) {
+            endpoints.push_back({0, h, i, true});
+            endpoints.push_back({0, h, i, false});
+            tracked[h.index] = h.generation + 1;
+        }
+    }
+}
@@ -0,0 +1,158 @@
+// Broad phase: finds the pairs of bodies whose bounding boxes overlap
+
+#pragma once
+
+#include "bodies.h"
+#include <algorithm>
+#include <cstdint>
+#include <math.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Base broad phase class. Instead of every shape checking every other shape
+// (n^2), a broad phase finds the pairs whose bounding boxes overlap once per
+// step and only those go on to the narrow phase. Pairs of sleeping bodies are
+// never reported; an awake body touching a sleeping one just gets the
+// sleeping one listed so it can be woken up.
+class BroadPhase {
+  public:
+    // Destructor
+    virtual ~BroadPhase() {
+    }
+
+    // Find the candidate pairs for this step. Fast bodies get their boxes
+    // stretched over where they'll move in dt, so they can't skip past
+    // anything without it showing up.
+    virtual void build(BodyStore& bodies, float dt) = 0;
+
+    // Name for the stats display
+    virtual std::string name() const = 0;
+
+    // Candidate pairs of awake bodies from the last build (indices into the
+    // body arrays, each pair only once)
+    const std::vector<std::pair<uint32_t, uint32_t>>& get_pairs() const {
+        return pairs;
+    }
+
+    // Sleeping bodies an awake body ran into (can have repeats)
+    const std::vector<uint32_t>& get_sleepers() const {
+        return sleepers;
+    }
+
+  protected:
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    std::vector<uint32_t> sleepers;
+};
+
+// Uniform grid broad phase sized to the arena. Shapes get binned into cells
+// and only shapes sharing a cell become candidate pairs. Sleeping bodies are
+// binned into their own cells, which only get rebuilt when the set of
+// sleepers changes, and awake bodies look up the sleeping cells they cover.
+// So a step costs about the same however many bodies are asleep.
+class SpatialGrid : public BroadPhase {
+  public:
+    // Constructor
+    SpatialGrid(float w = 1000, float h = 1000, float cell = 50)
+        : cellSize(cell) {
+        cols = std::max(1, (int)ceil(w / cell));
+        rows = std::max(1, (int)ceil(h / cell));
+        cellStart.resize(cols * rows + 1);
+    }
+
+    // Rebin every body and collect the candidate pairs
+    void build(BodyStore& bodies, float dt) override;
+
+    std::string name() const override {
+        return "Grid";
+    }
+
+  private:
+    // Inclusive range of cells covered by a box
+    struct CellRange {
+        int x0, y0, x1, y1;
+    };
+
+    // Map a coordinate to a cell, clamping anything outside the arena
+    int cellX(float x) const {
+        return std::clamp((int)floor(x / cellSize), 0, cols - 1);
+    }
+
+    int cellY(float y) const {
+        return std::clamp((int)floor(y / cellSize), 0, rows - 1);
+    }
+
+    // Cache the boxes and cell ranges of the bodies in [begin, end)
+    void refresh(const BodyStore& bodies, uint32_t begin, uint32_t end,
+                 float dt);
+
+    // Counting sort the bodies in [begin, end) into cells
+    void bin(uint32_t begin, uint32_t end, std::vector<int>& start,
+             std::vector<uint32_t>& entries);
+
+    // Cell of the corner of two boxes' overlap. Shapes spanning several cells
+    // would show up more than once, so a pair only counts in this cell.
+    int cornerCell(const CellRange& a, const CellRange& b) const {
+        return std::max(a.y0, b.y0) * cols + std::max(a.x0, b.x0);
+    }
+
+    // Grid variables
+    float cellSize;
+    int cols;
+    int rows;
+    std::vector<AABB> boxes;
+    std::vector<CellRange> ranges;
+    std::vector<int> cellStart;
+    std::vector<int> cursor;
+    std::vector<uint32_t> cellEntries;
+    std::vector<int> sleepStart; // Same thing for the sleeping bodies
+    std::vector<uint32_t> sleepEntries;
+    uint64_t sleepVersion = UINT64_MAX; // Store version they were binned at
+};
+
+// Sort and sweep broad phase along the x axis. The sorted endpoint list is
+// kept between steps, and since shapes only move a little each step it's
+// nearly sorted already, so an insertion sort fixes it up in close to linear
+// time. Unlike the grid, this doesn't care how big the shapes are. Sleeping
+// bodies don't move so they never need sorting, but the sweep still walks
+// past their endpoints.
+class SweepAndPrune : public BroadPhase {
+  public:
+    // Fix up the endpoint order and sweep for overlapping pairs
+    void build(BodyStore& bodies, float dt) override;
+
+    std::string name() const override {
+        return "SAP";
+    }
+
+  private:
+    // One end of a body's x extent
+    struct Endpoint {
+        float value;
+        BodyHandle handle;
+        uint32_t shape; // Array index, refreshed every build
+        bool isMin;
+    };
+
+    // Sort order for endpoints (starts go first on ties so touching shapes
+    // still count as overlapping)
+    static bool before(const Endpoint& a, const Endpoint& b) {
+        if (a.value != b.value) {
+            return a.value < b.value;
+        }
+        return a.isMin && !b.isMin;
+    }
+
+    // Keep the endpoint list in step with the store. Endpoints of removed
+    // bodies get dropped (which keeps the rest in order), and new bodies get
+    // added to the end for the insertion sort to place.
+    void sync(BodyStore& bodies);
+
+    // Sweep variables
+    std::vector<uint32_t> tracked; // Generation + 1 of each tracked handle
+    std::vector<Endpoint> endpoints;
+    std::vector<AABB> boxes;
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> activeAsleep;
+    uint64_t sleepVersion = UINT64_MAX;
+};
@@ -0,0 +1,79 @@
+// Time of impact tests
+
+#include "ccd.h"
+#include <math.h>
+
+float sweptCircles(Vector p, Vector motion, float r, Vector& normal) {
+    // Solve |p + motion * t| = r for the first t
+    float a = motion.dot(motion);
+    float b = 2 * p.dot(motion);
+    float c = p.dot(p) - r * r;
+    if (a == 0 || b >= 0) {
+        return 2; // Not moving, or moving apart
+    }
+    float discriminant = b * b - 4 * a * c;
+    if (discriminant < 0) {
+        return 2; // Missed
+    }
+    float t = (-b - sqrt(discriminant)) / (2 * a);
+    normal = (p + motion * t) / r;
+    return t;
+}
+
+// When b's extent on one axis starts and stops overlapping a's
+static bool slab(float aMin, float aMax, float bMin, float bMax, float motion,
+                 float& enter, float& exit) {
+    if (motion == 0) {
+        enter = -INFINITY;
+        exit = INFINITY;
+        return bMax > aMin && bMin < aMax;
+    }
+    float t0 = (aMin - bMax) / motion;
+    float t1 = (aMax - bMin) / motion;
+    enter = std::min(t0, t1);
+    exit = std::max(t0, t1);
+    return true;
+}
+
+float sweptBoxes(const AABB& a, const AABB& b, Vector motion, Vector& normal) {
+    float enterX, exitX, enterY, exitY;
+    if (!slab(a.min.x, a.max.x, b.min.x, b.max.x, motion.x, enterX, exitX) ||
+        !slab(a.min.y, a.max.y, b.min.y, b.max.y, motion.y, enterY, exitY)) {
+        return 2;
+    }
+    // They touch once they overlap on both axes, as long as that's before
+    // they stop overlapping on either
+    float enter = std::max(enterX, enterY);
+    float exit = std::min(exitX, exitY);
+    if (enter > exit || enter < 0) {
+        return 2;
+    }
+    // The normal is whichever side got crossed last, facing b
+    if (enterX > enterY) {
+        normal = Vector(motion.x < 0 ? 1 : -1, 0);
+    } else {
+        normal = Vector(0, motion.y < 0 ? 1 : -1);
+    }
+    return enter;
+}
+
+bool speculativeContact(const BodyStore& b, uint32_t i, uint32_t j, float dt,
+                        Contact& c) {
+    Vector motion((b.vx[j] - b.vx[i]) * dt, (b.vy[j] - b.vy[i]) * dt);
+    Vector normal;
+    float t;
+    if (b.type[i] == ShapeType::Circle && b.type[j] == ShapeType::Circle) {
+        Vector p(b.px[j] - b.px[i], b.py[j] - b.py[i]);
+        t = sweptCircles(p, motion, b.hx[i] + b.hx[j], normal);
+    } else {
+        t = sweptBoxes(b.bounds(i), b.bounds(j), motion, normal);
+    }
+    if (t > 1) {
+        return false;
+    }
+    c.a = i;
+    c.b = j;
+    c.normal = normal;
+    c.penetration = motion.dot(normal) * t; // How far they close before touching
+    return true;
+}
@@ -0,0 +1,26 @@
+// Continuous collision: time of impact tests for bodies that move far enough
+// in one step to skip right past each other. Instead of substepping, a fast
+// pair that's going to hit during the step gets a speculative contact: a
+// contact with a gap, which the solver only lets them close up to the
+// point they'd touch.
+
+#pragma once
+
+#include "bodies.h"
+#include "collision.h"
+#include <cstdint>
+
+// When two moving circles first touch. p is b's center relative to a's,
+// motion is how far b moves relative to a over the step, and r is the radii
+// added up. Returns the fraction of the step they touch at (and the normal
+// from a to b then), or something over 1 if they don't.
+float sweptCircles(Vector p, Vector motion, float r, Vector& normal);
+
+// Same thing for two boxes, with b moving by motion relative to a
+float sweptBoxes(const AABB& a, const AABB& b, Vector motion, Vector& normal);
+
+// Contact for two bodies that aren't touching yet but would be by the end of
+// a step of dt. The penetration is negative: minus the gap between them along
+// the normal. Circles sweep as circles, anything else as boxes.
+bool speculativeContact(const BodyStore& b, uint32_t i, uint32_t j, float dt,
+                        Contact& c);
@@ -0,0 +1,665 @@
+// Chunk stepping, seams, migration and paging
+
+#include "chunks.h"
+#include "profile.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cstdio>
+#include <math.h>
+
+// The neighbors that come after a chunk in ChunkCoord order, which it solves
+// the seams with
+static const ChunkCoord after[4] = {{0, 1}, {1, -1}, {1, 0}, {1, 1}};
+
+// Seam contacts keep both bodies' handles in the key and generation, with
+// this chunk's in the top half (the same way World's contacts do)
+static BodyHandle ownOf(const Contact& c) {
+    return BodyHandle{(uint32_t)(c.key >> 32), (uint32_t)(c.generation >> 32)};
+}
+
+static BodyHandle otherOf(const Contact& c) {
+    return BodyHandle{(uint32_t)c.key, (uint32_t)c.generation};
+}
+
+// Push a along -impulse and b along +impulse, the way the solver does
+static void push(BodyStore& a, uint32_t i, BodyStore& b, uint32_t j,
+                 Vector impulse) {
+    a.vx[i] -= impulse.x * a.inverseMass(i);
+    a.vy[i] -= impulse.y * a.inverseMass(i);
+    b.vx[j] += impulse.x * b.inverseMass(j);
+    b.vy[j] += impulse.y * b.inverseMass(j);
+}
+
+// A contact's total impulse, friction included
+static Vector impulseOf(const Contact& c) {
+    return Vector(c.normal.x * c.impulse - c.normal.y * c.tangentImpulse,
+                  c.normal.y * c.impulse + c.normal.x * c.tangentImpulse);
+}
+
+ChunkedWorld::ChunkedWorld(const std::string& directory, float chunkSize,
+                           float timestep, unsigned threads)
+    : jobs(new JobSystem(threads)), directory(directory),
+      chunkSize(chunkSize), timestep(timestep) {
+}
+
+ChunkedWorld::~ChunkedWorld() {
+    for (auto& entry : chunks) {
+        if (entry.second.paged) {
+            std::remove(pathOf(entry.first).c_str());
+        }
+    }
+}
+
+ChunkBody ChunkedWorld::add(ChunkCoord chunk, const Circle& c) {
+    Circle local = c;
+    locate(chunk, local.center);
+    return ChunkBody{chunk, chunkAt(chunk).world->get_bodies().add(local)};
+}
+
+ChunkBody ChunkedWorld::add(ChunkCoord chunk, const Rectangle& r) {
+    Rectangle local = r;
+    locate(chunk, local.center);
+    return ChunkBody{chunk, chunkAt(chunk).world->get_bodies().add(local)};
+}
+
+// Chunks only ever see each other's bodies, so a static has to be in every
+// chunk it reaches into
+void ChunkedWorld::addStatic(ChunkCoord chunk, const Circle& c) {
+    StaticBody s;
+    s.type = ShapeType::Circle;
+    s.center = c.center;
+    s.half = Vector(c.radius, c.radius);
+    s.color = c.color;
+    AABB box = s.bounds();
+    for (int y = (int)floorf(box.min.y / chunkSize);
+         y <= (int)floorf(box.max.y / chunkSize); y++) {
+        for (int x = (int)floorf(box.min.x / chunkSize);
+             x <= (int)floorf(box.max.x / chunkSize); x++) {
+            StaticBody local = s;
+            local.center = Vector(c.center.x - x * chunkSize,
+                                  c.center.y - y * chunkSize);
+            ChunkCoord at{chunk.x + x, chunk.y + y};
+            chunkAt(at).world->addStatic(local);
+        }
+    }
+}
+
+void ChunkedWorld::addStatic(ChunkCoord chunk, const Rectangle& r) {
+    StaticBody s;
+    s.type = ShapeType::Rectangle;
+    s.center = r.center;
+    s.half = Vector(r.size.x / 2, r.size.y / 2);
+    s.color = r.color;
+    AABB box = s.bounds();
+    for (int y = (int)floorf(box.min.y / chunkSize);
+         y <= (int)floorf(box.max.y / chunkSize); y++) {
+        for (int x = (int)floorf(box.min.x / chunkSize);
+             x <= (int)floorf(box.max.x / chunkSize); x++) {
+            StaticBody local = s;
+            local.center = Vector(r.center.x - x * chunkSize,
+                                  r.center.y - y * chunkSize);
+            ChunkCoord at{chunk.x + x, chunk.y + y};
+            chunkAt(at).world->addStatic(local);
+        }
+    }
+}
+
+// Anything awake (or about to wake up) gets stepped along with everything
+// around it, since that's all it can run into. Chunks don't see each other's
+// bodies while they step, so they can all go at once, and the seams get
+// solved afterwards one chunk at a time.
+void ChunkedWorld::step(float dt) {
+    PROFILE_SCOPE("chunks");
+    pushSeams();
+    std::vector<ChunkCoord> awake;
+    for (auto& entry : chunks) {
+        entry.second.stepped = false;
+        World* world = entry.second.world.get();
+        if (world && (world->get_bodies().awakeCount() > 0 ||
+                      world->get_bodies().has_pending_wakes())) {
+            awake.push_back(entry.first);
+        }
+    }
+    for (ChunkCoord c : awake) {
+        for (int y = -1; y <= 1; y++) {
+            for (int x = -1; x <= 1; x++) {
+                auto found = chunks.find(ChunkCoord{c.x + x, c.y + y});
+                if (found == chunks.end()) {
+                    continue;
+                }
+                if (!found->second.world) {
+                    pageIn(found->first, found->second);
+                }
+                found->second.stepped = true;
+            }
+        }
+    }
+
+    // In map order, so everything after this happens in the same order
+    // every run
+    std::vector<ChunkCoord> stepped;
+    std::vector<Chunk*> steppedChunks;
+    for (auto& entry : chunks) {
+        if (entry.second.stepped) {
+            stepped.push_back(entry.first);
+            steppedChunks.push_back(&entry.second);
+        }
+    }
+    jobs->parallelFor((uint32_t)stepped.size(), [&](uint32_t i) {
+        steppedChunks[i]->world->step(dt);
+    });
+    migrate(stepped);
+
+    // Finding the pairs only reads, so every chunk can do it at once, but
+    // solving them changes bodies on both sides, so that goes in map order
+    std::vector<ChunkCoord> loaded;
+    std::vector<Chunk*> loadedChunks;
+    for (auto& entry : chunks) {
+        if (entry.second.world) {
+            loaded.push_back(entry.first);
+            loadedChunks.push_back(&entry.second);
+        }
+    }
+    {
+        PROFILE_SCOPE("seams");
+        jobs->parallelFor((uint32_t)loaded.size(), [&](uint32_t i) {
+            findSeamPairs(loaded[i], *loadedChunks[i]);
+        });
+        for (uint32_t i = 0; i < loaded.size(); i++) {
+            for (int side = 0; side < 4; side++) {
+                solveSeam(loaded[i], *loadedChunks[i], side, dt);
+            }
+        }
+    }
+
+    // Page out whatever's been asleep long enough, as long as nothing next
+    // to it is awake (it'd be needed for the seams)
+    std::vector<ChunkCoord> idle;
+    for (auto& entry : chunks) {
+        Chunk& chunk = entry.second;
+        if (!chunk.world) {
+            continue;
+        }
+        bool resting = chunk.world->get_bodies().awakeCount() == 0 &&
+                       !chunk.world->get_bodies().has_pending_wakes();
+        chunk.idleSteps = resting ? chunk.idleSteps + 1 : 0;
+        if (chunk.idleSteps >= pageOutSteps) {
+            idle.push_back(entry.first);
+        }
+    }
+    for (ChunkCoord c : idle) {
+        Chunk* around[9];
+        neighbors(c, around);
+        bool quiet = true;
+        for (Chunk* n : around) {
+            quiet = quiet && (!n || n->idleSteps > 0);
+        }
+        if (quiet) {
+            pageOut(c, chunks[c]);
+        }
+    }
+
+    // Chunks everything's left (with no level geometry of their own) go
+    // away altogether
+    for (auto it = chunks.begin(); it != chunks.end();) {
+        if (empty(it->second)) {
+            if (it->second.paged) {
+                std::remove(pathOf(it->first).c_str());
+            }
+            it = chunks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    loadedCount = 0;
+    for (auto& entry : chunks) {
+        loadedCount += entry.second.world != nullptr;
+    }
+    steppedCount = (uint32_t)stepped.size();
+}
+
+int ChunkedWorld::advance(float elapsed) {
+    return fixedStep.advance(elapsed, timestep, [this] { step(timestep); });
+}
+
+void ChunkedWorld::locate(ChunkCoord& chunk, Vector& local) const {
+    float x = floorf(local.x / chunkSize);
+    float y = floorf(local.y / chunkSize);
+    chunk.x += (int32_t)x;
+    chunk.y += (int32_t)y;
+    local.x -= x * chunkSize;
+    local.y -= y * chunkSize;
+    // Something a hair under 0 rounds up to the whole chunk size, which is
+    // really the start of the next chunk
+    if (local.x >= chunkSize) {
+        local.x = 0;
+        chunk.x++;
+    }
+    if (local.y >= chunkSize) {
+        local.y = 0;
+        chunk.y++;
+    }
+}
+
+World* ChunkedWorld::get_chunk(ChunkCoord c) {
+    auto found = chunks.find(c);
+    if (found == chunks.end()) {
+        return nullptr;
+    }
+    if (!found->second.world) {
+        pageIn(c, found->second);
+    }
+    return found->second.world.get();
+}
+
+uint64_t ChunkedWorld::get_body_count() const {
+    uint64_t count = 0;
+    for (auto& entry : chunks) {
+        const Chunk& chunk = entry.second;
+        count += chunk.world ? chunk.world->get_bodies().size()
+                             : chunk.bodyCount;
+    }
+    return count;
+}
+
+uint64_t ChunkedWorld::hash() const {
+    uint64_t h = 1469598103934665603ull;
+    for (auto& entry : chunks) {
+        const Chunk& chunk = entry.second;
+        uint64_t part = chunk.world ? chunk.world->hash() : chunk.hash;
+        h = (h ^ (uint32_t)entry.first.x) * 1099511628211ull;
+        h = (h ^ (uint32_t)entry.first.y) * 1099511628211ull;
+        h = (h ^ part) * 1099511628211ull;
+    }
+    return h;
+}
+
+ChunkedWorld::Chunk& ChunkedWorld::chunkAt(ChunkCoord c) {
+    Chunk& chunk = chunks[c];
+    if (!chunk.world) {
+        pageIn(c, chunk);
+    }
+    return chunk;
+}
+
+void ChunkedWorld::neighbors(ChunkCoord c, Chunk* out[9]) {
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            auto found = chunks.find(ChunkCoord{c.x + x, c.y + y});
+            bool loaded = found != chunks.end() && found->second.world;
+            out[(y + 1) * 3 + x + 1] = loaded ? &found->second : nullptr;
+        }
+    }
+}
+
+std::unique_ptr<World> ChunkedWorld::makeWorld(ChunkCoord c) const {
+    // Walls a whole chunk out, so bodies never reach them before they've
+    // moved to the next chunk
+    std::unique_ptr<World> world(new World(timestep, 1));
+    world->set_walls(AABB{Vector(-chunkSize, -chunkSize),
+                          Vector(2 * chunkSize, 2 * chunkSize)});
+    world->get_solver_settings() = solverSettings;
+    world->get_sleep_settings() = sleepSettings;
+    world->get_random().set_seed((uint64_t)(uint32_t)c.x << 32 |
+                                 (uint32_t)c.y);
+    return world;
+}
+
+// A chunk that was never paged out (or whose file is gone) just starts
+// out empty
+void ChunkedWorld::pageIn(ChunkCoord c, Chunk& chunk) {
+    chunk.world = makeWorld(c);
+    chunk.idleSteps = 0;
+    if (!chunk.paged) {
+        return;
+    }
+    Snapshot snapshot;
+    if (snapshot.open(pathOf(c))) {
+        snapshot.restore(*chunk.world);
+        chunk.world->get_solver_settings() = solverSettings;
+        chunk.world->get_sleep_settings() = sleepSettings;
+        pageIns++;
+    }
+}
+
+void ChunkedWorld::pageOut(ChunkCoord c, Chunk& chunk) {
+    if (!Snapshot::save(*chunk.world, pathOf(c))) {
+        return;
+    }
+
+    // Everything around it is asleep, so there's nothing on the seams to
+    // warm start from when it comes back
+    for (Seam& seam : chunk.seams) {
+        seam = Seam();
+    }
+    chunk.bodyCount = chunk.world->get_bodies().size();
+    chunk.hash = chunk.world->hash();
+    chunk.paged = true;
+    chunk.world.reset();
+    pageOuts++;
+}
+
+bool ChunkedWorld::empty(const Chunk& chunk) const {
+    if (!chunk.world || chunk.world->get_bodies().size() > 0) {
+        return false;
+    }
+    for (const StaticBody& s : chunk.world->get_statics()) {
+        if (s.type != ShapeType::Count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string ChunkedWorld::pathOf(ChunkCoord c) const {
+    char name[64];
+    snprintf(name, sizeof(name), "/chunk_%d_%d.snap", c.x, c.y);
+    return directory + name;
+}
+
+// Applied before the chunks step, so a body resting on something across a
+// seam has that holding it up while its own chunk solves everything else.
+// solveSeam takes this back off before solving, so it only ever counts once.
+// Ones that aren't pushed still get warm started there, just not here.
+void ChunkedWorld::pushSeams() {
+    for (auto& entry : chunks) {
+        Chunk& chunk = entry.second;
+        for (int side = 0; side < 4; side++) {
+            Seam& seam = chunk.seams[side];
+            if (seam.contacts.empty()) {
+                continue;
+            }
+            ChunkCoord n{entry.first.x + after[side].x,
+                         entry.first.y + after[side].y};
+            auto found = chunks.find(n);
+            if (!chunk.world || found == chunks.end() ||
+                !found->second.world) {
+                seam.contacts.clear();
+                continue;
+            }
+
+            // Only keep the ones that got pushed, so solveSeam knows what to
+            // take back off
+            BodyStore& a = chunk.world->get_bodies();
+            BodyStore& b = found->second.world->get_bodies();
+            size_t kept = 0;
+            for (const Contact& c : seam.contacts) {
+                BodyHandle own = ownOf(c), other = otherOf(c);
+                if (!a.valid(own) || !b.valid(other)) {
+                    continue;
+                }
+                uint32_t i = a.indexOf(own), j = b.indexOf(other);
+                if (a.asleep(i) && b.asleep(j)) {
+                    continue;
+                }
+
+                // Not the ones that just bounced, since that impulse was
+                // stopping a hit, not holding anything up (and whatever's
+                // behind them would take it as a hit of its own)
+                if (c.bias != 0) {
+                    continue;
+                }
+                a.wake(i);
+                b.wake(j);
+                push(a, i, b, j, impulseOf(c));
+                seam.contacts[kept++] = c;
+            }
+            seam.contacts.resize(kept);
+        }
+    }
+}
+
+void ChunkedWorld::findSeamPairs(ChunkCoord c, Chunk& chunk) {
+    const World& world = *chunk.world;
+    const BodyStore& own = world.get_bodies();
+    for (Seam& seam : chunk.seams) {
+        seam.pairs.clear();
+    }
+    if (own.size() == 0) {
+        return;
+    }
+
+    // Only neighbors' bodies that reach something in this chunk matter
+    AABB reach{Vector(INFINITY, INFINITY), Vector(-INFINITY, -INFINITY)};
+    for (uint32_t i = 0; i < own.size(); i++) {
+        AABB box = own.bounds(i);
+        reach.min.x = std::min(reach.min.x, box.min.x);
+        reach.min.y = std::min(reach.min.y, box.min.y);
+        reach.max.x = std::max(reach.max.x, box.max.x);
+        reach.max.y = std::max(reach.max.y, box.max.y);
+    }
+
+    std::vector<QueryHit> hits;
+    for (int side = 0; side < 4; side++) {
+        auto found = chunks.find(
+            ChunkCoord{c.x + after[side].x, c.y + after[side].y});
+        if (found == chunks.end() || !found->second.world) {
+            continue;
+        }
+        const BodyStore& b = found->second.world->get_bodies();
+        if (own.awakeCount() == 0 && b.awakeCount() == 0) {
+            continue;
+        }
+        float ox = after[side].x * chunkSize;
+        float oy = after[side].y * chunkSize;
+        for (uint32_t j = 0; j < b.size(); j++) {
+            AABB box{Vector(b.px[j] - b.hx[j] + ox, b.py[j] - b.hy[j] + oy),
+                     Vector(b.px[j] + b.hx[j] + ox, b.py[j] + b.hy[j] + oy)};
+            if (!box.overlaps(reach)) {
+                continue;
+            }
+            hits.clear();
+            world.aabbQuery(box, hits, QueryFilter::Bodies);
+            for (const QueryHit& hit : hits) {
+                if (!own.asleep(own.indexOf(hit.body)) || !b.asleep(j)) {
+                    chunk.seams[side].pairs.push_back(
+                        SeamPair{hit.body, b.handleAt(j)});
+                }
+            }
+        }
+    }
+}
+
+// The pairs' bodies get copied into one store, the neighbor's moved into this
+// chunk's coordinates, so the usual kernels and solver can work on them as if
+// they'd always been in the same world
+void ChunkedWorld::solveSeam(ChunkCoord c, Chunk& chunk, int side, float dt) {
+    Seam& seam = chunk.seams[side];
+    if (seam.pairs.empty() && seam.contacts.empty()) {
+        return;
+    }
+    ChunkCoord n{c.x + after[side].x, c.y + after[side].y};
+    BodyStore& a = chunk.world->get_bodies();
+    BodyStore& b = chunks.at(n).world->get_bodies();
+    Vector offset(after[side].x * chunkSize, after[side].y * chunkSize);
+
+    // Each body once, however many pairs it's in (this chunk's first, then
+    // the neighbor's), sorted so finding one is a binary search. They're all
+    // awake in the copy, so each one's index there is its place in the list.
+    auto bySlot = [](const BodyHandle& x, const BodyHandle& y) {
+        return x.index < y.index;
+    };
+    std::vector<BodyHandle> owns, others;
+    for (const SeamPair& pair : seam.pairs) {
+        owns.push_back(pair.own);
+        others.push_back(pair.other);
+    }
+    for (const Contact& old : seam.contacts) {
+        if (a.valid(ownOf(old)) && b.valid(otherOf(old))) {
+            owns.push_back(ownOf(old));
+            others.push_back(otherOf(old));
+        }
+    }
+    for (std::vector<BodyHandle>* list : {&owns, &others}) {
+        std::sort(list->begin(), list->end(), bySlot);
+        list->erase(std::unique(list->begin(), list->end(),
+                                [](const BodyHandle& x, const BodyHandle& y) {
+                                    return x.index == y.index;
+                                }),
+                    list->end());
+    }
+    auto copyOf = [&](BodyHandle h, bool own) {
+        const std::vector<BodyHandle>& list = own ? owns : others;
+        auto it = std::lower_bound(list.begin(), list.end(), h, bySlot);
+        if (it == list.end() || it->index != h.index ||
+            it->generation != h.generation) {
+            return UINT32_MAX;
+        }
+        uint32_t first = own ? 0 : (uint32_t)owns.size();
+        return first + (uint32_t)(it - list.begin());
+    };
+
+    seamBodies.clear();
+    seamStart.clear();
+    seamAsleep.clear();
+    for (uint32_t k = 0; k < owns.size() + others.size(); k++) {
+        bool own = k < owns.size();
+        const BodyStore& from = own ? a : b;
+        uint32_t i = from.indexOf(own ? owns[k] : others[k - owns.size()]);
+        Vector center(from.px[i], from.py[i]);
+        if (!own) {
+            center += offset;
+        }
+        Vector velocity(from.vx[i], from.vy[i]);
+        if (from.type[i] == ShapeType::Circle) {
+            seamBodies.add(Circle(center, from.hx[i], from.color[i], Vector(),
+                                  velocity));
+        } else {
+            seamBodies.add(Rectangle(center,
+                                     Vector(from.hx[i] * 2, from.hy[i] * 2),
+                                     from.color[i], Vector(), velocity));
+        }
+        seamStart.push_back(center);
+        seamAsleep.push_back(from.asleep(i));
+    }
+
+    // Take back what pushSeams put on (and how far it carried them while
+    // their chunks stepped), whether they're still touching or not. The
+    // solver's warm start puts it on again if they are, and it's only meant
+    // to be there for the chunks' own solvers to push against. Anything that
+    // fell asleep during the step already lost it along with the rest of its
+    // velocity.
+    for (const Contact& old : seam.contacts) {
+        uint32_t ij[2] = {copyOf(ownOf(old), true),
+                          copyOf(otherOf(old), false)};
+        if (ij[0] == UINT32_MAX || ij[1] == UINT32_MAX) {
+            continue;
+        }
+        Vector before[2];
+        for (int k = 0; k < 2; k++) {
+            before[k] = Vector(seamBodies.vx[ij[k]], seamBodies.vy[ij[k]]);
+        }
+        push(seamBodies, ij[0], seamBodies, ij[1], -impulseOf(old));
+        for (int k = 0; k < 2; k++) {
+            uint32_t i = ij[k];
+            if (seamAsleep[i]) {
+                seamBodies.vx[i] = before[k].x;
+                seamBodies.vy[i] = before[k].y;
+                continue;
+            }
+            seamBodies.px[i] += (seamBodies.vx[i] - before[k].x) * dt;
+            seamBodies.py[i] += (seamBodies.vy[i] - before[k].y) * dt;
+        }
+    }
+
+    // The same kernels as everywhere else, keyed by the real handles so warm
+    // starting finds them again next step
+    seam.contacts.clear();
+    for (const SeamPair& pair : seam.pairs) {
+        uint32_t i = copyOf(pair.own, true);
+        uint32_t j = copyOf(pair.other, false);
+        CollisionFn collide =
+            collisionMatrix[(size_t)seamBodies.type[i] * shapeTypeCount +
+                            (size_t)seamBodies.type[j]];
+        Contact contact;
+        if (!collide || !collide(seamBodies, i, j, contact)) {
+            continue;
+        }
+        contact.key = (uint64_t)pair.own.index << 32 | pair.other.index;
+        contact.generation =
+            (uint64_t)pair.own.generation << 32 | pair.other.generation;
+        seam.contacts.push_back(contact);
+    }
+    seam.solver.solve(seamBodies, seam.contacts.data(),
+                      (uint32_t)seam.contacts.size(), dt, solverSettings);
+    seam.solver.store(seam.contacts.data(), (uint32_t)seam.contacts.size());
+
+    // Velocities come straight back, positions only if the solver moved
+    // them (so nothing else picks up rounding from the offset), and anything
+    // asleep that changed wakes up
+    for (uint32_t k = 0; k < seamBodies.size(); k++) {
+        bool own = k < owns.size();
+        BodyStore& to = own ? a : b;
+        uint32_t i = to.indexOf(own ? owns[k] : others[k - owns.size()]);
+        Vector moved =
+            Vector(seamBodies.px[k], seamBodies.py[k]) - seamStart[k];
+        if (moved == Vector() && to.vx[i] == seamBodies.vx[k] &&
+            to.vy[i] == seamBodies.vy[k]) {
+            continue;
+        }
+        to.px[i] += moved.x;
+        to.py[i] += moved.y;
+        to.vx[i] = seamBodies.vx[k];
+        to.vy[i] = seamBodies.vy[k];
+        to.wake(i);
+    }
+
+    // Bodies touching across a seam rest together, the same way an island
+    // does, or whichever side went to sleep first would just get woken again
+    // by the other
+    for (const Contact& contact : seam.contacts) {
+        uint32_t i = a.indexOf(ownOf(contact));
+        uint32_t j = b.indexOf(otherOf(contact));
+        if (!a.asleep(i) && !b.asleep(j)) {
+            float rested = std::min(a.sleepTime[i], b.sleepTime[j]);
+            a.sleepTime[i] = rested;
+            b.sleepTime[j] = rested;
+        }
+    }
+}
+
+void ChunkedWorld::migrate(const std::vector<ChunkCoord>& stepped) {
+    struct Move {
+        ChunkCoord to;
+        ShapeType type;
+        Vector center, half, velocity, acceleration;
+        Color color;
+    };
+    std::vector<Move> moves;
+    std::vector<BodyHandle> leaving;
+    for (ChunkCoord c : stepped) {
+        BodyStore& b = chunks[c].world->get_bodies();
+        leaving.clear();
+        for (uint32_t i = 0; i < b.awakeCount(); i++) {
+            if (b.px[i] >= 0 && b.px[i] < chunkSize && b.py[i] >= 0 &&
+                b.py[i] < chunkSize) {
+                continue;
+            }
+            Move move{c,
+                      b.type[i],
+                      Vector(b.px[i], b.py[i]),
+                      Vector(b.hx[i], b.hy[i]),
+                      Vector(b.vx[i], b.vy[i]),
+                      Vector(b.ax[i], b.ay[i]),
+                      b.color[i]};
+            locate(move.to, move.center);
+            moves.push_back(move);
+            leaving.push_back(b.handleAt(i));
+        }
+        for (BodyHandle h : leaving) {
+            b.remove(h);
+        }
+    }
+
+    for (const Move& m : moves) {
+        BodyStore& b = chunkAt(m.to).world->get_bodies();
+        if (m.type == ShapeType::Circle) {
+            b.add(Circle(m.center, m.half.x, m.color, m.acceleration,
+                         m.velocity));
+        } else {
+            b.add(Rectangle(m.center, Vector(m.half.x * 2, m.half.y * 2),
+                            m.color, m.acceleration, m.velocity));
+        }
+    }
+}
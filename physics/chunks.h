@@ -0,0 +1,215 @@
+// Large worlds: space split into square chunks, each one its own World with
+// coordinates measured from its own corner. A body's position is which chunk
+// it's in plus a float that never gets bigger than the chunk, so it's just as
+// precise a million units out as it is at the origin.
+//
+// Bodies move to the next chunk over as soon as their center leaves theirs.
+// Pairs that touch across a seam get solved after the chunks have stepped,
+// once each, by the chunk that comes first (lower x, then lower y), as
+// ordinary two body contacts with both bodies' mass and velocity, and the
+// result goes back to both chunks. Before the next step each pair gets last
+// step's impulse again, so the chunks' own solvers see a stack across a seam
+// holding itself up (the same as warm starting does inside one world).
+//
+// Chunks only get stepped while something in them or next to them is awake,
+// and a chunk that's stayed asleep long enough gets written out to disk as a
+// snapshot and dropped from memory until something wakes it or moves into
+// it. So memory and step time go with how much of the world is moving, not
+// how big it is.
+
+#pragma once
+
+#include "jobs.h"
+#include "world.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Which chunk, counted in chunks from the origin
+struct ChunkCoord {
+    int32_t x = 0;
+    int32_t y = 0;
+
+    bool operator<(const ChunkCoord& other) const {
+        return x < other.x || (x == other.x && y < other.y);
+    }
+
+    bool operator==(const ChunkCoord& other) const {
+        return x == other.x && y == other.y;
+    }
+};
+
+// A body somewhere in a chunked world. The handle belongs to the chunk's own
+// world, so a body gets a new one whenever it moves to another chunk.
+struct ChunkBody {
+    ChunkCoord chunk;
+    BodyHandle handle;
+};
+
+class ChunkedWorld {
+  public:
+    // Constructor (chunks get paged out to files in directory, which has to
+    // exist already)
+    ChunkedWorld(const std::string& directory, float chunkSize = 1000,
+                 float timestep = 1 / 120.0f,
+                 unsigned threads = std::thread::hardware_concurrency());
+
+    // Destructor (deletes every chunk's file, since nothing else can read
+    // them back in)
+    ~ChunkedWorld();
+
+    // Add a body to a chunk (its center is relative to the chunk's corner,
+    // and it gets moved to the right chunk if it's outside this one)
+    ChunkBody add(ChunkCoord chunk, const Circle& c);
+    ChunkBody add(ChunkCoord chunk, const Rectangle& r);
+
+    // Add level geometry (split up between every chunk it covers)
+    void addStatic(ChunkCoord chunk, const Circle& c);
+    void addStatic(ChunkCoord chunk, const Rectangle& r);
+
+    // Step every chunk that has anything moving in or next to it
+    void step(float dt);
+
+    // Same as World::advance
+    int advance(float elapsed);
+
+    // Move a chunk and a position relative to it to the chunk the position is
+    // actually in
+    void locate(ChunkCoord& chunk, Vector& local) const;
+
+    // A chunk's world (paged in if it has to be), or null if nothing's ever
+    // been put there. Changes to it are fine, as long as they're not made
+    // while stepping.
+    World* get_chunk(ChunkCoord chunk);
+
+    // Chunks with anything in them, whether they're in memory or not
+    uint32_t get_chunk_count() const {
+        return (uint32_t)chunks.size();
+    }
+
+    // Chunks in memory right now, and how many got stepped last step
+    uint32_t get_loaded_count() const {
+        return loadedCount;
+    }
+
+    uint32_t get_stepped_count() const {
+        return steppedCount;
+    }
+
+    // Bodies in every chunk (counting paged out ones)
+    uint64_t get_body_count() const;
+
+    // Times chunks have been written out and read back in
+    uint64_t get_page_outs() const {
+        return pageOuts;
+    }
+
+    uint64_t get_page_ins() const {
+        return pageIns;
+    }
+
+    float get_chunk_size() const {
+        return chunkSize;
+    }
+
+    // Steps a chunk has to have been asleep (with its neighbors asleep too)
+    // before it gets paged out
+    uint32_t get_page_out_steps() const {
+        return pageOutSteps;
+    }
+
+    void set_page_out_steps(uint32_t steps) {
+        pageOutSteps = steps;
+    }
+
+    // Settings every chunk gets (snapshots don't keep them, so paged in
+    // chunks get these again too)
+    SolverSettings& get_solver_settings() {
+        return solverSettings;
+    }
+
+    SleepSettings& get_sleep_settings() {
+        return sleepSettings;
+    }
+
+    // Hash of every chunk's bodies, for checking two runs came out the same
+    uint64_t hash() const;
+
+  private:
+    // Two bodies across a seam whose boxes overlap, one from a chunk and one
+    // from the neighbor after it
+    struct SeamPair {
+        BodyHandle own;
+        BodyHandle other;
+    };
+
+    // Everything between a chunk and one of the neighbors after it
+    struct Seam {
+        std::vector<SeamPair> pairs;   // Found this step
+        std::vector<Contact> contacts; // Last solved (handles in the key)
+        ContactSolver solver;          // For warm starting
+    };
+
+    struct Chunk {
+        std::unique_ptr<World> world; // Null while it's paged out
+        uint32_t bodyCount = 0;       // As of when it got paged out
+        uint64_t hash = 0;            // Same
+        uint32_t idleSteps = 0;       // Steps in a row with nothing awake
+        bool stepped = false;         // In the last step
+        bool paged = false;           // Has a file on disk
+        Seam seams[4];                // With each of the neighbors after it
+    };
+
+    // A chunk, made or paged in if it has to be
+    Chunk& chunkAt(ChunkCoord c);
+
+    // The loaded neighbors of a chunk, by where they are (-1 to 1 in each
+    // direction, 4 being the chunk itself)
+    void neighbors(ChunkCoord c, Chunk* out[9]);
+
+    // Fresh world for a chunk, set up with the shared settings
+    std::unique_ptr<World> makeWorld(ChunkCoord c) const;
+
+    void pageIn(ChunkCoord c, Chunk& chunk);
+    void pageOut(ChunkCoord c, Chunk& chunk);
+    std::string pathOf(ChunkCoord c) const;
+
+    // Whether a loaded chunk has nothing in it at all
+    bool empty(const Chunk& chunk) const;
+
+    // Give every pair solved across a seam last step the same impulse again,
+    // waking both bodies
+    void pushSeams();
+
+    // Find the pairs across a chunk's seams with the neighbors after it
+    void findSeamPairs(ChunkCoord c, Chunk& chunk);
+
+    // Solve one of a chunk's seams and write the result back to both sides
+    void solveSeam(ChunkCoord c, Chunk& chunk, int side, float dt);
+
+    // Move bodies that left their chunk into the one they're in now
+    void migrate(const std::vector<ChunkCoord>& stepped);
+
+    std::map<ChunkCoord, Chunk> chunks;
+    std::unique_ptr<JobSystem> jobs;
+    std::string directory;
+    float chunkSize;
+    float timestep;
+    FixedTimestep fixedStep;
+    uint32_t pageOutSteps = 240;
+    uint32_t loadedCount = 0;
+    uint32_t steppedCount = 0;
+    uint64_t pageOuts = 0;
+    uint64_t pageIns = 0;
+    SolverSettings solverSettings;
+    SleepSettings sleepSettings;
+
+    // Copies of the bodies in one seam's pairs, where they were before being
+    // solved and whether they're asleep in their own chunks
+    BodyStore seamBodies;
+    std::vector<Vector> seamStart;
+    std::vector<uint8_t> seamAsleep;
+};
@@ -0,0 +1,168 @@
+// Contact kernels for the built in shapes
+
+#include "collision.h"
+#include <algorithm>
+#include <math.h>
+
+// Circles touch when their centers are closer than their radii added up
+static bool circleCircle(Vector pa, float ra, Vector pb, float rb,
+                         Vector& normal, float& penetration) {
+    Vector delta(pb.x - pa.x, pb.y - pa.y);
+    float radii = ra + rb;
+    float distanceSquared = delta.length_squared();
+    if (distanceSquared >= radii * radii) {
+        return false;
+    }
+
+    // Only one square root, and none at all if they're not touching
+    float distance = sqrt(distanceSquared);
+    normal = distance > 0 ? delta / distance : Vector(0, 1);
+    penetration = radii - distance;
+    return true;
+}
+
+// Rectangles push apart along whichever axis they overlap the least on
+static bool rectRect(Vector pa, Vector ha, Vector pb, Vector hb,
+                     Vector& normal, float& penetration) {
+    float dx = pb.x - pa.x;
+    float dy = pb.y - pa.y;
+    float overlapX = ha.x + hb.x - fabs(dx);
+    float overlapY = ha.y + hb.y - fabs(dy);
+    if (overlapX <= 0 || overlapY <= 0) {
+        return false;
+    }
+
+    if (overlapX < overlapY) {
+        normal = Vector(dx < 0 ? -1 : 1, 0);
+        penetration = overlapX;
+    } else {
+        normal = Vector(0, dy < 0 ? -1 : 1);
+        penetration = overlapY;
+    }
+    return true;
+}
+
+// A rectangle and a circle touch when the closest point on the rectangle is
+// inside the circle
+static bool rectCircle(Vector pa, Vector ha, Vector pb, float radius,
+                       Vector& normal, float& penetration) {
+    float dx = pb.x - pa.x;
+    float dy = pb.y - pa.y;
+
+    // Find the closest point to the circle's center on the rectangle
+    float closestX = std::clamp(dx, -ha.x, ha.x);
+    float closestY = std::clamp(dy, -ha.y, ha.y);
+    Vector delta(dx - closestX, dy - closestY);
+    float distanceSquared = delta.length_squared();
+    if (distanceSquared >= radius * radius) {
+        return false;
+    }
+
+    if (distanceSquared > 0) {
+        float distance = sqrt(distanceSquared);
+        normal = delta / distance;
+        penetration = radius - distance;
+        return true;
+    }
+
+    // The center is inside the rectangle, so push out the nearest side
+    float outX = ha.x - fabs(dx);
+    float outY = ha.y - fabs(dy);
+    if (outX < outY) {
+        normal = Vector(dx < 0 ? -1 : 1, 0);
+        penetration = outX + radius;
+    } else {
+        normal = Vector(0, dy < 0 ? -1 : 1);
+        penetration = outY + radius;
+    }
+    return true;
+}
+
+bool circleCircleContact(const BodyStore& b, uint32_t i, uint32_t j,
+                         Contact& c) {
+    c.a = i;
+    c.b = j;
+    return circleCircle(Vector(b.px[i], b.py[i]), b.hx[i],
+                        Vector(b.px[j], b.py[j]), b.hx[j], c.normal,
+                        c.penetration);
+}
+
+bool rectRectContact(const BodyStore& b, uint32_t i, uint32_t j, Contact& c) {
+    c.a = i;
+    c.b = j;
+    return rectRect(Vector(b.px[i], b.py[i]), Vector(b.hx[i], b.hy[i]),
+                    Vector(b.px[j], b.py[j]), Vector(b.hx[j], b.hy[j]),
+                    c.normal, c.penetration);
+}
+
+// The rectangle is i and the circle is j
+bool rectCircleContact(const BodyStore& b, uint32_t i, uint32_t j,
+                       Contact& c) {
+    c.a = i;
+    c.b = j;
+    return rectCircle(Vector(b.px[i], b.py[i]), Vector(b.hx[i], b.hy[i]),
+                      Vector(b.px[j], b.py[j]), b.hx[j], c.normal,
+                      c.penetration);
+}
+
+// Same kernels, with the body grown by margin so anything that close counts
+// as touching (with a negative penetration, like the walls)
+bool staticContact(const BodyStore& b, uint32_t i, const StaticBody& s,
+                   float margin, Contact& c) {
+    Vector p(b.px[i], b.py[i]);
+    Vector h(b.hx[i] + margin, b.hy[i] + margin);
+    bool touching = false;
+    c.a = i;
+    c.b = wallBody;
+    if (b.type[i] == ShapeType::Circle) {
+        if (s.type == ShapeType::Circle) {
+            touching = circleCircle(p, h.x, s.center, s.half.x, c.normal,
+                                    c.penetration);
+        } else if (s.type == ShapeType::Rectangle) {
+            touching = rectCircle(s.center, s.half, p, h.x, c.normal,
+                                  c.penetration);
+            c.normal = -c.normal;
+        }
+    } else if (s.type == ShapeType::Circle) {
+        touching =
+            rectCircle(p, h, s.center, s.half.x, c.normal, c.penetration);
+    } else if (s.type == ShapeType::Rectangle) {
+        touching = rectRect(p, h, s.center, s.half, c.normal, c.penetration);
+    }
+    if (touching) {
+        c.penetration -= margin;
+    }
+    return touching;
+}
+
+bool shapeCircleContact(ShapeType type, Vector center, Vector half, Vector p,
+                        float radius, Vector& normal, float& penetration) {
+    if (type == ShapeType::Circle) {
+        return circleCircle(center, half.x, p, radius, normal, penetration);
+    } else if (type == ShapeType::Rectangle) {
+        return rectCircle(center, half, p, radius, normal, penetration);
+    }
+    return false;
+}
+
+// One wall per axis at most (the body would have to be bigger than the arena
+// to touch both)
+uint32_t wallContacts(const BodyStore& b, uint32_t i, const AABB& walls,
+                      float margin, Contact* out) {
+    uint32_t count = 0;
+    float lowX = walls.min.x - (b.px[i] - b.hx[i]);
+    float highX = b.px[i] + b.hx[i] - walls.max.x;
+    float lowY = walls.min.y - (b.py[i] - b.hy[i]);
+    float highY = b.py[i] + b.hy[i] - walls.max.y;
+    if (lowX > -margin) {
+        out[count++] = {i, wallBody, Vector(-1, 0), lowX};
+    } else if (highX > -margin) {
+        out[count++] = {i, wallBody, Vector(1, 0), highX};
+    }
+    if (lowY > -margin) {
+        out[count++] = {i, wallBody, Vector(0, -1), lowY};
+    } else if (highY > -margin) {
+        out[count++] = {i, wallBody, Vector(0, 1), highY};
+    }
+    return count;
+}
@@ -0,0 +1,144 @@
+// Narrow phase: contact kernels for each pair of shape types and the table
+// used to dispatch them
+
+#pragma once
+
+#include "bodies.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// A point where two bodies touch. Bodies here don't rotate, so one point per
+// pair is the whole manifold. The solver keeps the impulse it used on each
+// contact and starts from it next step if the same pair is still touching.
+struct Contact {
+    uint32_t a, b;        // Array indices of the bodies
+    Vector normal;        // Points from a to b
+    float penetration;    // Overlap along the normal (minus the gap for CCD)
+
+    // Filled in after the kernels (by the world and the solver)
+    uint64_t key = 0;         // Handle indices of the pair, for next step
+    uint64_t generation = 0;  // Handle generations, so reused slots don't match
+    float normalMass = 0;     // 1 / (inverse mass of a + inverse mass of b)
+    float bias = 0;           // Target separating speed (from restitution)
+    float closable = 0;       // How fast a gap can close without overlapping
+    float impulse = 0;        // Total impulse applied so far
+    float tangentImpulse = 0; // Same thing for friction
+};
+
+// Stands in for b in a contact with a wall. Walls never move, so the solver
+// treats them as infinitely heavy.
+constexpr uint32_t wallBody = UINT32_MAX;
+
+// Contacts between a body and the walls it's touching (or is within margin
+// of). Writes up to two contacts and returns how many.
+uint32_t wallContacts(const BodyStore& b, uint32_t i, const AABB& walls,
+                      float margin, Contact* out);
+
+// A piece of level geometry: a shape that never moves and doesn't sleep,
+// wake or take part in the broad phase. Bodies treat them like walls.
+struct StaticBody {
+    ShapeType type = ShapeType::Count; // Count for a removed one
+    Vector center;
+    Vector half; // Radius for circles, same as bodies
+    Color color;
+
+    AABB bounds() const {
+        return AABB{Vector(center.x - half.x, center.y - half.y),
+                    Vector(center.x + half.x, center.y + half.y)};
+    }
+};
+
+// Contact between a body and a static (which is b, as wallBody), counting
+// anything within margin as touching. Returns whether they are.
+bool staticContact(const BodyStore& b, uint32_t i, const StaticBody& s,
+                   float margin, Contact& c);
+
+// A shape given by value against a circle, for things that aren't bodies
+// (particles). The normal points from the shape to the circle.
+bool shapeCircleContact(ShapeType type, Vector center, Vector half, Vector p,
+                        float radius, Vector& normal, float& penetration);
+
+// Contact kernels for the built in shapes. Each one checks the pair for
+// overlap and fills in the contact if they're touching.
+bool circleCircleContact(const BodyStore& b, uint32_t i, uint32_t j,
+                         Contact& c);
+bool rectRectContact(const BodyStore& b, uint32_t i, uint32_t j, Contact& c);
+bool rectCircleContact(const BodyStore& b, uint32_t i, uint32_t j,
+                       Contact& c);
+
+// Signature shared by every contact kernel (store, the two bodies, then the
+// contact to fill in)
+using CollisionFn = bool (*)(const BodyStore&, uint32_t, uint32_t, Contact&);
+
+// Collision kernel for a pair of shape types. Adding a new shape type means
+// adding it to ShapeType and specializing this for each pair it can collide
+// with (setting exists, since a function's address isn't something the
+// compiler will always branch on at compile time). Only one order of each
+// pair is needed, and pairs without a kernel are just ignored.
+template <ShapeType A, ShapeType B>
+struct CollisionKernel {
+    static constexpr bool exists = false;
+    static constexpr CollisionFn collide = nullptr;
+};
+
+template <>
+struct CollisionKernel<ShapeType::Circle, ShapeType::Circle> {
+    static constexpr bool exists = true;
+    static constexpr CollisionFn collide = circleCircleContact;
+};
+
+template <>
+struct CollisionKernel<ShapeType::Rectangle, ShapeType::Rectangle> {
+    static constexpr bool exists = true;
+    static constexpr CollisionFn collide = rectRectContact;
+};
+
+template <>
+struct CollisionKernel<ShapeType::Rectangle, ShapeType::Circle> {
+    static constexpr bool exists = true;
+    static constexpr CollisionFn collide = rectCircleContact;
+};
+
+// Run the (B, A) kernel on an (A, B) pair and flip the contact around
+template <ShapeType A, ShapeType B>
+bool collideSwapped(const BodyStore& b, uint32_t i, uint32_t j, Contact& c) {
+    if (!CollisionKernel<B, A>::collide(b, j, i, c)) {
+        return false;
+    }
+    std::swap(c.a, c.b);
+    c.normal = -c.normal;
+    return true;
+}
+
+// Pick the kernel for a pair of types at compile time
+template <ShapeType A, ShapeType B>
+constexpr CollisionFn kernelFor() {
+    if constexpr (CollisionKernel<A, B>::exists) {
+        return CollisionKernel<A, B>::collide;
+    } else if constexpr (CollisionKernel<B, A>::exists) {
+        return collideSwapped<A, B>;
+    } else {
+        return nullptr;
+    }
+}
+
+constexpr size_t shapeTypeCount = (size_t)ShapeType::Count;
+
+template <size_t... I>
+constexpr std::array<CollisionFn, sizeof...(I)>
+makeCollisionMatrix(std::index_sequence<I...>) {
+    return {kernelFor<ShapeType(I / shapeTypeCount),
+                      ShapeType(I % shapeTypeCount)>()...};
+}
+
+// Every kernel laid out by type pair, so the narrow phase is one table lookup
+// per pair instead of a chain of type checks
+constexpr auto collisionMatrix = makeCollisionMatrix(
+    std::make_index_sequence<shapeTypeCount * shapeTypeCount>());
+
+// Look up the kernel for two bodies' types
+inline CollisionFn collisionKernel(ShapeType a, ShapeType b) {
+    return collisionMatrix[(size_t)a * shapeTypeCount + (size_t)b];
+}
@@ -0,0 +1,264 @@
+// Integrator kernels for each scheme and SIMD level
+
+#include "integrate.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define PHYSICS_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if PHYSICS_SSE && (defined(__GNUC__) || defined(__clang__))
+#define PHYSICS_AVX2 1
+#include <immintrin.h>
+
+// The AVX2 versions get compiled for AVX2 on their own, so the rest of the
+// library still runs on CPUs without it
+#define PHYSICS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// The schemes, moving one axis of one body (or four, or eight) along. Each
+// one's a struct so the loops below can be specialized on it and have it
+// inlined, and every width does the same math in the same order, so they
+// all give the same results. Accelerations get subtracted, like everywhere
+// else.
+struct SemiImplicitEuler {
+    static inline void advance(float& p, float& v, float a, float dt) {
+        v -= a * dt;
+        p += v * dt;
+    }
+
+#if PHYSICS_SSE
+    static inline void advance(__m128& p, __m128& v, __m128 a, __m128 dt) {
+        v = _mm_sub_ps(v, _mm_mul_ps(a, dt));
+        p = _mm_add_ps(p, _mm_mul_ps(v, dt));
+    }
+#endif
+
+#if PHYSICS_AVX2
+    PHYSICS_TARGET_AVX2 static inline void advance(__m256& p, __m256& v,
+                                                   __m256 a, __m256 dt) {
+        v = _mm256_sub_ps(v, _mm256_mul_ps(a, dt));
+        p = _mm256_add_ps(p, _mm256_mul_ps(v, dt));
+    }
+#endif
+};
+
+// Drift half a step, kick, drift the other half (no previous positions to
+// keep around, unlike the textbook form)
+struct Verlet {
+    static inline void advance(float& p, float& v, float a, float dt) {
+        float half = dt * 0.5f;
+        p += v * half;
+        v -= a * dt;
+        p += v * half;
+    }
+
+#if PHYSICS_SSE
+    static inline void advance(__m128& p, __m128& v, __m128 a, __m128 dt) {
+        __m128 half = _mm_mul_ps(dt, _mm_set1_ps(0.5f));
+        p = _mm_add_ps(p, _mm_mul_ps(v, half));
+        v = _mm_sub_ps(v, _mm_mul_ps(a, dt));
+        p = _mm_add_ps(p, _mm_mul_ps(v, half));
+    }
+#endif
+
+#if PHYSICS_AVX2
+    PHYSICS_TARGET_AVX2 static inline void advance(__m256& p, __m256& v,
+                                                   __m256 a, __m256 dt) {
+        __m256 half = _mm256_mul_ps(dt, _mm256_set1_ps(0.5f));
+        p = _mm256_add_ps(p, _mm256_mul_ps(v, half));
+        v = _mm256_sub_ps(v, _mm256_mul_ps(a, dt));
+        p = _mm256_add_ps(p, _mm256_mul_ps(v, half));
+    }
+#endif
+};
+
+// Push a body back inside the walls on one axis, and bounce it if it was
+// moving into the wall it hit (if it's already moving away, it's just being
+// shoved against the wall by something else and shouldn't get flipped back)
+static inline void bounce(float& p, float& v, float h, float lo, float hi) {
+    if (p - h < lo) {
+        p = lo + h;
+        if (v < 0) {
+            v = -v * 0.9f; // Reflect and dampen velocity
+        }
+    } else if (p + h > hi) {
+        p = hi - h;
+        if (v > 0) {
+            v = -v * 0.9f;
+        }
+    }
+}
+
+// Plain one body at a time version, also used for the leftovers at the end
+// of the wider versions
+template <typename Scheme>
+static void integrateScalar(BodyStore& b, uint32_t begin, uint32_t end,
+                            float dt, const AABB& walls) {
+    for (uint32_t i = begin; i < end; i++) {
+        Scheme::advance(b.px[i], b.vx[i], b.ax[i], dt);
+        Scheme::advance(b.py[i], b.vy[i], b.ay[i], dt);
+
+        // Bounce off walls
+        bounce(b.px[i], b.vx[i], b.hx[i], walls.min.x, walls.max.x);
+        bounce(b.py[i], b.vy[i], b.hy[i], walls.min.y, walls.max.y);
+    }
+}
+
+#if PHYSICS_SSE
+// Pick b where the mask is set and a everywhere else
+static inline __m128 select4(__m128 a, __m128 b, __m128 mask) {
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+// Same thing as the scalar bounce, for one axis of four bodies
+static inline void bounce4(__m128& p, __m128& v, __m128 h, __m128 lo,
+                           __m128 hi) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 hitLo = _mm_cmplt_ps(_mm_sub_ps(p, h), lo);
+    __m128 hitHi = _mm_andnot_ps(hitLo, _mm_cmpgt_ps(_mm_add_ps(p, h), hi));
+    __m128 flip = _mm_or_ps(_mm_and_ps(hitLo, _mm_cmplt_ps(v, zero)),
+                            _mm_and_ps(hitHi, _mm_cmpgt_ps(v, zero)));
+    v = select4(v, _mm_mul_ps(v, _mm_set1_ps(-0.9f)), flip);
+    p = select4(p, _mm_add_ps(lo, h), hitLo);
+    p = select4(p, _mm_sub_ps(hi, h), hitHi);
+}
+
+// Four bodies at a time
+template <typename Scheme>
+static void integrateSSE(BodyStore& b, uint32_t begin, uint32_t end, float dt,
+                         const AABB& walls) {
+    __m128 step = _mm_set1_ps(dt);
+    __m128 minX = _mm_set1_ps(walls.min.x), maxX = _mm_set1_ps(walls.max.x);
+    __m128 minY = _mm_set1_ps(walls.min.y), maxY = _mm_set1_ps(walls.max.y);
+    uint32_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 px = _mm_loadu_ps(&b.px[i]);
+        __m128 py = _mm_loadu_ps(&b.py[i]);
+        __m128 vx = _mm_loadu_ps(&b.vx[i]);
+        __m128 vy = _mm_loadu_ps(&b.vy[i]);
+        Scheme::advance(px, vx, _mm_loadu_ps(&b.ax[i]), step);
+        Scheme::advance(py, vy, _mm_loadu_ps(&b.ay[i]), step);
+
+        bounce4(px, vx, _mm_loadu_ps(&b.hx[i]), minX, maxX);
+        bounce4(py, vy, _mm_loadu_ps(&b.hy[i]), minY, maxY);
+
+        _mm_storeu_ps(&b.px[i], px);
+        _mm_storeu_ps(&b.py[i], py);
+        _mm_storeu_ps(&b.vx[i], vx);
+        _mm_storeu_ps(&b.vy[i], vy);
+    }
+    integrateScalar<Scheme>(b, i, end, dt, walls);
+}
+#endif
+
+#if PHYSICS_AVX2
+PHYSICS_TARGET_AVX2 static inline void bounce8(__m256& p, __m256& v, __m256 h,
+                                               __m256 lo, __m256 hi) {
+    __m256 zero = _mm256_setzero_ps();
+    __m256 hitLo = _mm256_cmp_ps(_mm256_sub_ps(p, h), lo, _CMP_LT_OQ);
+    __m256 hitHi = _mm256_andnot_ps(
+        hitLo, _mm256_cmp_ps(_mm256_add_ps(p, h), hi, _CMP_GT_OQ));
+    __m256 flip = _mm256_or_ps(
+        _mm256_and_ps(hitLo, _mm256_cmp_ps(v, zero, _CMP_LT_OQ)),
+        _mm256_and_ps(hitHi, _mm256_cmp_ps(v, zero, _CMP_GT_OQ)));
+    v = _mm256_blendv_ps(v, _mm256_mul_ps(v, _mm256_set1_ps(-0.9f)), flip);
+    p = _mm256_blendv_ps(p, _mm256_add_ps(lo, h), hitLo);
+    p = _mm256_blendv_ps(p, _mm256_sub_ps(hi, h), hitHi);
+}
+
+// Eight bodies at a time
+template <typename Scheme>
+PHYSICS_TARGET_AVX2 static void integrateAVX2(BodyStore& b, uint32_t begin,
+                                              uint32_t end, float dt,
+                                              const AABB& walls) {
+    __m256 step = _mm256_set1_ps(dt);
+    __m256 minX = _mm256_set1_ps(walls.min.x);
+    __m256 maxX = _mm256_set1_ps(walls.max.x);
+    __m256 minY = _mm256_set1_ps(walls.min.y);
+    __m256 maxY = _mm256_set1_ps(walls.max.y);
+    uint32_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 px = _mm256_loadu_ps(&b.px[i]);
+        __m256 py = _mm256_loadu_ps(&b.py[i]);
+        __m256 vx = _mm256_loadu_ps(&b.vx[i]);
+        __m256 vy = _mm256_loadu_ps(&b.vy[i]);
+        Scheme::advance(px, vx, _mm256_loadu_ps(&b.ax[i]), step);
+        Scheme::advance(py, vy, _mm256_loadu_ps(&b.ay[i]), step);
+
+        bounce8(px, vx, _mm256_loadu_ps(&b.hx[i]), minX, maxX);
+        bounce8(py, vy, _mm256_loadu_ps(&b.hy[i]), minY, maxY);
+
+        _mm256_storeu_ps(&b.px[i], px);
+        _mm256_storeu_ps(&b.py[i], py);
+        _mm256_storeu_ps(&b.vx[i], vx);
+        _mm256_storeu_ps(&b.vy[i], vy);
+    }
+    integrateScalar<Scheme>(b, i, end, dt, walls);
+}
+#endif
+
+SimdLevel detectSimdLevel() {
+#if PHYSICS_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+#endif
+#if PHYSICS_SSE
+    return SimdLevel::SSE;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::SSE:
+        return "SSE";
+    default:
+        return "Scalar";
+    }
+}
+
+const char* integratorName(Integrator integrator) {
+    switch (integrator) {
+    case Integrator::Verlet:
+        return "Verlet";
+    default:
+        return "Semi-implicit Euler";
+    }
+}
+
+template <typename Scheme>
+static void integrateWith(BodyStore& b, uint32_t begin, uint32_t end,
+                          float dt, const AABB& walls, SimdLevel level) {
+    // Fall back if the asked for path isn't in this build
+#if PHYSICS_AVX2
+    if (level == SimdLevel::AVX2) {
+        integrateAVX2<Scheme>(b, begin, end, dt, walls);
+        return;
+    }
+#endif
+#if PHYSICS_SSE
+    if (level != SimdLevel::Scalar) {
+        integrateSSE<Scheme>(b, begin, end, dt, walls);
+        return;
+    }
+#endif
+    integrateScalar<Scheme>(b, begin, end, dt, walls);
+}
+
+void integrateBodies(BodyStore& b, uint32_t begin, uint32_t end, float dt,
+                     const AABB& walls, SimdLevel level,
+                     Integrator integrator) {
+    switch (integrator) {
+    case Integrator::Verlet:
+        integrateWith<Verlet>(b, begin, end, dt, walls, level);
+        break;
+    default:
+        integrateWith<SemiImplicitEuler>(b, begin, end, dt, walls, level);
+        break;
+    }
+}
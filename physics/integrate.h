@@ -0,0 +1,35 @@
+// Integrator kernels: moving bodies by their velocity and acceleration with
+// one of a few schemes, plus the wall bounce, run over the body arrays
+// several bodies at a time with SSE or AVX2 when the CPU has them
+
+#pragma once
+
+#include "bodies.h"
+#include <cstdint>
+
+// Code paths the integrator can take
+enum class SimdLevel { Scalar, SSE, AVX2 };
+
+// Ways of moving bodies along over a step. Accelerations are constant (they
+// don't depend on position or velocity), so Verlet already follows the exact
+// curve, and higher order schemes like RK4 would only cost more.
+enum class Integrator {
+    SemiImplicitEuler, // Velocity first, then position with the new velocity
+    Verlet,            // Position Verlet: half a drift, a kick, half a drift
+};
+
+// Best code path this build and this CPU support
+SimdLevel detectSimdLevel();
+
+// Name of a code path (for stats and benchmarks)
+const char* simdLevelName(SimdLevel level);
+
+// Name of an integrator
+const char* integratorName(Integrator integrator);
+
+// Integrate bodies [begin, end) and bounce them off the walls. Every code
+// path gives exactly the same results for a given integrator, the wider
+// ones are just faster.
+void integrateBodies(BodyStore& b, uint32_t begin, uint32_t end, float dt,
+                     const AABB& walls, SimdLevel level,
+                     Integrator integrator = Integrator::SemiImplicitEuler);
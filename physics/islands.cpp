@@ -0,0 +1,106 @@
+// Island building with union find
+
+#include "islands.h"
+#include <algorithm>
+
+void IslandBuilder::build(
+    uint32_t bodyCount,
+    const std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+    FrameArena& scratch, const uint8_t* anchored) {
+    // Every body starts out on its own
+    parent.resize(bodyCount);
+    for (uint32_t i = 0; i < bodyCount; i++) {
+        parent[i] = i;
+    }
+    for (auto& pair : pairs) {
+        merge(pair.first, pair.second);
+    }
+
+    // Number the islands in order of their lowest body (which is always the
+    // root), so the numbering only depends on the bodies and not on the order
+    // the pairs came in
+    islandIds.assign(bodyCount, UINT32_MAX);
+    for (auto& pair : pairs) {
+        islandIds[find(pair.first)] = 0;
+    }
+    if (anchored) {
+        for (uint32_t i = 0; i < bodyCount; i++) {
+            if (anchored[i]) {
+                islandIds[find(i)] = 0;
+            }
+        }
+    }
+    uint32_t islandCount = 0;
+    for (uint32_t i = 0; i < bodyCount; i++) {
+        if (islandIds[i] == 0 && parent[i] == i) {
+            islandIds[i] = islandCount++;
+        }
+    }
+
+    // Counting sort the pairs by island
+    islandStart.assign(islandCount + 1, 0);
+    for (auto& pair : pairs) {
+        islandStart[islandOf(pair.first) + 1]++;
+    }
+    for (uint32_t i = 1; i <= islandCount; i++) {
+        islandStart[i] += islandStart[i - 1];
+    }
+    uint32_t* cursor = scratch.allocate<uint32_t>(islandCount);
+    std::copy(islandStart.begin(), islandStart.end() - 1, cursor);
+    sortedPairs.resize(pairs.size());
+    for (auto& pair : pairs) {
+        auto sorted = std::minmax(pair.first, pair.second);
+        sortedPairs[cursor[islandOf(pair.first)]++] = {sorted.first,
+                                                       sorted.second};
+    }
+
+    // Then sort within each island
+    for (uint32_t i = 0; i < islandCount; i++) {
+        std::sort(sortedPairs.begin() + islandStart[i],
+                  sortedPairs.begin() + islandStart[i + 1]);
+    }
+
+    // Counting sort the bodies by island too (bodies go in in order, so
+    // they come out in order)
+    bodyStart.assign(islandCount + 1, 0);
+    for (uint32_t i = 0; i < bodyCount; i++) {
+        uint32_t island = islandOf(i);
+        if (island != UINT32_MAX) {
+            bodyStart[island + 1]++;
+        }
+    }
+    for (uint32_t i = 1; i <= islandCount; i++) {
+        bodyStart[i] += bodyStart[i - 1];
+    }
+    std::copy(bodyStart.begin(), bodyStart.end() - 1, cursor);
+    islandBodies.resize(bodyStart.back());
+    for (uint32_t i = 0; i < bodyCount; i++) {
+        uint32_t island = islandOf(i);
+        if (island != UINT32_MAX) {
+            islandBodies[cursor[island]++] = i;
+        }
+    }
+}
+
+uint32_t IslandBuilder::find(uint32_t body) const {
+    // Walk up to the root, halving the path as we go
+    while (parent[body] != body) {
+        parent[body] = parent[parent[body]];
+        body = parent[body];
+    }
+    return body;
+}
+
+void IslandBuilder::merge(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+        return;
+    }
+    // Keep the lower body as the root
+    if (a < b) {
+        parent[b] = a;
+    } else {
+        parent[a] = b;
+    }
+}
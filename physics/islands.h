@@ -0,0 +1,72 @@
+// Contact islands: groups of bodies that touch each other, directly or
+// through other bodies. Nothing in one island can affect another during a
+// step, so islands can be solved on different threads.
+
+#pragma once
+
+#include "arena.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class IslandBuilder {
+  public:
+    // Group the bodies connected by the candidate pairs into islands. Bodies
+    // flagged in anchored (if given) get an island even if they're in no
+    // pair, since they have something besides other bodies to solve against.
+    void build(uint32_t bodyCount,
+               const std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+               FrameArena& scratch, const uint8_t* anchored = nullptr);
+
+    uint32_t get_island_count() const {
+        return (uint32_t)islandStart.size() - 1;
+    }
+
+    // Every pair, grouped by island and sorted within each island, so the
+    // solve order doesn't depend on which broad phase found them
+    const std::vector<std::pair<uint32_t, uint32_t>>& get_pairs() const {
+        return sortedPairs;
+    }
+
+    // Range of pairs in an island
+    uint32_t islandBegin(uint32_t island) const {
+        return islandStart[island];
+    }
+
+    uint32_t islandEnd(uint32_t island) const {
+        return islandStart[island + 1];
+    }
+
+    // Which island a body ended up in (UINT32_MAX for bodies not in a pair
+    // or anchored)
+    uint32_t islandOf(uint32_t body) const {
+        return islandIds[find(body)];
+    }
+
+    // Every body in a pair (or anchored), grouped by island (in order within each island)
+    const std::vector<uint32_t>& get_bodies() const {
+        return islandBodies;
+    }
+
+    // Range of bodies in an island
+    uint32_t bodyBegin(uint32_t island) const {
+        return bodyStart[island];
+    }
+
+    uint32_t bodyEnd(uint32_t island) const {
+        return bodyStart[island + 1];
+    }
+
+  private:
+    // Union find helpers
+    uint32_t find(uint32_t body) const;
+    void merge(uint32_t a, uint32_t b);
+
+    // Island variables
+    mutable std::vector<uint32_t> parent;
+    std::vector<uint32_t> islandIds; // Root body -> island number
+    std::vector<uint32_t> islandStart;
+    std::vector<std::pair<uint32_t, uint32_t>> sortedPairs;
+    std::vector<uint32_t> bodyStart;
+    std::vector<uint32_t> islandBodies;
+};
@@ -0,0 +1,118 @@
+// Work stealing job system
+
+#include "jobs.h"
+
+JobSystem::JobSystem(unsigned threads) : queues(threads > 0 ? threads : 1) {
+    // The caller is a worker too, so start one less thread
+    for (unsigned i = 0; i + 1 < queues.size(); i++) {
+        workers.emplace_back([this, i] { work(i); });
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void JobSystem::parallelFor(uint32_t count,
+                            const std::function<void(uint32_t)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    // Not worth waking anyone up for
+    if (workers.empty() || count == 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    // Deal the jobs out round robin
+    std::atomic<uint32_t> remaining{count};
+    for (uint32_t i = 0; i < count; i++) {
+        Queue& q = queues[i % queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+        q.push_back(Job{&fn, &remaining, i});
+    }
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        queued.fetch_add(count);
+    }
+    wake.notify_all();
+
+    // Help out until everything is done (jobs already taken by someone else
+    // might still be running after the queues empty)
+    unsigned caller = (unsigned)queues.size() - 1;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        if (!runOne(caller)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::work(unsigned index) {
+    while (true) {
+        if (runOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [this] { return quit || queued.load() > 0; });
+        if (quit) {
+            return;
+        }
+    }
+}
+
+bool JobSystem::runOne(unsigned index) {
+    Job job{nullptr, nullptr, 0};
+
+    // Newest job from our own queue first (it's the most likely to be warm in
+    // the cache), then the oldest job from everyone else's
+    for (size_t n = 0; n < queues.size() && !job.fn; n++) {
+        Queue& q = queues[(index + n) % queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.count == 0) {
+            continue;
+        }
+        job = n == 0 ? q.pop_back() : q.pop_front();
+    }
+    if (!job.fn) {
+        return false;
+    }
+    queued.fetch_sub(1);
+    (*job.fn)(job.index);
+    job.remaining->fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void JobSystem::Queue::push_back(const Job& job) {
+    // Out of room, so unroll into a buffer twice the size
+    if (count == ring.size()) {
+        std::vector<Job> bigger(ring.size() * 2);
+        for (size_t i = 0; i < count; i++) {
+            bigger[i] = ring[(head + i) % ring.size()];
+        }
+        ring.swap(bigger);
+        head = 0;
+    }
+    ring[(head + count) % ring.size()] = job;
+    count++;
+}
+
+JobSystem::Job JobSystem::Queue::pop_back() {
+    count--;
+    return ring[(head + count) % ring.size()];
+}
+
+JobSystem::Job JobSystem::Queue::pop_front() {
+    Job job = ring[head];
+    head = (head + 1) % ring.size();
+    count--;
+    return job;
+}
@@ -0,0 +1,70 @@
+// Work stealing job system. Every worker has its own queue and takes jobs off
+// the back of it; once it runs dry it steals from the front of someone else's.
+// The thread that hands out the work pitches in until it's all done. Jobs are
+// plain structs in ring buffers, so handing them out never touches the heap.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+  public:
+    // Constructor (0 threads means run everything on the calling thread)
+    JobSystem(unsigned threads = std::thread::hardware_concurrency());
+
+    // Destructor
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Run fn(0) through fn(count - 1) across the workers and wait for all of
+    // them to finish
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+    // Total threads doing work, counting the caller
+    unsigned get_thread_count() const {
+        return (unsigned)workers.size() + 1;
+    }
+
+  private:
+    // One call of a parallelFor
+    struct Job {
+        const std::function<void(uint32_t)>* fn;
+        std::atomic<uint32_t>* remaining;
+        uint32_t index;
+    };
+
+    // One worker's queue (a ring buffer that only grows, and only when a
+    // parallelFor hands out more jobs than ever before)
+    struct Queue {
+        std::mutex lock;
+        std::vector<Job> ring = std::vector<Job>(64);
+        size_t head = 0;
+        size_t count = 0;
+
+        void push_back(const Job& job);
+        Job pop_back();
+        Job pop_front();
+    };
+
+    // Worker thread loop
+    void work(unsigned index);
+
+    // Run one job from our own queue or a stolen one, if there is any
+    bool runOne(unsigned index);
+
+    // Job system variables
+    std::vector<std::thread> workers;
+    std::vector<Queue> queues; // One per worker plus one for the caller
+    std::atomic<uint32_t> queued{0};
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    bool quit = false;
+};
@@ -0,0 +1,231 @@
+// Input logging and lockstep playback
+
+#include "lockstep.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// File layout (little-endian): a header, the events and then the hashes
+struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    float timestep;
+    uint64_t seed;
+    uint64_t eventCount;
+    uint64_t tickCount;
+};
+
+static const char magic[8] = {'P', 'H', 'Y', 'S', 'I', 'N', 'P', 'T'};
+static const uint32_t version = 1;
+
+bool InputLog::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    LogHeader header = {};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.timestep = timestep;
+    header.seed = seed;
+    header.eventCount = events.size();
+    header.tickCount = hashes.size();
+    out.write((const char*)&header, sizeof(header));
+    // Events go out as a tick and a type byte each, so padding never ends
+    // up in the file
+    for (const InputEvent& e : events) {
+        out.write((const char*)&e.tick, sizeof(e.tick));
+        out.write((const char*)&e.type, sizeof(e.type));
+    }
+    out.write((const char*)hashes.data(), hashes.size() * sizeof(uint64_t));
+    return (bool)out;
+}
+
+bool InputLog::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return false;
+    }
+    uint64_t length = (uint64_t)in.tellg();
+    in.seekg(0);
+    LogHeader header;
+    if (length < sizeof(header) || !in.read((char*)&header, sizeof(header)) ||
+        memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        header.version != version) {
+        return false;
+    }
+
+    // Make sure the counts fit in the file before making room for them, so
+    // a cut off or corrupt log can't ask for gigabytes
+    uint64_t eventSize = sizeof(InputEvent::tick) + sizeof(InputEvent::type);
+    uint64_t left = length - sizeof(header);
+    if (header.eventCount > left / eventSize ||
+        header.tickCount >
+            (left - header.eventCount * eventSize) / sizeof(uint64_t)) {
+        return false;
+    }
+
+    // Read into new arrays, so a failed load leaves this log as it was
+    std::vector<InputEvent> loadedEvents(header.eventCount);
+    for (InputEvent& e : loadedEvents) {
+        in.read((char*)&e.tick, sizeof(e.tick));
+        in.read((char*)&e.type, sizeof(e.type));
+    }
+    std::vector<uint64_t> loadedHashes(header.tickCount);
+    in.read((char*)loadedHashes.data(), loadedHashes.size() * sizeof(uint64_t));
+    if (!in) {
+        return false;
+    }
+    timestep = header.timestep;
+    seed = header.seed;
+    events = std::move(loadedEvents);
+    hashes = std::move(loadedHashes);
+    return true;
+}
+
+Lockstep::Lockstep(World& world, uint64_t seed) : world(world) {
+    log.seed = seed;
+    log.timestep = world.get_timestep();
+    world.get_random().set_seed(seed);
+}
+
+Lockstep::Lockstep(World& world, const InputLog& recorded)
+    : world(world), log(recorded), playing(true) {
+    world.set_timestep(log.timestep);
+    world.get_random().set_seed(log.seed);
+}
+
+void Lockstep::input(InputType type) {
+    if (!playing) {
+        queued.push_back(type);
+    }
+}
+
+void Lockstep::tick() {
+    if (is_finished()) {
+        return;
+    }
+    uint64_t tick = world.get_step_count();
+    if (playing) {
+        while (nextEvent < log.events.size() &&
+               log.events[nextEvent].tick <= tick) {
+            apply(log.events[nextEvent++].type);
+        }
+    } else {
+        for (InputType type : queued) {
+            apply(type);
+            log.events.push_back({tick, type});
+        }
+        queued.clear();
+    }
+
+    world.step(world.get_timestep());
+
+    uint64_t hash = world.hash();
+    if (!playing) {
+        log.hashes.push_back(hash);
+    } else if (log.hashes[tick] != hash && diverged == UINT64_MAX) {
+        diverged = tick;
+    }
+}
+
+int Lockstep::advance(float elapsed) {
+    return fixedStep.advance(elapsed, world.get_timestep(), [this] { tick(); });
+}
+
+void Lockstep::apply(InputType type) {
+    BodyStore& bodies = world.get_bodies();
+    switch (type) {
+    case InputType::Spawn:
+        createRandomShape(bodies, world.get_random(), a, a_const);
+        break;
+    case InputType::Clear:
+        bodies.clear();
+        for (uint32_t id = 0; id < world.get_statics().size(); id++) {
+            world.removeStatic(id);
+        }
+        world.get_particles().clear();
+        break;
+    case InputType::SwitchBroadPhase:
+        world.set_broad_phase(world.get_broad_phase_type() ==
+                                      BroadPhaseType::Grid
+                                  ? BroadPhaseType::SweepAndPrune
+                                  : BroadPhaseType::Grid);
+        break;
+    case InputType::GravityUp:
+    case InputType::GravityDown:
+    case InputType::GravityLeft:
+    case InputType::GravityRight:
+        // Point gravity the new way, or with gravity off, give everything a
+        // kick instead
+        a = type == InputType::GravityUp     ? Vector(0, 200.0f)
+            : type == InputType::GravityDown ? Vector(0, -200.0f)
+            : type == InputType::GravityLeft ? Vector(200.0f, 0)
+                                             : Vector(-200.0f, 0);
+        for (Shape shape : bodies) {
+            if (a_const == 0) {
+                shape.set_velocity(shape.velocity() - a);
+            } else {
+                shape.set_acceleration(a * a_const);
+            }
+        }
+        if (a_const == 0) {
+            world.get_particles().addVelocity(-a);
+        } else {
+            world.get_particles().get_settings().acceleration = a * a_const;
+        }
+        break;
+    case InputType::GravityLess:
+        if (a_const > 0) {
+            for (Shape shape : bodies) {
+                shape.set_acceleration(shape.acceleration() / a_const);
+            }
+            a_const -= 1;
+        }
+        for (Shape shape : bodies) {
+            shape.set_acceleration(shape.acceleration() * a_const);
+        }
+        world.get_particles().get_settings().acceleration = a * a_const;
+        break;
+    case InputType::GravityMore:
+        if (a_const > 0) {
+            for (Shape shape : bodies) {
+                shape.set_acceleration(shape.acceleration() / a_const);
+            }
+        }
+        a_const += 1;
+        for (Shape shape : bodies) {
+            shape.set_acceleration(shape.acceleration() * a_const);
+        }
+        world.get_particles().get_settings().acceleration = a * a_const;
+        break;
+    case InputType::AddPlatform: {
+        // One draw per statement, same as createRandomShape
+        float x = 100 + world.get_random().below(800);
+        float y = 100 + world.get_random().below(700);
+        float width = 80 + world.get_random().below(200);
+        world.addStatic(Rectangle(Vector(x, y), Vector(width, 16),
+                                  Color(0x80, 0x80, 0x80)));
+        break;
+    }
+    case InputType::SpawnMany: {
+        SpawnSettings settings;
+        settings.minRadius = 5;
+        settings.maxRadius = 15;
+        settings.minSize = Vector(10, 10);
+        settings.maxSize = Vector(30, 30);
+        settings.acceleration = a * a_const;
+        world.spawn(100, settings);
+        break;
+    }
+    case InputType::Pour: {
+        // A couple of thousand particles somewhere up top
+        float x = 100 + world.get_random().below(600);
+        float y = 100 + world.get_random().below(300);
+        ParticleSystem& particles = world.get_particles();
+        particles.get_settings().acceleration = a * a_const;
+        particles.fill(AABB{Vector(x, y), Vector(x + 200, y + 160)});
+        break;
+    }
+    }
+}
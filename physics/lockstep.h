@@ -0,0 +1,109 @@
+// Lockstep: deterministic runs driven by a log of inputs. The world steps
+// with a fixed dt, spawns from its own seeded random numbers and solves in an
+// order that doesn't depend on threads, so the same seed and the same inputs
+// on the same ticks always give bit for bit the same world. That means a
+// whole run can be saved as just its inputs (a few bytes each) and played
+// back exactly, with a hash of the world after every tick to catch the first
+// tick a replay comes out different.
+
+#pragma once
+
+#include "world.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Everything the player can do to the world
+enum class InputType : uint8_t {
+    Spawn,            // Add a random shape
+    Clear,            // Remove every shape, platform and particle
+    SwitchBroadPhase, // Grid <-> sweep and prune
+    GravityUp,        // Point gravity a new way (or kick every shape that
+    GravityDown,      // way when gravity's off)
+    GravityLeft,
+    GravityRight,
+    GravityLess, // Gravity scale down or up by one
+    GravityMore,
+    AddPlatform, // Add a random static platform
+    SpawnMany,   // Add a hundred small shapes at once
+    Pour,        // Add a block of particles
+};
+
+struct InputEvent {
+    uint64_t tick; // Step it was applied before
+    InputType type;
+};
+
+// A recorded run: the seed and timestep it started from, every input, and a
+// hash of the world after every tick
+struct InputLog {
+    uint64_t seed = 1;
+    float timestep = 1 / 120.0f;
+    std::vector<InputEvent> events;
+    std::vector<uint64_t> hashes;
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+};
+
+class Lockstep {
+  public:
+    // Start recording (the world should be empty and never stepped, since
+    // the log only knows how to get from there)
+    Lockstep(World& world, uint64_t seed = 1);
+
+    // Play a log back instead of taking inputs (same goes for the world)
+    Lockstep(World& world, const InputLog& recorded);
+
+    // Queue an input for the next tick (ignored while playing a log back)
+    void input(InputType type);
+
+    // Apply this tick's inputs, step once and check or record the hash
+    void tick();
+
+    // Run fixed ticks for the elapsed time (same as World::advance, but every
+    // step goes through tick())
+    int advance(float elapsed);
+
+    bool is_playing() const {
+        return playing;
+    }
+
+    // Whether playback has run out of ticks
+    bool is_finished() const {
+        return playing && world.get_step_count() >= log.hashes.size();
+    }
+
+    // First tick whose hash didn't match the log (UINT64_MAX if none)
+    uint64_t get_diverged() const {
+        return diverged;
+    }
+
+    // What's been recorded so far (or what's playing)
+    const InputLog& get_log() const {
+        return log;
+    }
+
+    // Gravity direction and scale, which the inputs change
+    Vector get_gravity() const {
+        return a;
+    }
+
+    int get_gravity_scale() const {
+        return a_const;
+    }
+
+  private:
+    // Do what an input does to the world
+    void apply(InputType type);
+
+    World& world;
+    InputLog log;
+    std::vector<InputType> queued;
+    size_t nextEvent = 0; // Playback position in the log
+    bool playing = false;
+    uint64_t diverged = UINT64_MAX;
+    Vector a = Vector(0, -200.0f);
+    int a_const = 1;
+    FixedTimestep fixedStep;
+};
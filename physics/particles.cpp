@@ -0,0 +1,622 @@
+// Particle stepping: the counting sort, the pair kernels for each SIMD level
+// and coupling with bodies
+
+#include "particles.h"
+#include <algorithm>
+#include <cstring>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define PARTICLES_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if PARTICLES_SSE && (defined(__GNUC__) || defined(__clang__))
+#define PARTICLES_AVX2 1
+#define PARTICLES_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+static const uint32_t blockSize = ParticleSystem::blockSize;
+
+// Particles per job, for integrating and colliding
+static const uint32_t jobParticles = 4096;
+
+// Cap on grid cells, so a tiny radius in a huge arena can't eat all the
+// memory (cells just get bigger than a particle past this)
+static const uint64_t maxCells = 1 << 22;
+
+uint32_t ParticleSystem::add(Vector p, Vector v) {
+    if (count % blockSize == 0) {
+        blocks.push_back(Block());
+    }
+    Block& b = blocks.back();
+    uint32_t lane = count % blockSize;
+    b.px[lane] = p.x;
+    b.py[lane] = p.y;
+    b.vx[lane] = v.x;
+    b.vy[lane] = v.y;
+    return count++;
+}
+
+uint32_t ParticleSystem::fill(const AABB& region, Vector v) {
+    float spacing = settings.radius * 2;
+    uint32_t added = 0;
+    for (float y = region.min.y + settings.radius;
+         y + settings.radius <= region.max.y; y += spacing) {
+        for (float x = region.min.x + settings.radius;
+             x + settings.radius <= region.max.x; x += spacing) {
+            add(Vector(x, y), v);
+            added++;
+        }
+    }
+    return added;
+}
+
+void ParticleSystem::addVelocity(Vector dv) {
+    for (Block& b : blocks) {
+        for (uint32_t lane = 0; lane < blockSize; lane++) {
+            b.vx[lane] += dv.x;
+            b.vy[lane] += dv.y;
+        }
+    }
+}
+
+uint64_t ParticleSystem::hash() const {
+    uint64_t h = 1469598103934665603ull;
+    for (uint32_t i = 0; i < count; i++) {
+        const Block& b = blocks[i / blockSize];
+        uint32_t lane = i % blockSize;
+        for (float f : {b.px[lane], b.py[lane], b.vx[lane], b.vy[lane]}) {
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            h = (h ^ bits) * 1099511628211ull;
+        }
+    }
+    return h;
+}
+
+void ParticleSystem::step(float dt, const AABB& walls, JobSystem& jobs,
+                          SimdLevel level) {
+    if (count == 0) {
+        contactCount = 0;
+        return;
+    }
+    // Sort again after every move, since a particle can cross a cell edge
+    // in any substep and the pair search only looks one cell over
+    next.resize(blocks.size());
+    int substeps = std::max(settings.iterations, 1);
+    float h = dt / substeps;
+    for (int it = 0; it < substeps; it++) {
+        integrate(h, walls, jobs);
+        bin(walls, jobs);
+        collide(h, walls, jobs, level);
+    }
+}
+
+// Push a particle back inside the walls on one axis, bouncing it if it was
+// headed out
+static inline void bounce(float& p, float& v, float r, float lo, float hi,
+                          float restitution) {
+    if (p - r < lo) {
+        p = lo + r;
+        if (v < 0) {
+            v = -v * restitution;
+        }
+    } else if (p + r > hi) {
+        p = hi - r;
+        if (v > 0) {
+            v = -v * restitution;
+        }
+    }
+}
+
+void ParticleSystem::integrate(float dt, const AABB& walls, JobSystem& jobs) {
+    uint32_t perJob = jobParticles / blockSize;
+    uint32_t jobCount = ((uint32_t)blocks.size() + perJob - 1) / perJob;
+    float ax = settings.acceleration.x * dt;
+    float ay = settings.acceleration.y * dt;
+    float r = settings.radius;
+    float e = settings.restitution;
+    float limit = r / dt; // Nothing moves more than a radius, so nothing can
+                          // get through anything else between passes
+    jobs.parallelFor(jobCount, [&](uint32_t job) {
+        uint32_t end = std::min((job + 1) * perJob, (uint32_t)blocks.size());
+        for (uint32_t k = job * perJob; k < end; k++) {
+            Block& b = blocks[k];
+            for (uint32_t lane = 0; lane < blockSize; lane++) {
+                b.vx[lane] = std::clamp(b.vx[lane] - ax, -limit, limit);
+                b.vy[lane] = std::clamp(b.vy[lane] - ay, -limit, limit);
+                b.px[lane] += b.vx[lane] * dt;
+                b.py[lane] += b.vy[lane] * dt;
+            }
+            for (uint32_t lane = 0; lane < blockSize; lane++) {
+                bounce(b.px[lane], b.vx[lane], r, walls.min.x, walls.max.x, e);
+                bounce(b.py[lane], b.vy[lane], r, walls.min.y, walls.max.y, e);
+            }
+        }
+    });
+}
+
+void ParticleSystem::bin(const AABB& walls, JobSystem& jobs) {
+    // Cells are a particle across, unless that would make too many
+    float width = std::max(walls.max.x - walls.min.x, 1.0f);
+    float height = std::max(walls.max.y - walls.min.y, 1.0f);
+    cellSize = std::max(settings.radius * 2,
+                        sqrtf(width * height / (float)maxCells));
+    gridBox = walls;
+    columns = std::max((int)ceilf(width / cellSize), 1);
+    rows = std::max((int)ceilf(height / cellSize), 1);
+    uint32_t cellCount = (uint32_t)columns * rows;
+
+    // Which cell everything's in
+    keys.resize(count);
+    uint32_t jobCount = (count + jobParticles - 1) / jobParticles;
+    float scale = 1 / cellSize;
+    jobs.parallelFor(jobCount, [&](uint32_t job) {
+        uint32_t end = std::min((job + 1) * jobParticles, count);
+        for (uint32_t i = job * jobParticles; i < end; i++) {
+            const Block& b = blocks[i / blockSize];
+            int x = (int)((b.px[i % blockSize] - walls.min.x) * scale);
+            int y = (int)((b.py[i % blockSize] - walls.min.y) * scale);
+            x = std::clamp(x, 0, columns - 1);
+            y = std::clamp(y, 0, rows - 1);
+            keys[i] = (uint32_t)y * columns + x;
+        }
+    });
+
+    // Count each cell, then turn the counts into where each cell's run ends
+    // up. Going through in order keeps particles in the same order within a
+    // cell, so the sort (and everything after it) is the same every run.
+    cellStart.assign(cellCount + 1, 0);
+    for (uint32_t i = 0; i < count; i++) {
+        cellStart[keys[i] + 1]++;
+    }
+    for (uint32_t c = 0; c < cellCount; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+
+    // Then drop every particle into place (moving each cell's start along,
+    // which gets undone after)
+    next.resize(blocks.size());
+    cells.resize(count);
+    bounds = AABB{Vector(INFINITY, INFINITY), Vector(-INFINITY, -INFINITY)};
+    for (uint32_t i = 0; i < count; i++) {
+        const Block& from = blocks[i / blockSize];
+        uint32_t lane = i % blockSize;
+        uint32_t to = cellStart[keys[i]]++;
+        Block& b = next[to / blockSize];
+        b.px[to % blockSize] = from.px[lane];
+        b.py[to % blockSize] = from.py[lane];
+        b.vx[to % blockSize] = from.vx[lane];
+        b.vy[to % blockSize] = from.vy[lane];
+        cells[to] = keys[i];
+        bounds.min.x = std::min(bounds.min.x, from.px[lane]);
+        bounds.min.y = std::min(bounds.min.y, from.py[lane]);
+        bounds.max.x = std::max(bounds.max.x, from.px[lane]);
+        bounds.max.y = std::max(bounds.max.y, from.py[lane]);
+    }
+    for (uint32_t c = cellCount; c > 0; c--) {
+        cellStart[c] = cellStart[c - 1];
+    }
+    cellStart[0] = 0;
+    blocks.swap(next);
+
+    float r = settings.radius;
+    bounds = AABB{Vector(bounds.min.x - r, bounds.min.y - r),
+                  Vector(bounds.max.x + r, bounds.max.y + r)};
+}
+
+namespace {
+
+// Everything a particle's picked up from its neighbors so far, per lane (so
+// every SIMD level adds things up in the same order)
+struct alignas(32) Sums {
+    float cx[blockSize], cy[blockSize]; // Pushes
+    float ux[blockSize], uy[blockSize]; // Speeds pulling apart
+    uint32_t touching;
+};
+
+// The particle being pushed
+struct Pusher {
+    float px, py;
+    float vx, vy;
+    float diameter, diameterSquared;
+    float weight; // Its share of each push (0 to just count what it touches)
+    bool counting() const {
+        return weight == 0;
+    }
+};
+
+// Add up one lane's worth of sums in a fixed order
+static inline float total(const float* lanes) {
+    return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) +
+           ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+} // namespace
+
+// The pair kernels. Each one adds up how far the particle overlaps every
+// particle in [lo, hi) except itself (self), along the direction it'd be
+// pushed and scaled by the smaller weight of the two, a block at a time,
+// and how fast the ones it's touching are moving away from it. Both ends of
+// a pair use the same weight, so everything is equal and opposite.
+// Particles are all the same size, so there's nothing else to look up per
+// pair, and every level does exactly the same math per lane so they all come
+// out identical. Blocks with nothing touching get skipped, which is safe
+// since all they'd add is zero.
+//
+// Plain version, one lane at a time
+static void pairsScalar(const ParticleSystem::Block* blocks,
+                        const float* weights, uint32_t self, uint32_t lo,
+                        uint32_t hi, const Pusher& p, Sums& s) {
+    for (uint32_t k = lo / blockSize; k * blockSize < hi; k++) {
+        const ParticleSystem::Block& b = blocks[k];
+        for (uint32_t lane = 0; lane < blockSize; lane++) {
+            uint32_t j = k * blockSize + lane;
+            float dx = p.px - b.px[lane];
+            float dy = p.py - b.py[lane];
+            float d2 = dx * dx + dy * dy;
+            bool touch = j >= lo && j < hi && j != self &&
+                         d2 < p.diameterSquared;
+            if (!touch) {
+                continue;
+            }
+            s.touching++;
+            if (p.counting()) {
+                continue;
+            }
+
+            // Right on top of each other means pushing apart sideways, with
+            // which way going by index
+            bool apart = d2 > 0;
+            float d = sqrtf(d2);
+            float inverse = 1 / (apart ? d : 1.0f);
+            float nx = apart ? dx * inverse : (j > self ? -1.0f : 1.0f);
+            float ny = apart ? dy * inverse : 0.0f;
+            float w = std::min(p.weight, weights[j]);
+            float overlap = (p.diameter - d) * w;
+            float vn = (p.vx - b.vx[lane]) * nx + (p.vy - b.vy[lane]) * ny;
+            float leaving = (vn > 0 ? vn : 0.0f) * w;
+
+            s.cx[lane] += nx * overlap;
+            s.cy[lane] += ny * overlap;
+            s.ux[lane] += nx * leaving;
+            s.uy[lane] += ny * leaving;
+        }
+    }
+}
+
+#if PARTICLES_SSE
+static inline __m128 select4(__m128 a, __m128 b, __m128 mask) {
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+// Four lanes at a time (each block in two halves)
+static void pairsSSE(const ParticleSystem::Block* blocks,
+                     const float* weights, uint32_t self, uint32_t lo,
+                     uint32_t hi, const Pusher& p, Sums& s) {
+    Vector4 position(Vector(p.px, p.py)), velocity(Vector(p.vx, p.vy));
+    __m128 weight = _mm_set1_ps(p.weight);
+    __m128 diameter = _mm_set1_ps(p.diameter);
+    __m128 diameterSquared = _mm_set1_ps(p.diameterSquared);
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+    __m128 minusOne = _mm_set1_ps(-1);
+    __m128i me = _mm_set1_epi32((int32_t)self);
+    __m128i below = _mm_set1_epi32((int32_t)lo - 1);
+    __m128i end = _mm_set1_epi32((int32_t)hi);
+    Vector4 push[2], pull[2];
+    for (int h = 0; h < 2; h++) {
+        push[h] = Vector4::load(s.cx + 4 * h, s.cy + 4 * h);
+        pull[h] = Vector4::load(s.ux + 4 * h, s.uy + 4 * h);
+    }
+    uint32_t touching = 0;
+    for (uint32_t k = lo / blockSize; k * blockSize < hi; k++) {
+        const ParticleSystem::Block& b = blocks[k];
+        for (int h = 0; h < 2; h++) {
+            // Which lanes are in range and aren't the particle itself
+            __m128i j = _mm_add_epi32(
+                _mm_set1_epi32((int32_t)(k * blockSize) + 4 * h),
+                _mm_set_epi32(3, 2, 1, 0));
+            __m128i inRange = _mm_andnot_si128(
+                _mm_cmpeq_epi32(j, me),
+                _mm_and_si128(_mm_cmpgt_epi32(j, below),
+                              _mm_cmplt_epi32(j, end)));
+
+            Vector4 delta =
+                position - Vector4::load(b.px + 4 * h, b.py + 4 * h);
+            __m128 d2 = delta.length_squared();
+            __m128 touch = _mm_and_ps(_mm_castsi128_ps(inRange),
+                                      _mm_cmplt_ps(d2, diameterSquared));
+            int mask = _mm_movemask_ps(touch);
+            touching += __builtin_popcount(mask);
+            if (mask == 0 || p.counting()) {
+                continue;
+            }
+
+            __m128 apart = _mm_cmpgt_ps(d2, zero);
+            __m128 d = _mm_sqrt_ps(d2);
+            __m128 inverse = _mm_div_ps(one, select4(one, d, apart));
+            __m128 side = _mm_castsi128_ps(_mm_cmpgt_epi32(j, me));
+            Vector4 n(select4(select4(one, minusOne, side),
+                              _mm_mul_ps(delta.x, inverse), apart),
+                      _mm_and_ps(apart, _mm_mul_ps(delta.y, inverse)));
+            __m128 w = _mm_min_ps(
+                weight, _mm_load_ps(weights + k * blockSize + 4 * h));
+            __m128 overlap =
+                _mm_and_ps(touch, _mm_mul_ps(_mm_sub_ps(diameter, d), w));
+            __m128 vn =
+                (velocity - Vector4::load(b.vx + 4 * h, b.vy + 4 * h)).dot(n);
+            __m128 leaving =
+                _mm_and_ps(touch, _mm_mul_ps(_mm_max_ps(vn, zero), w));
+
+            push[h] += n * overlap;
+            pull[h] += n * leaving;
+        }
+    }
+    for (int h = 0; h < 2; h++) {
+        push[h].store(s.cx + 4 * h, s.cy + 4 * h);
+        pull[h].store(s.ux + 4 * h, s.uy + 4 * h);
+    }
+    s.touching += touching;
+}
+#endif
+
+#if PARTICLES_AVX2
+// Eight lanes at a time, a whole block per go
+PARTICLES_TARGET_AVX2 static void pairsAVX2(
+    const ParticleSystem::Block* blocks, const float* weights, uint32_t self,
+    uint32_t lo, uint32_t hi, const Pusher& p, Sums& s) {
+    __m256 px = _mm256_set1_ps(p.px), py = _mm256_set1_ps(p.py);
+    __m256 vx = _mm256_set1_ps(p.vx), vy = _mm256_set1_ps(p.vy);
+    __m256 weight = _mm256_set1_ps(p.weight);
+    __m256 diameter = _mm256_set1_ps(p.diameter);
+    __m256 diameterSquared = _mm256_set1_ps(p.diameterSquared);
+    __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+    __m256 minusOne = _mm256_set1_ps(-1);
+    __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i me = _mm256_set1_epi32((int32_t)self);
+    __m256i below = _mm256_set1_epi32((int32_t)lo - 1);
+    __m256i end = _mm256_set1_epi32((int32_t)hi);
+    __m256 cx = _mm256_load_ps(s.cx), cy = _mm256_load_ps(s.cy);
+    __m256 ux = _mm256_load_ps(s.ux), uy = _mm256_load_ps(s.uy);
+    uint32_t touching = 0;
+    for (uint32_t k = lo / blockSize; k * blockSize < hi; k++) {
+        const ParticleSystem::Block& b = blocks[k];
+        __m256i j = _mm256_add_epi32(
+            _mm256_set1_epi32((int32_t)(k * blockSize)), lanes);
+        __m256i inRange = _mm256_andnot_si256(
+            _mm256_cmpeq_epi32(j, me),
+            _mm256_and_si256(_mm256_cmpgt_epi32(j, below),
+                             _mm256_cmpgt_epi32(end, j)));
+
+        __m256 dx = _mm256_sub_ps(px, _mm256_load_ps(b.px));
+        __m256 dy = _mm256_sub_ps(py, _mm256_load_ps(b.py));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 touch =
+            _mm256_and_ps(_mm256_castsi256_ps(inRange),
+                          _mm256_cmp_ps(d2, diameterSquared, _CMP_LT_OQ));
+        int mask = _mm256_movemask_ps(touch);
+        touching += __builtin_popcount(mask);
+        if (mask == 0 || p.counting()) {
+            continue;
+        }
+
+        __m256 apart = _mm256_cmp_ps(d2, zero, _CMP_GT_OQ);
+        __m256 d = _mm256_sqrt_ps(d2);
+        __m256 inverse = _mm256_div_ps(one, _mm256_blendv_ps(one, d, apart));
+        __m256 side = _mm256_castsi256_ps(_mm256_cmpgt_epi32(j, me));
+        __m256 nx =
+            _mm256_blendv_ps(_mm256_blendv_ps(one, minusOne, side),
+                             _mm256_mul_ps(dx, inverse), apart);
+        __m256 ny = _mm256_and_ps(apart, _mm256_mul_ps(dy, inverse));
+        __m256 w =
+            _mm256_min_ps(weight, _mm256_load_ps(weights + k * blockSize));
+        __m256 overlap =
+            _mm256_and_ps(touch, _mm256_mul_ps(_mm256_sub_ps(diameter, d), w));
+        __m256 vn = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(vx, _mm256_load_ps(b.vx)), nx),
+            _mm256_mul_ps(_mm256_sub_ps(vy, _mm256_load_ps(b.vy)), ny));
+        __m256 leaving =
+            _mm256_and_ps(touch, _mm256_mul_ps(_mm256_max_ps(vn, zero), w));
+
+        cx = _mm256_add_ps(cx, _mm256_mul_ps(nx, overlap));
+        cy = _mm256_add_ps(cy, _mm256_mul_ps(ny, overlap));
+        ux = _mm256_add_ps(ux, _mm256_mul_ps(nx, leaving));
+        uy = _mm256_add_ps(uy, _mm256_mul_ps(ny, leaving));
+    }
+    _mm256_store_ps(s.cx, cx);
+    _mm256_store_ps(s.cy, cy);
+    _mm256_store_ps(s.ux, ux);
+    _mm256_store_ps(s.uy, uy);
+    s.touching += touching;
+}
+#endif
+
+using PairsFn = void (*)(const ParticleSystem::Block*, const float*,
+                         uint32_t, uint32_t, uint32_t, const Pusher&, Sums&);
+
+static PairsFn pairsFor(SimdLevel level) {
+#if PARTICLES_AVX2
+    if (level == SimdLevel::AVX2) {
+        return pairsAVX2;
+    }
+#endif
+#if PARTICLES_SSE
+    if (level != SimdLevel::Scalar) {
+        return pairsSSE;
+    }
+#endif
+    return pairsScalar;
+}
+
+void ParticleSystem::collide(float dt, const AABB& walls, JobSystem& jobs,
+                             SimdLevel level) {
+    PairsFn pairs = pairsFor(level);
+    uint32_t jobCount = (count + jobParticles - 1) / jobParticles;
+    counts.assign(jobCount, 0);
+    weights.resize(blocks.size());
+    const float* weighed = weights.data()->lanes;
+    float r = settings.radius;
+    float relaxation = settings.relaxation / 2; // Each side fixes half
+    float inverseDt = 1 / dt;
+    float damping = 1 - settings.restitution;
+
+    // Run the pair kernel over everything a particle can touch, which is in
+    // the three cells around it in each of the three rows around it (which
+    // the sort put next to each other)
+    auto neighbors = [&](uint32_t i, const Pusher& p, Sums& s) {
+        int x = (int)(cells[i] % columns);
+        int y = (int)(cells[i] / columns);
+        int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, columns - 1);
+        for (int row = std::max(y - 1, 0); row <= std::min(y + 1, rows - 1);
+             row++) {
+            uint32_t lo = cellStart[row * columns + x0];
+            uint32_t hi = cellStart[row * columns + x1 + 1];
+            if (lo < hi) {
+                pairs(blocks.data(), weighed, i, lo, hi, p, s);
+            }
+        }
+    };
+
+    // Everything pushes at once, so a particle squeezed from every side
+    // would get shoved way too far by the whole lot added up. So first count
+    // what everything's touching, and split each push by the busier of the
+    // two particles. That keeps piles from blowing up, and since both ends
+    // of a pair push by the same amount it doesn't make momentum out of
+    // nothing either.
+    jobs.parallelFor(jobCount, [&](uint32_t job) {
+        uint32_t end = std::min((job + 1) * jobParticles, count);
+        for (uint32_t i = job * jobParticles; i < end; i++) {
+            const Block& from = blocks[i / blockSize];
+            uint32_t lane = i % blockSize;
+            Pusher p = {from.px[lane], from.py[lane], 0, 0, 2 * r, 4 * r * r,
+                        0};
+            Sums s = {};
+            neighbors(i, p, s);
+            weights[i / blockSize].lanes[lane] =
+                relaxation / (float)std::max(s.touching, 1u);
+            counts[job] += s.touching;
+        }
+    });
+
+    // Then push. However far a particle gets moved is taken off its velocity
+    // too, so particles that run into each other stop instead of overlapping
+    // more and more.
+    jobs.parallelFor(jobCount, [&](uint32_t job) {
+        uint32_t end = std::min((job + 1) * jobParticles, count);
+        for (uint32_t i = job * jobParticles; i < end; i++) {
+            const Block& from = blocks[i / blockSize];
+            uint32_t lane = i % blockSize;
+            Pusher p = {from.px[lane], from.py[lane], from.vx[lane],
+                        from.vy[lane], 2 * r, 4 * r * r,
+                        weights[i / blockSize].lanes[lane]};
+            Sums s = {};
+            neighbors(i, p, s);
+
+            float px = std::clamp(p.px + total(s.cx), walls.min.x + r,
+                                  walls.max.x - r);
+            float py = std::clamp(p.py + total(s.cy), walls.min.y + r,
+                                  walls.max.y - r);
+            Block& to = next[i / blockSize];
+            to.px[lane] = px;
+            to.py[lane] = py;
+            to.vx[lane] = from.vx[lane] + (px - p.px) * inverseDt -
+                          total(s.ux) * damping;
+            to.vy[lane] = from.vy[lane] + (py - p.py) * inverseDt -
+                          total(s.uy) * damping;
+        }
+    });
+    blocks.swap(next);
+
+    // Every touching pair got counted from both ends
+    contactCount = 0;
+    for (uint32_t c : counts) {
+        contactCount += c;
+    }
+    contactCount /= 2;
+}
+
+template <typename Fn>
+void ParticleSystem::forEachIn(const AABB& box, Fn fn) {
+    if (cellStart.empty()) {
+        return;
+    }
+    float scale = 1 / cellSize;
+    int x0 = (int)floorf((box.min.x - gridBox.min.x) * scale);
+    int y0 = (int)floorf((box.min.y - gridBox.min.y) * scale);
+    int x1 = (int)floorf((box.max.x - gridBox.min.x) * scale);
+    int y1 = (int)floorf((box.max.y - gridBox.min.y) * scale);
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, columns - 1);
+    y1 = std::min(y1, rows - 1);
+    for (int y = y0; y <= y1 && x0 <= x1; y++) {
+        uint32_t lo = cellStart[y * columns + x0];
+        uint32_t hi = cellStart[y * columns + x1 + 1];
+        for (uint32_t i = lo; i < hi; i++) {
+            fn(i);
+        }
+    }
+}
+
+void ParticleSystem::pushOut(ShapeType type, Vector& center, Vector half,
+                             float inverseMass, Vector& velocity) {
+    // Particles weigh their radius squared, same as circles
+    float r = settings.radius;
+    float inverseParticle = 1 / (r * r);
+    float share = inverseParticle + inverseMass;
+
+    // Particles have moved since they were sorted (about a cell at most), so
+    // look a cell further out
+    float reach = r + cellSize;
+    AABB box{Vector(center.x - half.x - reach, center.y - half.y - reach),
+             Vector(center.x + half.x + reach, center.y + half.y + reach)};
+    forEachIn(box, [&](uint32_t i) {
+        Block& b = blocks[i / blockSize];
+        uint32_t lane = i % blockSize;
+        Vector normal;
+        float penetration;
+        if (!shapeCircleContact(type, center, half,
+                                Vector(b.px[lane], b.py[lane]), r, normal,
+                                penetration)) {
+            return;
+        }
+
+        // Split the overlap by mass
+        float amount = penetration / share;
+        b.px[lane] += normal.x * amount * inverseParticle;
+        b.py[lane] += normal.y * amount * inverseParticle;
+        center = center - normal * (amount * inverseMass);
+
+        // And stop them moving into each other (with a little bounce)
+        float vn = (b.vx[lane] - velocity.x) * normal.x +
+                   (b.vy[lane] - velocity.y) * normal.y;
+        if (vn < 0) {
+            float impulse = -(1 + settings.restitution) * vn / share;
+            b.vx[lane] += normal.x * impulse * inverseParticle;
+            b.vy[lane] += normal.y * impulse * inverseParticle;
+            velocity = velocity - normal * (impulse * inverseMass);
+        }
+    });
+}
+
+void ParticleSystem::couple(BodyStore& bodies, uint32_t i) {
+    Vector center(bodies.px[i], bodies.py[i]);
+    Vector velocity(bodies.vx[i], bodies.vy[i]);
+    bool awake = !bodies.asleep(i);
+    pushOut(bodies.type[i], center, Vector(bodies.hx[i], bodies.hy[i]),
+            awake ? bodies.inverseMass(i) : 0, velocity);
+    if (awake) {
+        bodies.px[i] = center.x;
+        bodies.py[i] = center.y;
+        bodies.vx[i] = velocity.x;
+        bodies.vy[i] = velocity.y;
+    }
+}
+
+void ParticleSystem::couple(const StaticBody& s) {
+    Vector center = s.center;
+    Vector velocity;
+    pushOut(s.type, center, s.half, 0, velocity);
+}
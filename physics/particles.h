@@ -0,0 +1,166 @@
+// Particles: huge numbers of circles that are all the same size, with none
+// of what makes bodies general. There are no shape types, handles, sleeping
+// or islands, just positions and velocities in blocks of eight (every
+// block's x's, then y's, and so on, so one block is a couple of cache lines
+// and one AVX register per field).
+//
+// Every substep the particles move and then get counting sorted by grid
+// cell, with cells the size of a particle, so everything a particle can
+// touch is in three runs of the arrays (the row above, its own row and the
+// row below). Then every particle adds up the pushes from everything touching it, eight at a time,
+// reading last pass's positions and writing into the other set of blocks,
+// so particles can be done in any order on any thread and still come out
+// the same. Pushes move particles, and however far they moved goes into
+// their velocity (position based, like cloth and fluid solvers do it), and
+// particles still touching that are pulling apart get slowed down so piles
+// don't bounce. Particles and bodies push each other apart in a coupling
+// pass after that, split by mass like the solver does.
+
+#pragma once
+
+#include "bodies.h"
+#include "collision.h"
+#include "integrate.h"
+#include "jobs.h"
+#include <cstdint>
+#include <vector>
+
+// Knobs for the particles
+struct ParticleSettings {
+    float radius = 2;
+    Vector acceleration = Vector(0, -200.0f);
+    int iterations = 2;       // Substeps, each one pass over the contacts
+    float relaxation = 1.0f;  // How hard overlaps get pushed apart (more
+                              // fixes them faster, but past 1 they bounce)
+    float restitution = 0.1f; // Bounce off the walls, bodies and each other
+    Color color = Color(0x40, 0x90, 0xff);
+};
+
+class ParticleSystem {
+  public:
+    static const uint32_t blockSize = 8;
+
+    // Eight particles
+    struct alignas(32) Block {
+        float px[blockSize];
+        float py[blockSize];
+        float vx[blockSize];
+        float vy[blockSize];
+    };
+
+    // Add a particle and get its index (which only lasts until the next step,
+    // since stepping sorts them)
+    uint32_t add(Vector p, Vector v = Vector());
+
+    // Fill a box with particles packed as tight as they go without touching,
+    // and say how many went in
+    uint32_t fill(const AABB& region, Vector v = Vector());
+
+    void clear() {
+        blocks.clear();
+        count = 0;
+    }
+
+    // Give every particle a push
+    void addVelocity(Vector dv);
+
+    uint32_t size() const {
+        return count;
+    }
+
+    Vector position(uint32_t i) const {
+        const Block& b = blocks[i / blockSize];
+        return Vector(b.px[i % blockSize], b.py[i % blockSize]);
+    }
+
+    Vector velocity(uint32_t i) const {
+        const Block& b = blocks[i / blockSize];
+        return Vector(b.vx[i % blockSize], b.vy[i % blockSize]);
+    }
+
+    // The particles, a block of eight at a time (lanes past size() in the
+    // last block aren't particles)
+    const std::vector<Block>& get_blocks() const {
+        return blocks;
+    }
+
+    ParticleSettings& get_settings() {
+        return settings;
+    }
+
+    const ParticleSettings& get_settings() const {
+        return settings;
+    }
+
+    // Particle pairs touching in the last step
+    uint32_t get_contact_count() const {
+        return contactCount;
+    }
+
+    // Box around every particle as of the last step
+    const AABB& get_bounds() const {
+        return bounds;
+    }
+
+    // Move every particle, sort them into the grid and push apart the ones
+    // that overlap. Comes out the same on any number of threads and at any
+    // SIMD level.
+    void step(float dt, const AABB& walls, JobSystem& jobs, SimdLevel level);
+
+    // Push particles and a body apart (and trade velocity along the way).
+    // Sleeping bodies don't get pushed back, and don't wake up.
+    void couple(BodyStore& bodies, uint32_t i);
+
+    // Push particles out of a static
+    void couple(const StaticBody& s);
+
+    // Hash of every particle's position and velocity
+    uint64_t hash() const;
+
+  private:
+    // Snapshots save and restore the particles as they are
+    friend class Snapshot;
+
+    // Gravity, moving and the walls
+    void integrate(float dt, const AABB& walls, JobSystem& jobs);
+
+    // Counting sort the particles by cell (into the other blocks, which then
+    // get swapped in)
+    void bin(const AABB& walls, JobSystem& jobs);
+
+    // One pass of pushing apart, from blocks into next (counting what
+    // everything touches first)
+    void collide(float dt, const AABB& walls, JobSystem& jobs,
+                 SimdLevel level);
+
+    // Run fn(index) on every particle whose cell overlaps a box
+    template <typename Fn>
+    void forEachIn(const AABB& box, Fn fn);
+
+    // Push particles out of a shape with the given inverse mass (0 for one
+    // that can't move), moving the shape back as it goes
+    void pushOut(ShapeType type, Vector& center, Vector half,
+                 float inverseMass, Vector& velocity);
+
+    // A float per particle, lined up with the blocks
+    struct alignas(32) Lanes {
+        float lanes[blockSize];
+    };
+
+    std::vector<Block> blocks;
+    std::vector<Block> next;
+    uint32_t count = 0;
+    ParticleSettings settings;
+
+    // The grid, rebuilt every step
+    std::vector<uint32_t> keys;      // Each particle's cell, before sorting
+    std::vector<uint32_t> cells;     // Each particle's cell, in sorted order
+    std::vector<uint32_t> cellStart; // First particle in each cell (+ end)
+    std::vector<uint32_t> counts;    // Per job contact counts
+    std::vector<Lanes> weights;      // Each particle's share of its pushes
+    AABB gridBox = AABB{Vector(), Vector()};
+    float cellSize = 1;
+    int columns = 0, rows = 0;
+    AABB bounds = AABB{Vector(), Vector()};
+    uint32_t contactCount = 0;
+};
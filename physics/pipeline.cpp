@@ -0,0 +1,62 @@
+// Simulation thread and handing frames over
+
+#include "pipeline.h"
+
+FramePipeline::FramePipeline(const World& world,
+                             std::function<void(float)> simulate)
+    : world(world), simulate(std::move(simulate)) {
+    thread = std::thread([this] { run(); });
+}
+
+FramePipeline::~FramePipeline() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return !busy; });
+        quit = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void FramePipeline::begin(float dt) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return !busy; });
+        elapsed = dt;
+        busy = true;
+    }
+    wake.notify_all();
+}
+
+void FramePipeline::finish() {
+    std::unique_lock<std::mutex> guard(lock);
+    wake.wait(guard, [this] { return !busy; });
+    if (filled) {
+        front = 1 - front;
+        filled = false;
+    }
+}
+
+void FramePipeline::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return busy || quit; });
+        if (quit) {
+            return;
+        }
+
+        // Nothing else touches the world or the back state while busy, so
+        // step without holding the lock
+        guard.unlock();
+        simulate(elapsed);
+        RenderState& back = states[1 - front];
+        back.capture(world.get_bodies(), world.get_statics(),
+                     &world.get_particles());
+        back.step = world.get_step_count();
+        guard.lock();
+
+        busy = false;
+        filled = true;
+        wake.notify_all();
+    }
+}
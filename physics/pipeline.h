@@ -0,0 +1,62 @@
+// Pipelined frames: the world steps on its own thread while the last frame's
+// bodies get drawn. Every step of a frame finishes, and then a copy of the
+// bodies gets taken, before anything gets drawn from it. So a frame is
+// always one whole state of the world (never half stepped), and a frame
+// takes as long as the slower of stepping and drawing instead of both added
+// up.
+//
+// Each frame goes:
+//   finish()   wait for the step to be done and swap in its copy
+//   ...        handle input and read stats (nothing's touching the world)
+//   begin(dt)  start stepping the next frame
+//   ...        draw get_state() while that runs
+
+#pragma once
+
+#include "render.h"
+#include "world.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class FramePipeline {
+  public:
+    // Constructor (simulate does one frame's worth of stepping, given the
+    // time since the last frame)
+    FramePipeline(const World& world, std::function<void(float)> simulate);
+
+    // Destructor (waits for the frame in progress)
+    ~FramePipeline();
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    // Start stepping the next frame on the simulation thread. The world
+    // belongs to that thread until finish().
+    void begin(float elapsed);
+
+    // Wait for the frame in progress and make its copy the one to draw
+    void finish();
+
+    // The last finished frame (stays the same until the next finish())
+    const RenderState& get_state() const {
+        return states[front];
+    }
+
+  private:
+    // Simulation thread loop
+    void run();
+
+    const World& world;
+    std::function<void(float)> simulate;
+    RenderState states[2]; // Drawn from and being filled in
+    int front = 0;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    float elapsed = 0;
+    bool busy = false;  // A frame is being stepped
+    bool filled = false; // The back state has a frame that's not swapped in
+    bool quit = false;
+};
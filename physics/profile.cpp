@@ -0,0 +1,108 @@
+// Profiler bookkeeping and trace export
+
+#include "profile.h"
+#include <fstream>
+
+Profiler& Profiler::get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+double& Profiler::total(std::vector<Stat>& stats, const char* name) {
+    for (auto& stat : stats) {
+        if (stat.name == name) {
+            return stat.value;
+        }
+    }
+    stats.push_back({name, 0});
+    return stats.back().value;
+}
+
+uint32_t Profiler::threadId() {
+    std::thread::id id = std::this_thread::get_id();
+    for (uint32_t i = 0; i < threads.size(); i++) {
+        if (threads[i] == id) {
+            return i;
+        }
+    }
+    threads.push_back(id);
+    return (uint32_t)threads.size() - 1;
+}
+
+void Profiler::record(const char* name, uint64_t start, uint64_t end) {
+    std::lock_guard<std::mutex> guard(lock);
+    total(scopes, name) += (end - start) / 1e6;
+    if (recording) {
+        events.push_back({name, start, end - start, threadId(), 0});
+    }
+}
+
+void Profiler::count(const char* name, int64_t amount) {
+    std::lock_guard<std::mutex> guard(lock);
+    total(counters, name) += amount;
+}
+
+void Profiler::gauge(const char* name, int64_t value) {
+    std::lock_guard<std::mutex> guard(lock);
+    total(counters, name) = value;
+}
+
+void Profiler::endFrame() {
+    uint64_t time = now();
+    std::lock_guard<std::mutex> guard(lock);
+    if (recording) {
+        for (auto& counter : counters) {
+            events.push_back(
+                {counter.name, time, UINT64_MAX, 0, (int64_t)counter.value});
+        }
+    }
+    // Swap instead of copying so the vectors keep their room
+    std::swap(scopes, lastScopes);
+    std::swap(counters, lastCounters);
+    scopes.clear();
+    counters.clear();
+}
+
+std::vector<Profiler::Stat> Profiler::get_scopes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return lastScopes;
+}
+
+std::vector<Profiler::Stat> Profiler::get_counters() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return lastCounters;
+}
+
+void Profiler::set_recording(bool on) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (on && !recording) {
+        events.clear();
+    }
+    recording = on;
+}
+
+bool Profiler::writeTrace(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Complete events ("X") for scopes and counter events ("C") for
+    // counters, with times in microseconds
+    out << "{\"traceEvents\": [\n";
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event& e = events[i];
+        out << "  {\"name\": \"" << e.name << "\", \"pid\": 1, \"tid\": "
+            << e.thread << ", \"ts\": " << e.start / 1000.0;
+        if (e.duration == UINT64_MAX) {
+            out << ", \"ph\": \"C\", \"args\": {\"value\": " << e.value
+                << "}}";
+        } else {
+            out << ", \"ph\": \"X\", \"dur\": " << e.duration / 1000.0 << "}";
+        }
+        out << (i + 1 < events.size() ? ",\n" : "\n");
+    }
+    out << "], \"displayTimeUnit\": \"ms\"}\n";
+    return (bool)out;
+}
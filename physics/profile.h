@@ -0,0 +1,130 @@
+// Profiling: scoped timers and counters around each phase of a step (and of
+// a frame, in the GUI). Each frame's totals are kept for an on screen
+// overlay, and everything can be recorded to a Chrome trace (open it in
+// chrome://tracing or ui.perfetto.dev).
+//
+// It's meant for whole phases, not per body work: every scope takes a lock.
+// Build with -DPHYSICS_PROFILE=0 and the macros compile away to nothing.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef PHYSICS_PROFILE
+#define PHYSICS_PROFILE 1
+#endif
+
+class Profiler {
+  public:
+    // One scope's total time or one counter's value over a frame
+    struct Stat {
+        const char* name;
+        double value; // Milliseconds for scopes
+    };
+
+    // The one profiler everything reports to
+    static Profiler& get();
+
+    // Nanoseconds since the profiler started
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - epoch)
+            .count();
+    }
+
+    // Add a finished scope (names have to be string literals, since they're
+    // kept by pointer)
+    void record(const char* name, uint64_t start, uint64_t end);
+
+    // Add to a counter for this frame
+    void count(const char* name, int64_t amount);
+
+    // Set a counter for this frame (for things like how many bodies are
+    // awake, which shouldn't add up over several steps)
+    void gauge(const char* name, int64_t value);
+
+    // Close out the frame: everything so far becomes the last frame's stats
+    void endFrame();
+
+    // Last frame's scopes and counters
+    std::vector<Stat> get_scopes() const;
+    std::vector<Stat> get_counters() const;
+
+    // Keep every scope and counter from now on for a trace (this grows
+    // without bound, so only leave it on for a while)
+    void set_recording(bool on);
+
+    bool get_recording() const {
+        return recording;
+    }
+
+    // Write out everything recorded as Chrome trace JSON
+    bool writeTrace(const std::string& path) const;
+
+  private:
+    Profiler() : epoch(std::chrono::steady_clock::now()) {
+    }
+
+    // Running total for a name, added to the list the first time it shows up
+    static double& total(std::vector<Stat>& stats, const char* name);
+
+    struct Event {
+        const char* name;
+        uint64_t start;
+        uint64_t duration;
+        uint32_t thread;
+        int64_t value; // Counters only (their duration is UINT64_MAX)
+    };
+
+    // Small id for the calling thread, for the trace
+    uint32_t threadId();
+
+    std::chrono::steady_clock::time_point epoch;
+    mutable std::mutex lock;
+    std::vector<Stat> scopes, counters;         // This frame so far
+    std::vector<Stat> lastScopes, lastCounters; // The last whole frame
+    std::vector<Event> events;
+    std::vector<std::thread::id> threads;
+    bool recording = false;
+};
+
+// Times everything from here to the end of the scope
+class ScopedTimer {
+  public:
+    ScopedTimer(const char* name)
+        : name(name), start(Profiler::get().now()) {
+    }
+
+    ~ScopedTimer() {
+        Profiler& profiler = Profiler::get();
+        profiler.record(name, start, profiler.now());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  private:
+    const char* name;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if PHYSICS_PROFILE
+#define PROFILE_SCOPE(name)                                                    \
+    ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(name, amount) Profiler::get().count(name, amount)
+#define PROFILE_GAUGE(name, value) Profiler::get().gauge(name, value)
+#define PROFILE_FRAME() Profiler::get().endFrame()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name, amount)
+#define PROFILE_GAUGE(name, value)
+#define PROFILE_FRAME()
+#endif
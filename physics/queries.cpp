@@ -0,0 +1,298 @@
+// World queries: raycasts, points, boxes and nearest, through the AABB trees
+// and then checked against the actual shapes
+
+#include "world.h"
+#include <math.h>
+
+// Whether a point is inside a shape
+static bool shapeContains(ShapeType type, Vector c, Vector h, Vector p) {
+    float dx = p.x - c.x;
+    float dy = p.y - c.y;
+    if (type == ShapeType::Circle) {
+        return dx * dx + dy * dy <= h.x * h.x;
+    }
+    return fabs(dx) <= h.x && fabs(dy) <= h.y;
+}
+
+// Closest point on a shape to p (p itself if it's inside)
+static Vector shapeClosest(ShapeType type, Vector c, Vector h, Vector p) {
+    float dx = p.x - c.x;
+    float dy = p.y - c.y;
+    if (type == ShapeType::Circle) {
+        float distance = sqrtf(dx * dx + dy * dy);
+        if (distance <= h.x) {
+            return p;
+        }
+        return Vector(c.x + dx / distance * h.x, c.y + dy / distance * h.x);
+    }
+    return Vector(c.x + std::clamp(dx, -h.x, h.x),
+                  c.y + std::clamp(dy, -h.y, h.y));
+}
+
+// Whether a shape overlaps a box
+static bool shapeOverlaps(ShapeType type, Vector c, Vector h,
+                          const AABB& box) {
+    AABB bounds{Vector(c.x - h.x, c.y - h.y), Vector(c.x + h.x, c.y + h.y)};
+    if (!bounds.overlaps(box)) {
+        return false;
+    }
+    if (type == ShapeType::Circle) {
+        float dx = std::clamp(c.x, box.min.x, box.max.x) - c.x;
+        float dy = std::clamp(c.y, box.min.y, box.max.y) - c.y;
+        return dx * dx + dy * dy <= h.x * h.x;
+    }
+    return true;
+}
+
+// Where along from + d * t a ray first hits a shape (if it does before
+// limit), and the normal there. Rays starting inside hit right away.
+static bool shapeRaycast(ShapeType type, Vector c, Vector h, Vector from,
+                         Vector d, float limit, float& t, Vector& normal) {
+    if (shapeContains(type, c, h, from)) {
+        t = 0;
+        normal = (-d).normal();
+        return true;
+    }
+    if (type == ShapeType::Circle) {
+        // Solve |from + d * t - c| = r for the first t
+        Vector m(from.x - c.x, from.y - c.y);
+        float a = d.dot(d);
+        float b = m.dot(d);
+        float k = m.dot(m) - h.x * h.x;
+        float discriminant = b * b - a * k;
+        if (a == 0 || b > 0 || discriminant < 0) {
+            return false;
+        }
+        t = (-b - sqrtf(discriminant)) / a;
+        if (t > limit) {
+            return false;
+        }
+        normal = Vector((m.x + d.x * t) / h.x, (m.y + d.y * t) / h.y);
+        return true;
+    }
+    AABB box{Vector(c.x - h.x, c.y - h.y), Vector(c.x + h.x, c.y + h.y)};
+    t = AABBTree::rayBox(from, d, box);
+    if (t > limit) {
+        return false;
+    }
+    // The side it came in through is the one it's on now
+    float px = from.x + d.x * t - c.x;
+    float py = from.y + d.y * t - c.y;
+    if (fabs(fabs(px) - h.x) < fabs(fabs(py) - h.y)) {
+        normal = Vector(px < 0 ? -1 : 1, 0);
+    } else {
+        normal = Vector(0, py < 0 ? -1 : 1);
+    }
+    return true;
+}
+
+void World::syncBodyTree() const {
+    if (syncedStep == stepCount && syncedChanges == bodies.get_change_count()) {
+        return;
+    }
+    syncedStep = stepCount;
+    syncedChanges = bodies.get_change_count();
+    syncCount++;
+
+    // Move (or add) every body's leaf. Resting and sleeping bodies are still
+    // inside their fat boxes, so this only touches the tree for ones that
+    // moved.
+    uint32_t slotCount = bodies.get_slot_count();
+    bodyProxies.resize(slotCount, AABBTree::null);
+    bodySeen.resize(slotCount, 0);
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+        uint32_t slot = bodies.handleAt(i).index;
+        bodySeen[slot] = syncCount;
+        if (bodyProxies[slot] == AABBTree::null) {
+            bodyProxies[slot] = bodyTree.insert(bodies.bounds(i), slot);
+        } else {
+            bodyTree.move(bodyProxies[slot], bodies.bounds(i));
+        }
+    }
+
+    // Then drop the ones for removed bodies
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        if (bodyProxies[slot] != AABBTree::null &&
+            bodySeen[slot] != syncCount) {
+            bodyTree.remove(bodyProxies[slot]);
+            bodyProxies[slot] = AABBTree::null;
+        }
+    }
+}
+
+bool World::raycast(Vector from, Vector to, QueryHit& hit,
+                    QueryFilter filter) const {
+    Vector d(to.x - from.x, to.y - from.y);
+    float best = INFINITY;
+    Vector normal;
+    auto check = [&](ShapeType type, Vector c, Vector h, float limit) {
+        float t;
+        if (!shapeRaycast(type, c, h, from, d, std::min(limit, best), t,
+                          normal) ||
+            t >= best) {
+            return false;
+        }
+        best = t;
+        hit.normal = normal;
+        return true;
+    };
+
+    if (filter != QueryFilter::Bodies) {
+        staticTree.raycast(from, to, [&](uint32_t proxy, float limit) {
+            uint32_t id = staticTree.get_data(proxy);
+            const StaticBody& s = statics[id];
+            if (check(s.type, s.center, s.half, limit)) {
+                hit.body = BodyHandle();
+                hit.staticId = id;
+            }
+            return best;
+        });
+    }
+    if (filter != QueryFilter::Statics) {
+        syncBodyTree();
+        bodyTree.raycast(from, to, [&](uint32_t proxy, float limit) {
+            uint32_t i = bodies.indexOf(BodyHandle{bodyTree.get_data(proxy)});
+            if (check(bodies.type[i], Vector(bodies.px[i], bodies.py[i]),
+                      Vector(bodies.hx[i], bodies.hy[i]), limit)) {
+                hit.body = bodies.handleAt(i);
+                hit.staticId = UINT32_MAX;
+            }
+            return best;
+        });
+    }
+    if (best > 1) {
+        return false;
+    }
+    hit.point = Vector(from.x + d.x * best, from.y + d.y * best);
+    hit.distance = best * d.length();
+    return true;
+}
+
+bool World::pointQuery(Vector p, QueryHit& hit, QueryFilter filter) const {
+    AABB box{p, p};
+    bool found = false;
+    if (filter != QueryFilter::Statics) {
+        // Bodies later in the arrays get drawn over earlier ones, so the one
+        // on top is the highest index
+        syncBodyTree();
+        uint32_t top = 0;
+        bodyTree.query(box, [&](uint32_t proxy) {
+            uint32_t i = bodies.indexOf(BodyHandle{bodyTree.get_data(proxy)});
+            if ((!found || i > top) &&
+                shapeContains(bodies.type[i],
+                              Vector(bodies.px[i], bodies.py[i]),
+                              Vector(bodies.hx[i], bodies.hy[i]), p)) {
+                top = i;
+                found = true;
+            }
+            return true;
+        });
+        if (found) {
+            hit = QueryHit();
+            hit.body = bodies.handleAt(top);
+        }
+    }
+    if (!found && filter != QueryFilter::Bodies) {
+        staticTree.query(box, [&](uint32_t proxy) {
+            uint32_t id = staticTree.get_data(proxy);
+            const StaticBody& s = statics[id];
+            if (shapeContains(s.type, s.center, s.half, p)) {
+                hit = QueryHit();
+                hit.staticId = id;
+                found = true;
+                return false;
+            }
+            return true;
+        });
+    }
+    if (found) {
+        hit.point = p;
+    }
+    return found;
+}
+
+uint32_t World::aabbQuery(const AABB& box, std::vector<QueryHit>& hits,
+                          QueryFilter filter) const {
+    size_t before = hits.size();
+    if (filter != QueryFilter::Bodies) {
+        staticTree.query(box, [&](uint32_t proxy) {
+            uint32_t id = staticTree.get_data(proxy);
+            const StaticBody& s = statics[id];
+            if (shapeOverlaps(s.type, s.center, s.half, box)) {
+                QueryHit hit;
+                hit.staticId = id;
+                hit.point = s.center;
+                hits.push_back(hit);
+            }
+            return true;
+        });
+    }
+    if (filter != QueryFilter::Statics) {
+        syncBodyTree();
+        bodyTree.query(box, [&](uint32_t proxy) {
+            uint32_t i = bodies.indexOf(BodyHandle{bodyTree.get_data(proxy)});
+            Vector c(bodies.px[i], bodies.py[i]);
+            if (shapeOverlaps(bodies.type[i], c,
+                              Vector(bodies.hx[i], bodies.hy[i]), box)) {
+                QueryHit hit;
+                hit.body = bodies.handleAt(i);
+                hit.point = c;
+                hits.push_back(hit);
+            }
+            return true;
+        });
+    }
+    return (uint32_t)(hits.size() - before);
+}
+
+bool World::nearest(Vector p, float maxDistance, QueryHit& hit,
+                    QueryFilter filter) const {
+    float best = maxDistance;
+    auto distance = [&](ShapeType type, Vector c, Vector h) {
+        Vector closest = shapeClosest(type, c, h, p);
+        return Vector(closest.x - p.x, closest.y - p.y).length();
+    };
+
+    bool found = false;
+    if (filter != QueryFilter::Bodies) {
+        uint32_t proxy = staticTree.nearest(p, best, [&](uint32_t proxy) {
+            const StaticBody& s = statics[staticTree.get_data(proxy)];
+            return distance(s.type, s.center, s.half);
+        });
+        if (proxy != AABBTree::null) {
+            const StaticBody& s = statics[staticTree.get_data(proxy)];
+            hit = QueryHit();
+            hit.staticId = staticTree.get_data(proxy);
+            hit.point = shapeClosest(s.type, s.center, s.half, p);
+            best = distance(s.type, s.center, s.half);
+            found = true;
+        }
+    }
+    if (filter != QueryFilter::Statics) {
+        syncBodyTree();
+        auto shapeAt = [&](uint32_t proxy, Vector& c, Vector& h) {
+            uint32_t i = bodies.indexOf(BodyHandle{bodyTree.get_data(proxy)});
+            c = Vector(bodies.px[i], bodies.py[i]);
+            h = Vector(bodies.hx[i], bodies.hy[i]);
+            return i;
+        };
+        uint32_t proxy = bodyTree.nearest(p, best, [&](uint32_t proxy) {
+            Vector c, h;
+            uint32_t i = shapeAt(proxy, c, h);
+            return distance(bodies.type[i], c, h);
+        });
+        if (proxy != AABBTree::null) {
+            Vector c, h;
+            uint32_t i = shapeAt(proxy, c, h);
+            hit = QueryHit();
+            hit.body = bodies.handleAt(i);
+            hit.point = shapeClosest(bodies.type[i], c, h, p);
+            best = distance(bodies.type[i], c, h);
+            found = true;
+        }
+    }
+    if (found) {
+        hit.distance = best;
+    }
+    return found;
+}
@@ -0,0 +1,60 @@
+// Small seeded random number generator (PCG32). Unlike rand(), each world
+// gets its own, and it gives the same numbers for the same seed on every
+// platform, so spawning is part of what a seed reproduces.
+
+#pragma once
+
+#include <cstdint>
+
+class Random {
+  public:
+    // Constructor
+    Random(uint64_t seed = 1) {
+        set_seed(seed);
+    }
+
+    // Start the sequence over from a seed
+    void set_seed(uint64_t s) {
+        seed = s;
+        state = 0;
+        next();
+        state += s;
+        next();
+    }
+
+    uint64_t get_seed() const {
+        return seed;
+    }
+
+    // Next 32 random bits
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+        uint32_t rotation = (uint32_t)(old >> 59);
+        return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+    }
+
+    // Where in the sequence it is (for saving and restoring)
+    uint64_t get_state() const {
+        return state;
+    }
+
+    void set_state(uint64_t s) {
+        state = s;
+    }
+
+    // Random integer from 0 to n - 1
+    int below(int n) {
+        return (int)(next() % (uint32_t)n);
+    }
+
+    // Random float from 0 up to (not including) 1
+    float uniform() {
+        return (next() >> 8) * (1.0f / 16777216);
+    }
+
+  private:
+    uint64_t seed;
+    uint64_t state;
+};
@@ -0,0 +1,196 @@
+// Culling, span filling and dirty tiles
+
+#include "render.h"
+#include "particles.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define RENDER_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Fill pixels [x0, x1] of a row with one color, four at a time with SSE
+static inline void fillSpan(Color* row, int x0, int x1, Color c) {
+    uint32_t value;
+    memcpy(&value, &c, sizeof(value));
+    uint32_t* p = (uint32_t*)row + x0;
+    int count = x1 - x0 + 1;
+    int i = 0;
+#if RENDER_SSE
+    __m128i wide = _mm_set1_epi32((int)value);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(p + i), wide);
+    }
+#endif
+    for (; i < count; i++) {
+        p[i] = value;
+    }
+}
+
+void RenderState::capture(const BodyStore& bodies,
+                          const std::vector<StaticBody>& statics,
+                          const ParticleSystem* particles) {
+    px.clear();
+    py.clear();
+    hx.clear();
+    hy.clear();
+    type.clear();
+    color.clear();
+    for (const StaticBody& s : statics) {
+        if (s.type != ShapeType::Count) {
+            px.push_back(s.center.x);
+            py.push_back(s.center.y);
+            hx.push_back(s.half.x);
+            hy.push_back(s.half.y);
+            type.push_back(s.type);
+            color.push_back(s.color);
+        }
+    }
+    uint32_t n = bodies.size();
+    px.insert(px.end(), bodies.px.begin(), bodies.px.begin() + n);
+    py.insert(py.end(), bodies.py.begin(), bodies.py.begin() + n);
+    hx.insert(hx.end(), bodies.hx.begin(), bodies.hx.begin() + n);
+    hy.insert(hy.end(), bodies.hy.begin(), bodies.hy.begin() + n);
+    type.insert(type.end(), bodies.type.begin(), bodies.type.begin() + n);
+    color.insert(color.end(), bodies.color.begin(), bodies.color.begin() + n);
+    if (!particles) {
+        return;
+    }
+
+    // Particles are just circles that are all alike
+    float r = particles->get_settings().radius;
+    for (uint32_t i = 0; i < particles->size(); i++) {
+        Vector p = particles->position(i);
+        px.push_back(p.x);
+        py.push_back(p.y);
+    }
+    size_t total = px.size();
+    hx.resize(total, r);
+    hy.resize(total, r);
+    type.resize(total, ShapeType::Circle);
+    color.resize(total, particles->get_settings().color);
+}
+
+void Renderer::render(const BodyStore& bodies, Color* pixels, int w, int h) {
+    draw(bodies, pixels, w, h);
+}
+
+void Renderer::render(const RenderState& state, Color* pixels, int w, int h) {
+    draw(state, pixels, w, h);
+}
+
+template <typename Bodies>
+void Renderer::draw(const Bodies& bodies, Color* pixels, int w, int h) {
+    // A new size means nothing that's there can be trusted
+    if (w != width || h != height) {
+        width = w;
+        height = h;
+        tilesX = (w + tileSize - 1) / tileSize;
+        tilesY = (h + tileSize - 1) / tileSize;
+        dirty.assign(tilesX * tilesY, 1);
+    }
+    clearDirty(pixels);
+
+    drawn = 0;
+    culled = 0;
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+        float cx = bodies.px[i];
+        float cy = bodies.py[i];
+        float hx = bodies.hx[i];
+        float hy = bodies.hy[i];
+
+        // Pixels whose centers are inside the bounding box (clamped as
+        // floats first, so bodies way off screen can't overflow an int)
+        int x0 = (int)std::max(ceilf(cx - hx - 0.5f), 0.0f);
+        int x1 = (int)std::min(ceilf(cx + hx - 0.5f) - 1, w - 1.0f);
+        int y0 = (int)std::max(ceilf(cy - hy - 0.5f), 0.0f);
+        int y1 = (int)std::min(ceilf(cy + hy - 0.5f) - 1, h - 1.0f);
+        if (x0 > x1 || y0 > y1) {
+            culled++;
+            continue;
+        }
+        drawn++;
+        markTiles(x0, y0, x1, y1);
+
+        Color c = bodies.color[i];
+        if (bodies.type[i] == ShapeType::Rectangle) {
+            for (int y = y0; y <= y1; y++) {
+                fillSpan(pixels + (size_t)y * w, x0, x1, c);
+            }
+            continue;
+        }
+
+        // Circles get one span per row, as wide as the circle is there
+        float r2 = hx * hx;
+        for (int y = y0; y <= y1; y++) {
+            float dy = y + 0.5f - cy;
+            float half = sqrtf(std::max(r2 - dy * dy, 0.0f));
+            int left = std::max((int)ceilf(cx - half - 0.5f), x0);
+            int right = std::min((int)ceilf(cx + half - 0.5f) - 1, x1);
+            if (left <= right) {
+                fillSpan(pixels + (size_t)y * w, left, right, c);
+            }
+        }
+    }
+}
+
+void Renderer::markDirty(int x, int y, int w, int h) {
+    markTiles(std::max(x, 0), std::max(y, 0), std::min(x + w, width) - 1,
+              std::min(y + h, height) - 1);
+}
+
+void Renderer::markTiles(int x0, int y0, int x1, int y1) {
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    for (int ty = y0 / tileSize; ty <= y1 / tileSize; ty++) {
+        uint8_t* row = &dirty[ty * tilesX];
+        std::fill(row + x0 / tileSize, row + x1 / tileSize + 1, 1);
+    }
+}
+
+void Renderer::clearDirty(Color* pixels) {
+    for (int ty = 0; ty < tilesY; ty++) {
+        uint8_t* row = &dirty[ty * tilesX];
+        int y0 = ty * tileSize;
+        int y1 = std::min(y0 + tileSize, height) - 1;
+        // Clear runs of dirty tiles as one span per pixel row
+        for (int tx = 0; tx < tilesX;) {
+            if (!row[tx]) {
+                tx++;
+                continue;
+            }
+            int start = tx;
+            while (tx < tilesX && row[tx]) {
+                row[tx++] = 0;
+            }
+            int x0 = start * tileSize;
+            int x1 = std::min(tx * tileSize, width) - 1;
+            for (int y = y0; y <= y1; y++) {
+                fillSpan(pixels + (size_t)y * width, x0, x1, background);
+            }
+        }
+    }
+}
+
+bool Image::savePPM(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    out << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> row(width * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const Color& c = pixels[(size_t)y * width + x];
+            row[3 * x] = c.r;
+            row[3 * x + 1] = c.g;
+            row[3 * x + 2] = c.b;
+        }
+        out.write((const char*)row.data(), row.size());
+    }
+    return (bool)out;
+}
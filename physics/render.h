@@ -0,0 +1,115 @@
+// Software renderer: draws every body straight into a pixel buffer in one
+// pass over the body arrays, instead of one graphics call per shape. Bodies
+// off the edge of the buffer get skipped, shapes are filled a row (span) at
+// a time, and only the parts of the buffer that were drawn on last frame get
+// cleared. It doesn't know about tigr (a TPixel is laid out just like a
+// Color), so it draws just as well into an off-screen Image with no window.
+
+#pragma once
+
+#include "bodies.h"
+#include "collision.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ParticleSystem;
+
+// Off-screen pixels to render into (rows top to bottom)
+struct Image {
+    Image(int w = 0, int h = 0, Color fill = Color(0, 0, 0))
+        : width(w), height(h), pixels((size_t)w * h, fill) {
+    }
+
+    // Save as a binary PPM (about the simplest image format there is)
+    bool savePPM(const std::string& path) const;
+
+    int width;
+    int height;
+    std::vector<Color> pixels;
+};
+
+// Copy of just what drawing needs from the bodies, so a frame can be drawn
+// while the world it came from carries on stepping
+struct RenderState {
+    // Copy the bodies' drawable fields (and the statics', which go first so
+    // they're drawn underneath, and the particles', which go last)
+    void capture(const BodyStore& bodies,
+                 const std::vector<StaticBody>& statics = {},
+                 const ParticleSystem* particles = nullptr);
+
+    uint32_t size() const {
+        return (uint32_t)px.size();
+    }
+
+    uint64_t step = 0; // World step it was captured after
+    std::vector<float> px, py;
+    std::vector<float> hx, hy;
+    std::vector<ShapeType> type;
+    std::vector<Color> color;
+};
+
+class Renderer {
+  public:
+    // Clear what the last frame drew and draw every body that's on screen
+    // into a width x height buffer. Anything else that's drawn into the same
+    // buffer needs markDirty, or it won't get cleared.
+    void render(const BodyStore& bodies, Color* pixels, int width,
+                int height);
+
+    void render(const BodyStore& bodies, Image& image) {
+        render(bodies, image.pixels.data(), image.width, image.height);
+    }
+
+    // Same thing, from a captured copy
+    void render(const RenderState& state, Color* pixels, int width,
+                int height);
+
+    // Something else was drawn over this region (text, say), so clear it
+    // next frame
+    void markDirty(int x, int y, int w, int h);
+
+    // Clear the whole buffer next frame
+    void invalidate() {
+        std::fill(dirty.begin(), dirty.end(), 1);
+    }
+
+    Color get_background() const {
+        return background;
+    }
+
+    void set_background(Color c) {
+        background = c;
+        invalidate();
+    }
+
+    // Bodies drawn and skipped for being off screen last frame
+    uint32_t get_drawn() const {
+        return drawn;
+    }
+
+    uint32_t get_culled() const {
+        return culled;
+    }
+
+  private:
+    // Shared by both kinds of input (anything with the same arrays)
+    template <typename Bodies>
+    void draw(const Bodies& bodies, Color* pixels, int width, int height);
+
+    // Mark the tiles under a pixel rectangle (inclusive) to be cleared
+    void markTiles(int x0, int y0, int x1, int y1);
+
+    // Clear every dirty tile back to the background
+    void clearDirty(Color* pixels);
+
+    static const int tileSize = 32;
+
+    Color background = Color(0, 0, 0);
+    int width = 0, height = 0;
+    int tilesX = 0, tilesY = 0;
+    std::vector<uint8_t> dirty; // One per tile
+    uint32_t drawn = 0;
+    uint32_t culled = 0;
+};
@@ -0,0 +1,296 @@
+// Writing, mapping and restoring snapshots
+
+#include "snapshot.h"
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char magic[8] = {'P', 'H', 'Y', 'S', 'S', 'N', 'A', 'P'};
+static const uint64_t arrayAlign = 64;
+
+// The file is little-endian, so it's only written or read as-is on
+// little-endian machines (which is all of them that this runs on, but it
+// shouldn't quietly load garbage if that changes)
+static bool littleEndian() {
+    uint32_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+size_t Snapshot::elementSize(SnapshotArray array) {
+    switch (array) {
+    case SnapshotArray::Color:
+        return sizeof(Color);
+    case SnapshotArray::Type:
+        return sizeof(ShapeType);
+    case SnapshotArray::Intersecting:
+        return sizeof(uint8_t);
+    case SnapshotArray::Owners:
+    case SnapshotArray::Generations:
+    case SnapshotArray::SleepNext:
+    case SnapshotArray::FreeSlots:
+        return sizeof(uint32_t);
+    case SnapshotArray::PendingWakes:
+        return sizeof(BodyHandle);
+    case SnapshotArray::Impulses:
+        return sizeof(ContactSolver::CachedImpulse);
+    case SnapshotArray::Statics:
+        return sizeof(StaticBody);
+    case SnapshotArray::Particles:
+        return sizeof(ParticleSystem::Block);
+    default:
+        return sizeof(float);
+    }
+}
+
+// Elements in each array
+static uint64_t elementCount(const SnapshotHeader& h, SnapshotArray array) {
+    switch (array) {
+    case SnapshotArray::Generations:
+    case SnapshotArray::SleepNext:
+        return h.slotCount;
+    case SnapshotArray::FreeSlots:
+        return h.freeCount;
+    case SnapshotArray::PendingWakes:
+        return h.pendingCount;
+    case SnapshotArray::Impulses:
+        return h.impulseCount;
+    case SnapshotArray::Statics:
+        return h.staticCount;
+    case SnapshotArray::Particles:
+        return (h.particleCount + ParticleSystem::blockSize - 1) /
+               ParticleSystem::blockSize;
+    default:
+        return h.bodyCount;
+    }
+}
+
+bool Snapshot::save(const World& world, const std::string& path) {
+    if (!littleEndian()) {
+        return false;
+    }
+    const BodyStore& b = world.bodies;
+    const void* arrays[(uint32_t)SnapshotArray::Count] = {
+        b.px.data(),          b.py.data(),          b.vx.data(),
+        b.vy.data(),          b.ax.data(),          b.ay.data(),
+        b.hx.data(),          b.hy.data(),          b.sleepTime.data(),
+        b.color.data(),       b.type.data(),        b.intersecting.data(),
+        b.owners.data(),      b.generations.data(), b.sleepNext.data(),
+        b.freeSlots.data(),   b.pendingWakes.data(),
+        world.solver.cache.data(), world.statics.data(),
+        world.particles.blocks.data()};
+
+    SnapshotHeader header = {};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.bodyCount = b.size();
+    header.awakeCount = b.awake;
+    header.slotCount = (uint32_t)b.generations.size();
+    header.freeCount = (uint32_t)b.freeSlots.size();
+    header.pendingCount = (uint32_t)b.pendingWakes.size();
+    header.impulseCount = (uint32_t)world.solver.cache.size();
+    header.staticCount = (uint32_t)world.statics.size();
+    header.particleCount = world.particles.count;
+    header.stepCount = world.stepCount;
+    header.randomSeed = world.random.get_seed();
+    header.randomState = world.random.get_state();
+    header.timestep = world.timestep;
+    header.accumulator = world.fixedStep.accumulator;
+    header.walls[0] = world.walls.min.x;
+    header.walls[1] = world.walls.min.y;
+    header.walls[2] = world.walls.max.x;
+    header.walls[3] = world.walls.max.y;
+
+    // Lay the arrays out one after the other
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (uint32_t a = 0; a < (uint32_t)SnapshotArray::Count; a++) {
+        offset = (offset + arrayAlign - 1) & ~(arrayAlign - 1);
+        header.offsets[a] = offset;
+        offset += elementCount(header, (SnapshotArray)a) *
+                  elementSize((SnapshotArray)a);
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+    uint64_t written = sizeof(header);
+    char padding[arrayAlign] = {};
+    for (uint32_t a = 0; a < (uint32_t)SnapshotArray::Count; a++) {
+        out.write(padding, header.offsets[a] - written);
+        uint64_t bytes = elementCount(header, (SnapshotArray)a) *
+                         elementSize((SnapshotArray)a);
+        out.write((const char*)arrays[a], bytes);
+        written = header.offsets[a] + bytes;
+    }
+    return (bool)out;
+}
+
+bool Snapshot::open(const std::string& path) {
+    close();
+#ifndef _WIN32
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        void* mapped =
+            mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped != MAP_FAILED) {
+            data = (const uint8_t*)mapped;
+            length = info.st_size;
+        }
+    }
+    ::close(file);
+#else
+    // No mmap here, so just read the whole thing in
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (in) {
+        buffer.resize((size_t)in.tellg());
+        in.seekg(0);
+        if (in.read((char*)buffer.data(), buffer.size()) && !buffer.empty()) {
+            data = buffer.data();
+            length = buffer.size();
+        }
+    }
+#endif
+    if (data && !check()) {
+        close();
+    }
+    return data != nullptr;
+}
+
+void Snapshot::close() {
+#ifndef _WIN32
+    if (data) {
+        munmap((void*)data, length);
+    }
+#endif
+    buffer.clear();
+    data = nullptr;
+    length = 0;
+}
+
+bool Snapshot::check() const {
+    if (!littleEndian() || length < sizeof(SnapshotHeader)) {
+        return false;
+    }
+    const SnapshotHeader& h = get_header();
+    if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+        h.headerSize != sizeof(SnapshotHeader) || h.awakeCount > h.bodyCount ||
+        h.freeCount > h.slotCount || h.bodyCount > h.slotCount) {
+        return false;
+    }
+    for (uint32_t a = 0; a < (uint32_t)SnapshotArray::Count; a++) {
+        uint64_t bytes =
+            elementCount(h, (SnapshotArray)a) * elementSize((SnapshotArray)a);
+        if (h.offsets[a] % arrayAlign != 0 || h.offsets[a] > length ||
+            bytes > length - h.offsets[a]) {
+            return false;
+        }
+    }
+
+    // These all index into the slot arrays, so make sure they can't run off
+    for (SnapshotArray a : {SnapshotArray::Owners, SnapshotArray::SleepNext,
+                            SnapshotArray::FreeSlots}) {
+        const uint32_t* slots = get<uint32_t>(a);
+        for (uint64_t i = 0; i < elementCount(h, a); i++) {
+            if (slots[i] >= h.slotCount) {
+                return false;
+            }
+        }
+    }
+
+    // Every body needs its own slot (restore builds the slot table from the
+    // owners), and free slots can't be anyone's
+    std::vector<uint8_t> used(h.slotCount, 0);
+    for (SnapshotArray a : {SnapshotArray::Owners, SnapshotArray::FreeSlots}) {
+        const uint32_t* slots = get<uint32_t>(a);
+        for (uint64_t i = 0; i < elementCount(h, a); i++) {
+            if (used[slots[i]]++) {
+                return false;
+            }
+        }
+    }
+
+    // Types pick the collision kernel out of a table, so they can't be past
+    // the end of it (read as bytes, since a bad one isn't a ShapeType)
+    const uint8_t* types = get<uint8_t>(SnapshotArray::Type);
+    for (uint32_t i = 0; i < h.bodyCount; i++) {
+        if (types[i] >= (uint8_t)ShapeType::Count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replace a vector's contents with count elements straight from the file
+template <typename T>
+static void load(std::vector<T>& to, const T* from, uint64_t count) {
+    to.assign(from, from + count);
+}
+
+bool Snapshot::restore(World& world) const {
+    if (!data) {
+        return false;
+    }
+    const SnapshotHeader& h = get_header();
+    BodyStore& b = world.bodies;
+    load(b.px, get<float>(SnapshotArray::Px), h.bodyCount);
+    load(b.py, get<float>(SnapshotArray::Py), h.bodyCount);
+    load(b.vx, get<float>(SnapshotArray::Vx), h.bodyCount);
+    load(b.vy, get<float>(SnapshotArray::Vy), h.bodyCount);
+    load(b.ax, get<float>(SnapshotArray::Ax), h.bodyCount);
+    load(b.ay, get<float>(SnapshotArray::Ay), h.bodyCount);
+    load(b.hx, get<float>(SnapshotArray::Hx), h.bodyCount);
+    load(b.hy, get<float>(SnapshotArray::Hy), h.bodyCount);
+    load(b.sleepTime, get<float>(SnapshotArray::SleepTime), h.bodyCount);
+    load(b.color, get<Color>(SnapshotArray::Color), h.bodyCount);
+    load(b.type, get<ShapeType>(SnapshotArray::Type), h.bodyCount);
+    load(b.intersecting, get<uint8_t>(SnapshotArray::Intersecting),
+         h.bodyCount);
+    load(b.owners, get<uint32_t>(SnapshotArray::Owners), h.bodyCount);
+    load(b.generations, get<uint32_t>(SnapshotArray::Generations),
+         h.slotCount);
+    load(b.sleepNext, get<uint32_t>(SnapshotArray::SleepNext), h.slotCount);
+    load(b.freeSlots, get<uint32_t>(SnapshotArray::FreeSlots), h.freeCount);
+    load(b.pendingWakes, get<BodyHandle>(SnapshotArray::PendingWakes),
+         h.pendingCount);
+    load(world.solver.cache,
+         get<ContactSolver::CachedImpulse>(SnapshotArray::Impulses),
+         h.impulseCount);
+
+    // Slots aren't saved since the owners say where every body is
+    b.slots.assign(h.slotCount, 0);
+    for (uint32_t i = 0; i < h.bodyCount; i++) {
+        b.slots[b.owners[i]] = i;
+    }
+    b.awake = h.awakeCount;
+    b.sleepVersion++; // Every body moved, as far as the broad phase knows
+    b.changeCount++;
+
+    world.stepCount = h.stepCount;
+    world.random.set_seed(h.randomSeed);
+    world.random.set_state(h.randomState);
+    world.timestep = h.timestep;
+    world.fixedStep.accumulator = h.accumulator;
+    world.contactCount = h.impulseCount;
+    world.setStatics(get<StaticBody>(SnapshotArray::Statics), h.staticCount);
+    load(world.particles.blocks,
+         get<ParticleSystem::Block>(SnapshotArray::Particles),
+         elementCount(h, SnapshotArray::Particles));
+    world.particles.count = h.particleCount;
+    world.set_walls(AABB{Vector(h.walls[0], h.walls[1]),
+                         Vector(h.walls[2], h.walls[3])});
+    return true;
+}
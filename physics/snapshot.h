@@ -0,0 +1,113 @@
+// World snapshots: a flat binary checkpoint of every body and everything the
+// next step depends on, for crash recovery or for going back to a bad frame.
+//
+// The file is just a header followed by the store's arrays, one after the
+// other (same structure of arrays layout as BodyStore, little-endian, each
+// array 64 byte aligned). Nothing needs parsing, so a snapshot gets mapped
+// into memory and its arrays read in place, and restoring a world is one
+// memcpy per array.
+
+#pragma once
+
+#include "world.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Arrays in a snapshot, in file order (add new ones at the end, before
+// Count, and bump the version)
+enum class SnapshotArray : uint32_t {
+    Px, Py, Vx, Vy, Ax, Ay, Hx, Hy, SleepTime, // float per body
+    Color,                                      // Color per body
+    Type,                                       // ShapeType per body
+    Intersecting,                               // uint8_t per body
+    Owners,                                     // uint32_t per body
+    Generations,                                // uint32_t per handle slot
+    SleepNext,                                  // uint32_t per handle slot
+    FreeSlots,                                  // uint32_t per free slot
+    PendingWakes,                               // BodyHandle per wake
+    Impulses,                                   // Solver's warm start cache
+    Statics,                                    // StaticBody per static id
+    Particles, // ParticleSystem::Block per eight particles
+    Count
+};
+
+struct SnapshotHeader {
+    char magic[8];       // "PHYSSNAP"
+    uint32_t version;
+    uint32_t headerSize; // sizeof(SnapshotHeader) when it was written
+    uint32_t bodyCount;
+    uint32_t awakeCount;
+    uint32_t slotCount;
+    uint32_t freeCount;
+    uint32_t pendingCount;
+    uint32_t impulseCount;
+    uint32_t staticCount;
+    uint32_t particleCount;
+    uint64_t stepCount;
+    uint64_t randomSeed;
+    uint64_t randomState;
+    float timestep;
+    float accumulator;
+    float walls[4]; // Min x, min y, max x, max y
+    uint64_t offsets[(uint32_t)SnapshotArray::Count]; // From the file start
+};
+
+// A snapshot file mapped into memory. Arrays can be read straight out of it
+// (no copy) for as long as it stays open.
+class Snapshot {
+  public:
+    static const uint32_t version = 4;
+
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // Destructor
+    ~Snapshot() {
+        close();
+    }
+
+    // Write a world out to a file. Settings (solver, sleep, broad phase and
+    // so on) aren't included, they're up to whoever loads it.
+    static bool save(const World& world, const std::string& path);
+
+    // Map a snapshot file and check it's one this version can read
+    bool open(const std::string& path);
+
+    void close();
+
+    // Copy the snapshot into a world, replacing every body in it. Stepping
+    // it from here goes exactly the way the saved world would have.
+    bool restore(World& world) const;
+
+    bool is_open() const {
+        return data != nullptr;
+    }
+
+    const SnapshotHeader& get_header() const {
+        return *(const SnapshotHeader*)data;
+    }
+
+    uint32_t size() const {
+        return get_header().bodyCount;
+    }
+
+    // One of the arrays, read in place
+    template <typename T>
+    const T* get(SnapshotArray array) const {
+        return (const T*)(data + get_header().offsets[(uint32_t)array]);
+    }
+
+  private:
+    // Bytes per element of each array
+    static size_t elementSize(SnapshotArray array);
+
+    // Check the header and that every array fits in the file
+    bool check() const;
+
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    std::vector<uint8_t> buffer; // Where the file goes if it can't be mapped
+};
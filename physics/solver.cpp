@@ -0,0 +1,153 @@
+// Sequential impulse solver
+
+#include "solver.h"
+#include <algorithm>
+
+// Walls can't be pushed
+static inline float inverseMass(const BodyStore& b, uint32_t i) {
+    return i == wallBody ? 0 : b.inverseMass(i);
+}
+
+// How fast b is moving relative to a along a direction (along the normal,
+// that's negative if they're moving together)
+static inline float relativeSpeed(const BodyStore& b, const Contact& c,
+                                  Vector dir) {
+    float vx = -b.vx[c.a];
+    float vy = -b.vy[c.a];
+    if (c.b != wallBody) {
+        vx += b.vx[c.b];
+        vy += b.vy[c.b];
+    }
+    return vx * dir.x + vy * dir.y;
+}
+
+// Sideways along the contact, for friction
+static inline Vector tangent(const Contact& c) {
+    return Vector(-c.normal.y, c.normal.x);
+}
+
+// Push b along a direction and a the opposite way
+static inline void applyImpulse(BodyStore& b, const Contact& c, float invA,
+                                float invB, Vector dir, float amount) {
+    float px = dir.x * amount;
+    float py = dir.y * amount;
+    b.vx[c.a] -= px * invA;
+    b.vy[c.a] -= py * invA;
+    if (c.b != wallBody) {
+        b.vx[c.b] += px * invB;
+        b.vy[c.b] += py * invB;
+    }
+}
+
+void ContactSolver::solve(BodyStore& b, Contact* contacts, uint32_t count,
+                          float dt, const SolverSettings& settings) const {
+    // Work out each contact's effective mass and bounce, and reapply last
+    // step's impulses
+    for (uint32_t n = 0; n < count; n++) {
+        Contact& c = contacts[n];
+        float invA = inverseMass(b, c.a);
+        float invB = inverseMass(b, c.b);
+        c.normalMass = 1 / (invA + invB);
+
+        // Contacts with a gap (from CCD) can close up to the gap this step
+        c.closable = std::max(-c.penetration, 0.0f) / dt;
+
+        c.impulse = 0;
+        c.tangentImpulse = 0;
+        if (settings.warmStarting) {
+            cachedImpulse(c);
+        }
+
+        // Only bounce off fast hits that just happened, so resting bodies
+        // actually rest
+        float closing = relativeSpeed(b, c, c.normal);
+        c.bias = closing < -settings.bounceThreshold && c.impulse == 0
+                     ? -settings.restitution * closing
+                     : 0;
+        applyImpulse(b, c, invA, invB, c.normal, c.impulse);
+        applyImpulse(b, c, invA, invB, tangent(c), c.tangentImpulse);
+    }
+
+    // Velocity iterations
+    for (int it = 0; it < settings.iterations; it++) {
+        for (uint32_t n = 0; n < count; n++) {
+            Contact& c = contacts[n];
+            float invA = inverseMass(b, c.a);
+            float invB = inverseMass(b, c.b);
+
+            // Friction, limited by how hard the contact is pushing (bodies
+            // don't rotate, so the tangent has the same effective mass)
+            Vector t = tangent(c);
+            float change = -c.normalMass * relativeSpeed(b, c, t);
+            float limit = settings.friction * c.impulse;
+            float total =
+                std::clamp(c.tangentImpulse + change, -limit, limit);
+            applyImpulse(b, c, invA, invB, t, total - c.tangentImpulse);
+            c.tangentImpulse = total;
+
+            // Clamp the total, not the change, so an earlier iteration that
+            // pushed too hard can be taken back
+            change =
+                -c.normalMass * (relativeSpeed(b, c, c.normal) + c.closable);
+            total = std::max(c.impulse + change, 0.0f);
+            applyImpulse(b, c, invA, invB, c.normal, total - c.impulse);
+            c.impulse = total;
+        }
+    }
+
+    // Then bounce, once the contacts have stopped pushing into each other.
+    // This goes on top of the impulse that gets cached, since warm starting
+    // next step with a whole bounce's worth of push would just throw the
+    // bodies apart again.
+    for (uint32_t n = 0; n < count; n++) {
+        Contact& c = contacts[n];
+        if (c.bias == 0 || c.impulse == 0) {
+            continue;
+        }
+        float invA = inverseMass(b, c.a);
+        float invB = inverseMass(b, c.b);
+        float change =
+            c.normalMass * (c.bias - relativeSpeed(b, c, c.normal));
+        applyImpulse(b, c, invA, invB, c.normal, std::max(change, -c.impulse));
+    }
+
+    // Push overlapping bodies apart directly, split by mass (this doesn't add
+    // any velocity, so it can't make things jitter)
+    for (uint32_t n = 0; n < count; n++) {
+        Contact& c = contacts[n];
+        float invA = inverseMass(b, c.a);
+        float invB = inverseMass(b, c.b);
+        float amount = std::max(c.penetration - settings.slop, 0.0f) *
+                       settings.correction / (invA + invB);
+        b.px[c.a] -= c.normal.x * amount * invA;
+        b.py[c.a] -= c.normal.y * amount * invA;
+        if (c.b != wallBody) {
+            b.px[c.b] += c.normal.x * amount * invB;
+            b.py[c.b] += c.normal.y * amount * invB;
+        }
+    }
+}
+
+void ContactSolver::store(const Contact* contacts, uint32_t count) {
+    cache.resize(count);
+    for (uint32_t n = 0; n < count; n++) {
+        cache[n] = {contacts[n].key, contacts[n].generation,
+                    contacts[n].impulse, contacts[n].tangentImpulse};
+    }
+    std::sort(cache.begin(), cache.end(),
+              [](const CachedImpulse& x, const CachedImpulse& y) {
+                  return x.key < y.key;
+              });
+}
+
+void ContactSolver::cachedImpulse(Contact& c) const {
+    auto it = std::lower_bound(
+        cache.begin(), cache.end(), c.key,
+        [](const CachedImpulse& x, uint64_t key) { return x.key < key; });
+    if (it == cache.end() || it->key != c.key ||
+        it->generation != c.generation) {
+        return;
+    }
+    c.impulse = it->impulse;
+    c.tangentImpulse = it->tangentImpulse;
+}
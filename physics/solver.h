@@ -0,0 +1,50 @@
+// Sequential impulse contact solver. Every contact gets pushed apart a little
+// at a time, over and over, with the total impulse on each contact kept from
+// going negative (contacts can push but never pull) and friction kept under a
+// fraction of that push. Starting each contact from last step's impulse (warm
+// starting) means stacks only need a handful of iterations to settle.
+
+#pragma once
+
+#include "bodies.h"
+#include "collision.h"
+#include <cstdint>
+#include <vector>
+
+// Knobs for the solver
+struct SolverSettings {
+    int iterations = 8;
+    float restitution = 0.5f;
+    float friction = 0.4f;
+    float bounceThreshold = 30; // Slower hits than this don't bounce at all
+    float correction = 0.8f;    // Fraction of the overlap fixed each step
+    float slop = 0.5f;          // Overlap that's allowed to stay
+    bool warmStarting = true;
+};
+
+class ContactSolver {
+  public:
+    // Set up, warm start and solve one island's contacts for a step of dt.
+    // Islands don't share bodies, so different islands can be solved at the
+    // same time.
+    void solve(BodyStore& b, Contact* contacts, uint32_t count, float dt,
+               const SolverSettings& settings) const;
+
+    // Remember this step's impulses for warm starting the next one
+    void store(const Contact* contacts, uint32_t count);
+
+  private:
+    friend class Snapshot;
+
+    // Load last step's impulses for a pair (if they were touching)
+    void cachedImpulse(Contact& c) const;
+
+    struct CachedImpulse {
+        uint64_t key;
+        uint64_t generation;
+        float impulse;
+        float tangentImpulse;
+    };
+
+    std::vector<CachedImpulse> cache; // Sorted by key
+};
@@ -0,0 +1,192 @@
+// Bulk spawning: dart throwing into a grid, so each try only has to look at
+// the shapes in the few cells around it instead of every body in the world
+
+#include "world.h"
+#include "profile.h"
+#include <algorithm>
+
+namespace {
+
+// Everything already placed (or in the way), bucketed by grid cell. A shape
+// goes in every cell its box touches, so a try only has to look in the cells
+// its own box touches.
+class PlacementGrid {
+  public:
+    PlacementGrid(const AABB& region, float cell, float spacing)
+        : origin(region.min), spacing(spacing) {
+        // Keep the grid to a sane size, even for tiny shapes in a huge region
+        float width = region.max.x - region.min.x;
+        float height = region.max.y - region.min.y;
+        cell = std::max(cell, sqrtf(width * height / maxCells));
+        inverse = 1 / cell;
+        columns = std::max((int)(width * inverse) + 1, 1);
+        rows = std::max((int)(height * inverse) + 1, 1);
+        heads.assign((size_t)columns * rows, UINT32_MAX);
+    }
+
+    void add(ShapeType type, Vector center, Vector half) {
+        uint32_t shape = (uint32_t)shapes.size();
+        shapes.push_back({type, center, half});
+        int x0, y0, x1, y1;
+        if (!cells(center, half, x0, y0, x1, y1)) {
+            return;
+        }
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                uint32_t& head = heads[(size_t)y * columns + x];
+                links.push_back({shape, head});
+                head = (uint32_t)links.size() - 1;
+            }
+        }
+    }
+
+    // Whether a shape would overlap anything (or come within spacing of it)
+    bool blocked(ShapeType type, Vector center, Vector half) const {
+        Vector grown(half.x + spacing, half.y + spacing);
+        int x0, y0, x1, y1;
+        if (!cells(center, grown, x0, y0, x1, y1)) {
+            return false;
+        }
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                for (uint32_t l = heads[(size_t)y * columns + x];
+                     l != UINT32_MAX; l = links[l].next) {
+                    const Placed& s = shapes[links[l].shape];
+                    if (shapesOverlap(type, center, grown, s.type, s.center,
+                                      s.half)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+  private:
+    static constexpr float maxCells = 1 << 22;
+
+    struct Placed {
+        ShapeType type;
+        Vector center;
+        Vector half;
+    };
+
+    struct Link {
+        uint32_t shape;
+        uint32_t next;
+    };
+
+    // Range of cells a box touches (false if it's all outside the grid)
+    bool cells(Vector center, Vector half, int& x0, int& y0, int& x1,
+               int& y1) const {
+        float left = (center.x - half.x - origin.x) * inverse;
+        float right = (center.x + half.x - origin.x) * inverse;
+        float bottom = (center.y - half.y - origin.y) * inverse;
+        float top = (center.y + half.y - origin.y) * inverse;
+        if (right < 0 || top < 0 || left >= columns || bottom >= rows) {
+            return false;
+        }
+        x0 = std::max((int)left, 0);
+        y0 = std::max((int)bottom, 0);
+        x1 = std::min((int)right, columns - 1);
+        y1 = std::min((int)top, rows - 1);
+        return true;
+    }
+
+    Vector origin;
+    float spacing;
+    float inverse;
+    int columns;
+    int rows;
+    std::vector<uint32_t> heads; // First link in each cell
+    std::vector<Link> links;
+    std::vector<Placed> shapes;
+};
+
+} // namespace
+
+uint32_t World::spawn(uint32_t count, const SpawnSettings& settings) {
+    PROFILE_SCOPE("spawn");
+    AABB region = settings.region;
+    if (region.max.x <= region.min.x || region.max.y <= region.min.y) {
+        region = walls;
+    }
+
+    // Cells as big as the biggest shape, so each try looks at about four
+    float largest = std::max({settings.maxRadius * 2, settings.maxSize.x,
+                              settings.maxSize.y});
+    PlacementGrid grid(region, largest + settings.spacing, settings.spacing);
+
+    // Whatever's already there is in the way too
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+        if (bodies.bounds(i).overlaps(region)) {
+            grid.add(bodies.type[i], Vector(bodies.px[i], bodies.py[i]),
+                     Vector(bodies.hx[i], bodies.hy[i]));
+        }
+    }
+    staticTree.query(region, [&](uint32_t proxy) {
+        const StaticBody& s = statics[staticTree.get_data(proxy)];
+        grid.add(s.type, s.center, s.half);
+        return true;
+    });
+
+    bodies.reserve(bodies.size() + count);
+    uint32_t placed = 0;
+    uint32_t misses = 0;
+    for (uint32_t n = 0; n < count && misses < settings.attempts; n++) {
+        // Pick the shape first (one draw per statement, so the same seed
+        // makes the same shapes everywhere)
+        const SpawnSettings& s = settings;
+        bool circle = random.uniform() < s.circles;
+        Vector half;
+        if (circle) {
+            float t = random.uniform();
+            float radius = s.minRadius + t * (s.maxRadius - s.minRadius);
+            half = Vector(radius, radius);
+        } else {
+            float tx = random.uniform();
+            float ty = random.uniform();
+            half = Vector((s.minSize.x + tx * (s.maxSize.x - s.minSize.x)) / 2,
+                          (s.minSize.y + ty * (s.maxSize.y - s.minSize.y)) / 2);
+        }
+        uint8_t r = random.below(256);
+        uint8_t g = random.below(256);
+        uint8_t b = random.below(256);
+        Color color(r, g, b);
+
+        // Then throw it at the region until it lands somewhere clear
+        float spanX = region.max.x - region.min.x - 2 * half.x;
+        float spanY = region.max.y - region.min.y - 2 * half.y;
+        ShapeType type = circle ? ShapeType::Circle : ShapeType::Rectangle;
+        bool found = false;
+        Vector center;
+        for (uint32_t a = 0; a < settings.attempts && spanX >= 0 && spanY >= 0;
+             a++) {
+            float x = random.uniform();
+            float y = random.uniform();
+            center = Vector(region.min.x + half.x + x * spanX,
+                            region.min.y + half.y + y * spanY);
+            if (!grid.blocked(type, center, half)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            misses++;
+            continue;
+        }
+        misses = 0;
+        placed++;
+
+        grid.add(type, center, half);
+        if (circle) {
+            bodies.add(Circle(center, half.x, color, settings.acceleration,
+                              settings.velocity));
+        } else {
+            bodies.add(Rectangle(center, Vector(half.x * 2, half.y * 2),
+                                 color, settings.acceleration,
+                                 settings.velocity));
+        }
+    }
+    return placed;
+}
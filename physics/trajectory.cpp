@@ -0,0 +1,408 @@
+// Trajectory recording and playback
+
+#include "trajectory.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <math.h>
+
+// File layout (little-endian): a header, then chunks (each a frame count, a
+// byte count and that many bytes of frames), then the chunk index (first
+// frame and file offset of each chunk) and a footer saying where it is.
+//
+// A frame is a kind byte, the step number, then either a keyframe (the slot
+// count, each slot's generation and shape, and its absolute quantized
+// values) or a delta frame (for each live slot, a byte saying which of its
+// four values changed followed by the changes). Every number that isn't a
+// shape field is a varint, and signed ones are zigzagged first, so small
+// changes take a byte.
+
+static const char magic[8] = {'P', 'H', 'Y', 'S', 'T', 'R', 'A', 'J'};
+static const uint32_t version = 1;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    float timestep;
+    float positionStep;
+    float velocityStep;
+};
+
+struct FileFooter {
+    uint64_t indexOffset;
+    uint64_t chunkCount;
+    uint64_t frameCount;
+    char magic[8];
+};
+
+enum : uint8_t { DeltaFrame, KeyFrame };
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)v | 0x80);
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static uint64_t getVarint(const std::vector<uint8_t>& in, size_t& cursor) {
+    uint64_t v = 0;
+    for (int shift = 0; cursor < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[cursor++];
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return v;
+}
+
+// Signed to unsigned so small negative numbers stay small
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static int32_t quantize(float v, float step) {
+    return (int32_t)lrintf(std::clamp(v / step, -1e9f, 1e9f));
+}
+
+bool TrajectoryRecorder::start(const std::string& path, float timestep) {
+    stop();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    FileHeader header = {};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.timestep = timestep;
+    header.positionStep = settings.positionStep;
+    header.velocityStep = settings.velocityStep;
+    file.write((const char*)&header, sizeof(header));
+
+    ring.assign(std::max<uint32_t>(settings.bufferFrames, 1),
+                TrajectoryFrame());
+    head = 0;
+    tail = 0;
+    lastGenerations.clear();
+    captured = 0;
+    stalls = 0;
+    shapes = TrajectoryFrame();
+    last.clear();
+    chunk.clear();
+    chunkStart = 0;
+    chunkCount = 0;
+    index.clear();
+    written = 0;
+
+    running = true;
+    writer = std::thread([this] { write(); });
+    return true;
+}
+
+void TrajectoryRecorder::capture(const World& world) {
+    if (!is_recording()) {
+        return;
+    }
+    // Wait for room if the writer's a whole buffer behind
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= ring.size()) {
+        stalls++;
+        while (h - tail.load(std::memory_order_acquire) >= ring.size()) {
+            std::this_thread::yield();
+        }
+    }
+
+    const BodyStore& bodies = world.get_bodies();
+    uint32_t slots = bodies.get_slot_count();
+    TrajectoryFrame& f = ring[h % ring.size()];
+    f.step = world.get_step_count();
+    f.generation.assign(slots, TrajectoryFrame::dead);
+    for (auto array : {&f.px, &f.py, &f.vx, &f.vy}) {
+        array->resize(slots);
+    }
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+        BodyHandle handle = bodies.handleAt(i);
+        uint32_t s = handle.index;
+        f.generation[s] = handle.generation;
+        f.px[s] = bodies.px[i];
+        f.py[s] = bodies.py[i];
+        f.vx[s] = bodies.vx[i];
+        f.vy[s] = bodies.vy[i];
+    }
+
+    // Shapes never change on their own, so only copy them when bodies have
+    // come or gone
+    f.shapesChanged = captured == 0 || f.generation != lastGenerations;
+    if (f.shapesChanged) {
+        f.hx.resize(slots);
+        f.hy.resize(slots);
+        f.type.resize(slots);
+        f.color.resize(slots);
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            uint32_t s = bodies.handleAt(i).index;
+            f.hx[s] = bodies.hx[i];
+            f.hy[s] = bodies.hy[i];
+            f.type[s] = bodies.type[i];
+            f.color[s] = bodies.color[i];
+        }
+        lastGenerations = f.generation;
+    }
+
+    head.store(h + 1, std::memory_order_release);
+    captured++;
+}
+
+void TrajectoryRecorder::stop() {
+    if (!writer.joinable()) {
+        return;
+    }
+    running = false;
+    writer.join();
+}
+
+void TrajectoryRecorder::write() {
+    while (true) {
+        // Check this before looking for frames, so once it's false every
+        // frame there's going to be is already in the ring
+        bool done = !running.load();
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            if (done) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+
+        const TrajectoryFrame& frame = ring[t % ring.size()];
+        if (frame.shapesChanged) {
+            shapes.generation = frame.generation;
+            shapes.hx = frame.hx;
+            shapes.hy = frame.hy;
+            shapes.type = frame.type;
+            shapes.color = frame.color;
+        }
+        if (chunkCount == settings.chunkFrames) {
+            flushChunk();
+        }
+        encode(frame, chunkCount == 0 || frame.shapesChanged);
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    // Finish the last chunk and write the index
+    if (chunkCount > 0) {
+        flushChunk();
+    }
+    FileFooter footer = {};
+    footer.indexOffset = (uint64_t)file.tellp();
+    footer.chunkCount = index.size() / 2;
+    footer.frameCount = written;
+    memcpy(footer.magic, magic, sizeof(magic));
+    file.write((const char*)index.data(), index.size() * sizeof(uint64_t));
+    file.write((const char*)&footer, sizeof(footer));
+    file.close();
+}
+
+void TrajectoryRecorder::encode(const TrajectoryFrame& frame, bool keyframe) {
+    uint32_t slots = frame.get_slot_count();
+    last.resize(4 * slots);
+    chunk.push_back(keyframe ? KeyFrame : DeltaFrame);
+    putVarint(chunk, frame.step);
+
+    if (keyframe) {
+        putVarint(chunk, slots);
+        for (uint32_t s = 0; s < slots; s++) {
+            // Generations go in one up so 0 can mean an empty slot
+            putVarint(chunk, (uint64_t)frame.generation[s] + 1);
+            if (!frame.alive(s)) {
+                continue;
+            }
+            const uint8_t* color = (const uint8_t*)&shapes.color[s];
+            chunk.push_back((uint8_t)shapes.type[s]);
+            chunk.insert(chunk.end(), color, color + sizeof(Color));
+            const uint8_t* hx = (const uint8_t*)&shapes.hx[s];
+            const uint8_t* hy = (const uint8_t*)&shapes.hy[s];
+            chunk.insert(chunk.end(), hx, hx + sizeof(float));
+            chunk.insert(chunk.end(), hy, hy + sizeof(float));
+        }
+    }
+
+    for (uint32_t s = 0; s < slots; s++) {
+        if (!frame.alive(s)) {
+            continue;
+        }
+        int32_t q[4] = {quantize(frame.px[s], settings.positionStep),
+                        quantize(frame.py[s], settings.positionStep),
+                        quantize(frame.vx[s], settings.velocityStep),
+                        quantize(frame.vy[s], settings.velocityStep)};
+        int32_t* prev = &last[4 * s];
+        if (keyframe) {
+            for (int k = 0; k < 4; k++) {
+                putVarint(chunk, zigzag(q[k]));
+                prev[k] = q[k];
+            }
+            continue;
+        }
+        uint8_t changed = 0;
+        for (int k = 0; k < 4; k++) {
+            changed |= (q[k] != prev[k]) << k;
+        }
+        chunk.push_back(changed);
+        for (int k = 0; k < 4; k++) {
+            if (changed & (1 << k)) {
+                putVarint(chunk, zigzag(q[k] - prev[k]));
+                prev[k] = q[k];
+            }
+        }
+    }
+    chunkCount++;
+    written++;
+}
+
+void TrajectoryRecorder::flushChunk() {
+    index.push_back(chunkStart);
+    index.push_back((uint64_t)file.tellp());
+    uint32_t sizes[2] = {chunkCount, (uint32_t)chunk.size()};
+    file.write((const char*)sizes, sizeof(sizes));
+    file.write((const char*)chunk.data(), chunk.size());
+    chunk.clear();
+    chunkStart += chunkCount;
+    chunkCount = 0;
+}
+
+bool TrajectoryReader::open(const std::string& path) {
+    file.close();
+    file.clear();
+    file.open(path, std::ios::binary);
+    FileHeader header;
+    FileFooter footer;
+    if (!file.read((char*)&header, sizeof(header)) ||
+        memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        header.version != version) {
+        return false;
+    }
+    file.seekg(-(std::streamoff)sizeof(footer), std::ios::end);
+    if (!file.read((char*)&footer, sizeof(footer)) ||
+        memcmp(footer.magic, magic, sizeof(magic)) != 0) {
+        return false;
+    }
+    index.resize(2 * footer.chunkCount);
+    file.seekg(footer.indexOffset);
+    if (!file.read((char*)index.data(), index.size() * sizeof(uint64_t))) {
+        return false;
+    }
+
+    timestep = header.timestep;
+    positionStep = header.positionStep;
+    velocityStep = header.velocityStep;
+    frameCount = footer.frameCount;
+    loaded = UINT32_MAX;
+    position = 0;
+    return true;
+}
+
+bool TrajectoryReader::seek(uint64_t target) {
+    if (target >= frameCount) {
+        return false;
+    }
+    position = target;
+    return true;
+}
+
+bool TrajectoryReader::next() {
+    if (position >= frameCount) {
+        return false;
+    }
+    // Unless the loaded chunk is already up to this frame, start again from
+    // the keyframe at the start of the chunk it's in
+    if (loaded == UINT32_MAX || chunkFrame != position ||
+        position >= chunkEnd) {
+        uint32_t c = 0;
+        while (c + 1 < index.size() / 2 && index[2 * (c + 1)] <= position) {
+            c++;
+        }
+        if (!loadChunk(c)) {
+            return false;
+        }
+        while (chunkFrame < position) {
+            decode();
+        }
+    }
+    decode();
+    position++;
+    return true;
+}
+
+bool TrajectoryReader::loadChunk(uint32_t c) {
+    uint32_t sizes[2];
+    file.clear();
+    file.seekg(index[2 * c + 1]);
+    if (!file.read((char*)sizes, sizeof(sizes))) {
+        return false;
+    }
+    chunk.resize(sizes[1]);
+    if (!file.read((char*)chunk.data(), chunk.size())) {
+        return false;
+    }
+    cursor = 0;
+    chunkFrame = index[2 * c];
+    chunkEnd = c + 1 < index.size() / 2 ? index[2 * (c + 1)] : frameCount;
+    loaded = c;
+    return true;
+}
+
+void TrajectoryReader::decode() {
+    bool keyframe = cursor < chunk.size() && chunk[cursor++] == KeyFrame;
+    frame.step = getVarint(chunk, cursor);
+    frame.shapesChanged = keyframe;
+    if (keyframe) {
+        uint32_t slots = (uint32_t)getVarint(chunk, cursor);
+        frame.generation.resize(slots);
+        for (auto array :
+             {&frame.px, &frame.py, &frame.vx, &frame.vy, &frame.hx,
+              &frame.hy}) {
+            array->assign(slots, 0);
+        }
+        frame.type.assign(slots, ShapeType::Circle);
+        frame.color.assign(slots, Color());
+        last.assign(4 * slots, 0);
+        for (uint32_t s = 0; s < slots; s++) {
+            frame.generation[s] = (uint32_t)getVarint(chunk, cursor) - 1;
+            if (!frame.alive(s) || cursor + 13 > chunk.size()) {
+                continue;
+            }
+            frame.type[s] = (ShapeType)chunk[cursor++];
+            memcpy(&frame.color[s], &chunk[cursor], sizeof(Color));
+            memcpy(&frame.hx[s], &chunk[cursor + 4], sizeof(float));
+            memcpy(&frame.hy[s], &chunk[cursor + 8], sizeof(float));
+            cursor += 12;
+        }
+    }
+
+    for (uint32_t s = 0; s < frame.get_slot_count(); s++) {
+        if (!frame.alive(s)) {
+            continue;
+        }
+        int32_t* q = &last[4 * s];
+        uint8_t changed = 0x0F;
+        if (!keyframe) {
+            changed = cursor < chunk.size() ? chunk[cursor++] : 0;
+        }
+        for (int k = 0; k < 4; k++) {
+            if (changed & (1 << k)) {
+                int32_t v = unzigzag((uint32_t)getVarint(chunk, cursor));
+                q[k] = keyframe ? v : q[k] + v;
+            }
+        }
+        frame.px[s] = q[0] * positionStep;
+        frame.py[s] = q[1] * positionStep;
+        frame.vx[s] = q[2] * velocityStep;
+        frame.vy[s] = q[3] * velocityStep;
+    }
+    chunkFrame++;
+}
@@ -0,0 +1,171 @@
+// Trajectory recording: every body's center and velocity, every step, for
+// looking at long runs afterwards without running them again.
+//
+// The simulation thread just copies each step into a ring buffer, and a
+// writer thread does the rest: values get rounded to a fixed step
+// (quantized), stored as the change from the last frame (which is nothing at
+// all for resting bodies), and written out in chunks that each start from a
+// keyframe. An index of the chunks goes at the end of the file, so a reader
+// can jump to any frame by decoding at most one chunk.
+//
+// Bodies are recorded by handle slot rather than by array index, since the
+// store shuffles bodies around as they sleep and wake.
+
+#pragma once
+
+#include "world.h"
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How finely to record
+struct RecorderSettings {
+    float positionStep = 1 / 64.0f; // Pixels
+    float velocityStep = 1 / 16.0f; // Pixels per second
+    uint32_t chunkFrames = 256;     // Frames between keyframes
+    uint32_t bufferFrames = 64;     // Frames the writer can fall behind by
+};
+
+// One recorded step, by handle slot. The shape fields only change when
+// bodies are added or removed.
+struct TrajectoryFrame {
+    static constexpr uint32_t dead = UINT32_MAX; // Generation of an empty slot
+
+    uint64_t step = 0;
+    std::vector<uint32_t> generation;
+    std::vector<float> px, py, vx, vy;
+    std::vector<float> hx, hy;
+    std::vector<ShapeType> type;
+    std::vector<Color> color;
+    bool shapesChanged = false; // Since the last frame
+
+    uint32_t get_slot_count() const {
+        return (uint32_t)generation.size();
+    }
+
+    bool alive(uint32_t slot) const {
+        return generation[slot] != dead;
+    }
+};
+
+class TrajectoryRecorder {
+  public:
+    // Constructor
+    TrajectoryRecorder(const RecorderSettings& settings = RecorderSettings())
+        : settings(settings) {
+    }
+
+    // Destructor (finishes the file if it's still recording)
+    ~TrajectoryRecorder() {
+        stop();
+    }
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // Start writing a new file
+    bool start(const std::string& path, float timestep);
+
+    // Record the world as it is now (call it after every step). Only copies,
+    // unless the writer is a whole buffer behind, in which case this waits.
+    void capture(const World& world);
+
+    // Write out everything left, plus the index, and close the file
+    void stop();
+
+    bool is_recording() const {
+        return writer.joinable();
+    }
+
+    uint64_t get_frame_count() const {
+        return captured;
+    }
+
+    // Captures that had to wait on the writer
+    uint64_t get_stalls() const {
+        return stalls;
+    }
+
+  private:
+    // Writer thread loop
+    void write();
+
+    // Quantize and encode one frame onto the current chunk
+    void encode(const TrajectoryFrame& frame, bool keyframe);
+
+    // Write the current chunk out and add it to the index
+    void flushChunk();
+
+    RecorderSettings settings;
+    std::ofstream file;
+    std::thread writer;
+    std::atomic<bool> running{false};
+
+    // Ring of frames shared with the writer (capture only writes at head,
+    // the writer only reads at tail, so neither needs a lock)
+    std::vector<TrajectoryFrame> ring;
+    std::atomic<uint64_t> head{0}, tail{0};
+    std::vector<uint32_t> lastGenerations; // Capture side
+    uint64_t captured = 0;
+    uint64_t stalls = 0;
+
+    // Writer side
+    TrajectoryFrame shapes;               // Last known shape fields
+    std::vector<int32_t> last;            // Last quantized values, 4 per slot
+    std::vector<uint8_t> chunk;           // Encoded frames so far
+    uint64_t chunkStart = 0;              // First frame in the chunk
+    uint32_t chunkCount = 0;              // Frames in the chunk
+    std::vector<uint64_t> index;          // First frame, offset per chunk
+    uint64_t written = 0;                 // Frames encoded
+};
+
+// Reads a recording back one frame at a time, or from anywhere in it
+class TrajectoryReader {
+  public:
+    bool open(const std::string& path);
+
+    // Total frames in the file
+    uint64_t get_frame_count() const {
+        return frameCount;
+    }
+
+    float get_timestep() const {
+        return timestep;
+    }
+
+    // The frame just read
+    const TrajectoryFrame& get_frame() const {
+        return frame;
+    }
+
+    // Read the next frame (false at the end)
+    bool next();
+
+    // Jump to any frame, so the next call to next() reads it
+    bool seek(uint64_t target);
+
+  private:
+    // Load a chunk into memory
+    bool loadChunk(uint32_t chunk);
+
+    // Decode the next frame of the loaded chunk
+    void decode();
+
+    std::ifstream file;
+    float timestep = 0;
+    float positionStep = 1, velocityStep = 1;
+    uint64_t frameCount = 0;
+    std::vector<uint64_t> index; // First frame, offset per chunk
+
+    std::vector<uint8_t> chunk;
+    size_t cursor = 0;         // Read position in the chunk
+    uint64_t chunkFrame = 0;   // Frame the cursor is at
+    uint64_t chunkEnd = 0;     // First frame after the loaded chunk
+    uint32_t loaded = UINT32_MAX;
+    uint64_t position = 0;     // Frame the next call to next() reads
+    std::vector<int32_t> last; // Quantized values, 4 per slot
+    TrajectoryFrame frame;
+};
@@ -0,0 +1,182 @@
+// Vector math and bounding boxes used everywhere in the engine
+
+#pragma once
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define VECTOR_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Define the vector class with nice math
+class Vector {
+  public:
+    // Constructor
+    constexpr Vector(float x = 0.0f, float y = 0.0f)
+        : x(x), y(y) {
+    }
+
+    // Vector variables
+    float x;
+    float y;
+
+    // Overloaded operators
+    constexpr Vector operator+(const Vector& v) const {
+        return Vector(x + v.x, y + v.y);
+    }
+
+    constexpr Vector& operator+=(const Vector& v) {
+        x += v.x;
+        y += v.y;
+        return *this;
+    }
+
+    constexpr Vector operator-(const Vector& v) const {
+        return Vector(x - v.x, y - v.y);
+    }
+
+    constexpr Vector& operator-=(const Vector& v) {
+        x -= v.x;
+        y -= v.y;
+        return *this;
+    }
+
+    constexpr Vector operator-() const {
+        return Vector(-x, -y);
+    }
+
+    constexpr Vector operator*(float b) const {
+        return Vector(x * b, y * b);
+    }
+
+    constexpr Vector& operator*=(float b) {
+        x *= b;
+        y *= b;
+        return *this;
+    }
+
+    constexpr Vector operator/(float b) const {
+        return Vector(x / b, y / b);
+    }
+
+    constexpr Vector& operator/=(float b) {
+        x /= b;
+        y /= b;
+        return *this;
+    }
+
+    constexpr bool operator==(const Vector& v) const {
+        return x == v.x && y == v.y;
+    }
+
+    constexpr bool operator!=(const Vector& v) const {
+        return !(*this == v);
+    }
+
+    // Get the dot product
+    constexpr float dot(const Vector& other) const {
+        return x * other.x + y * other.y;
+    }
+
+    // Get the cross product
+    constexpr float cross(const Vector& other) const {
+        return x * other.y - y * other.x;
+    }
+
+    // Get the length squared, for comparing lengths without a square root
+    constexpr float length_squared() const {
+        return x * x + y * y;
+    }
+
+    // Get the length of the vector
+    float length() const {
+        return sqrtf(length_squared());
+    }
+
+    // Get the normal of the vector
+    Vector normal() const {
+        float len = length();
+        if (len > 0) {
+            return Vector(x / len, y / len);
+        }
+        return Vector(0, 0);
+    }
+};
+
+#if VECTOR_SSE
+// Four vectors at once, x's together and y's together, for SSE kernels that
+// work on a few bodies or particles at a time. Does exactly the same float
+// math per lane as Vector does, so a kernel using it can match a plain one
+// bit for bit.
+struct Vector4 {
+    __m128 x, y;
+
+    Vector4() : x(_mm_setzero_ps()), y(_mm_setzero_ps()) {
+    }
+
+    Vector4(__m128 x, __m128 y) : x(x), y(y) {
+    }
+
+    // The same vector in every lane
+    explicit Vector4(const Vector& v)
+        : x(_mm_set1_ps(v.x)), y(_mm_set1_ps(v.y)) {
+    }
+
+    // Four x's and four y's from 16 byte aligned arrays
+    static Vector4 load(const float* xs, const float* ys) {
+        return Vector4(_mm_load_ps(xs), _mm_load_ps(ys));
+    }
+
+    void store(float* xs, float* ys) const {
+        _mm_store_ps(xs, x);
+        _mm_store_ps(ys, y);
+    }
+
+    Vector4 operator+(const Vector4& v) const {
+        return Vector4(_mm_add_ps(x, v.x), _mm_add_ps(y, v.y));
+    }
+
+    Vector4 operator-(const Vector4& v) const {
+        return Vector4(_mm_sub_ps(x, v.x), _mm_sub_ps(y, v.y));
+    }
+
+    // Scale each lane by its own number
+    Vector4 operator*(__m128 b) const {
+        return Vector4(_mm_mul_ps(x, b), _mm_mul_ps(y, b));
+    }
+
+    Vector4& operator+=(const Vector4& v) {
+        x = _mm_add_ps(x, v.x);
+        y = _mm_add_ps(y, v.y);
+        return *this;
+    }
+
+    __m128 dot(const Vector4& v) const {
+        return _mm_add_ps(_mm_mul_ps(x, v.x), _mm_mul_ps(y, v.y));
+    }
+
+    __m128 length_squared() const {
+        return dot(*this);
+    }
+
+    // One lane as a Vector
+    Vector get(int lane) const {
+        alignas(16) float xs[4], ys[4];
+        store(xs, ys);
+        return Vector(xs[lane], ys[lane]);
+    }
+};
+#endif
+
+// Axis-aligned bounding box, used by the broad phase
+struct AABB {
+    Vector min;
+    Vector max;
+
+    // Check if two boxes overlap
+    constexpr bool overlaps(const AABB& other) const {
+        return !(max.x < other.min.x || min.x > other.max.x ||
+                 max.y < other.min.y || min.y > other.max.y);
+    }
+};
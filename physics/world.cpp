@@ -0,0 +1,486 @@
+// World stepping and spawning
+
+#include "world.h"
+#include "ccd.h"
+#include "profile.h"
+#include <algorithm>
+#include <cstring>
+
+// Bodies per integration job (a multiple of the widest SIMD path)
+static const uint32_t integrateChunk = 8192;
+
+// Step every awake body: move them all, then only run the narrow phase on
+// the pairs the broad phase found. Those pairs get split into islands that
+// can't affect each other, and each island's contacts get found and solved in
+// parallel. Each island is always solved in the same order on one thread, so
+// the result is the same no matter how many threads there are or which one
+// ran what. Sleeping bodies are skipped the whole way through, until an
+// awake body runs into them.
+void World::step(float dt) {
+    PROFILE_SCOPE("step");
+    scratch.reset();
+    bodies.wakePending();
+    {
+        PROFILE_SCOPE("integrate");
+        integrate(dt);
+    }
+
+    // With CCD on, fast bodies get swept over where they're headed
+    float sweep = ccd ? dt : 0;
+    BroadPhase& broadPhase = get_broad_phase();
+    {
+        PROFILE_SCOPE("broad phase");
+        broadPhase.build(bodies, sweep);
+    }
+
+    // Wake whatever got run into and look again, so those pairs get solved
+    // this step (a fast body could be through it by the next one). Anything
+    // the newly woken bodies touch wakes up next step.
+    if (!broadPhase.get_sleepers().empty()) {
+        PROFILE_SCOPE("wake");
+        for (uint32_t sleeper : broadPhase.get_sleepers()) {
+            bodies.wake(sleeper);
+        }
+        bodies.wakePending();
+        broadPhase.build(bodies, sweep);
+        for (uint32_t sleeper : broadPhase.get_sleepers()) {
+            bodies.wake(sleeper);
+        }
+    }
+    anchored = nullptr;
+    staticCounts = nullptr;
+    staticStart = nullptr;
+    if (staticTree.size() > 0) {
+        PROFILE_SCOPE("statics");
+        findStatics();
+    }
+    {
+        PROFILE_SCOPE("islands");
+        islands.build(bodies.awakeCount(), broadPhase.get_pairs(), scratch,
+                      anchored);
+    }
+
+    // Make room for each island's static contacts
+    uint32_t islandCount = islands.get_island_count();
+    uint32_t staticTotal = 0;
+    if (anchored) {
+        staticStart = scratch.allocate<uint32_t>(islandCount + 1);
+        for (uint32_t i = 0; i < islandCount; i++) {
+            staticStart[i] = staticTotal;
+            for (uint32_t m = islands.bodyBegin(i); m < islands.bodyEnd(i);
+                 m++) {
+                staticTotal += staticCounts[islands.get_bodies()[m]];
+            }
+        }
+        staticStart[islandCount] = staticTotal;
+    }
+
+    // Batch small islands together so each job has a decent amount of work
+    // (counting bodies too, since some islands are one body on a static)
+    uint32_t target = std::max<uint32_t>(
+        64, (islands.get_pairs().size() + islands.get_bodies().size()) /
+                (jobs->get_thread_count() * 4));
+    uint32_t inBatch = 0;
+    uint32_t batchCount = 0;
+    batches = scratch.allocate<uint32_t>(islandCount + 1);
+    contacts = scratch.allocate<Contact>(islands.get_pairs().size() +
+                                         2 * islands.get_bodies().size() +
+                                         staticTotal);
+    contactCounts = scratch.allocate<uint32_t>(islandCount);
+    batches[0] = 0;
+    for (uint32_t i = 0; i < islandCount; i++) {
+        inBatch += islands.islandEnd(i) - islands.islandBegin(i) +
+                   islands.bodyEnd(i) - islands.bodyBegin(i);
+        if (inBatch >= target || i + 1 == islandCount) {
+            batches[++batchCount] = i + 1;
+            inBatch = 0;
+        }
+    }
+
+    {
+        // Timed as a whole, since a scope per island would cost more than
+        // most islands take
+        PROFILE_SCOPE("contacts");
+        jobs->parallelFor(batchCount, [this, dt](uint32_t batch) {
+            for (uint32_t i = batches[batch]; i < batches[batch + 1]; i++) {
+                solveIsland(i, dt);
+            }
+        });
+    }
+
+    // Gather every island's contacts (in island order, so this is the same
+    // every run) for warm starting the next step
+    contactCount = 0;
+    for (uint32_t i = 0; i < islandCount; i++) {
+        Contact* found = islandContacts(i);
+        std::copy(found, found + contactCounts[i], contacts + contactCount);
+        contactCount += contactCounts[i];
+    }
+    solver.store(contacts, contactCount);
+    if (particles.size() > 0) {
+        PROFILE_SCOPE("particles");
+        stepParticles(dt);
+    }
+    {
+        PROFILE_SCOPE("sleep");
+        updateSleep(dt);
+    }
+    stepCount++;
+    if (stepListener) {
+        stepListener(*this);
+    }
+
+    PROFILE_COUNT("pairs tested", islands.get_pairs().size());
+    PROFILE_COUNT("contacts resolved", contactCount);
+    PROFILE_GAUGE("bodies awake", bodies.awakeCount());
+}
+
+// Bodies get pushed by particles before they're checked for sleep, so
+// anything the particles are still shoving stays awake
+void World::stepParticles(float dt) {
+    particles.step(dt, walls, *jobs, simdLevel);
+
+    // Then everything near them gets a turn, one at a time in index order
+    // (a body can touch thousands of particles, but there aren't usually
+    // many bodies in the particles)
+    const AABB& near = particles.get_bounds();
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+        if (bodies.bounds(i).overlaps(near)) {
+            particles.couple(bodies, i);
+        }
+    }
+    staticTree.query(near, [this](uint32_t proxy) {
+        particles.couple(statics[staticTree.get_data(proxy)]);
+        return true;
+    });
+    PROFILE_COUNT("particle contacts", particles.get_contact_count());
+}
+
+void World::solveIsland(uint32_t island, float dt) {
+    auto& pairs = islands.get_pairs();
+    Contact* found = islandContacts(island);
+    uint32_t count = 0;
+    for (uint32_t p = islands.islandBegin(island);
+         p < islands.islandEnd(island); p++) {
+        uint32_t a = pairs[p].first;
+        uint32_t b = pairs[p].second;
+        CollisionFn collide = collisionKernel(bodies.type[a], bodies.type[b]);
+        Contact& c = found[count];
+        bool touching = collide && collide(bodies, a, b, c);
+
+        if (!touching) {
+            // Fast pairs that aren't touching yet might still hit before the
+            // next step
+            bool fast =
+                ccd && collide && (bodies.fast(a, dt) || bodies.fast(b, dt));
+            if (!fast || !speculativeContact(bodies, a, b, dt, c)) {
+                continue;
+            }
+        }
+
+        // Key the contact by handle so it can be found again next step even
+        // if the bodies get moved around in the store
+        BodyHandle ha = bodies.handleAt(a);
+        BodyHandle hb = bodies.handleAt(b);
+        if (ha.index > hb.index) {
+            std::swap(ha, hb);
+        }
+        c.key = (uint64_t)ha.index << 32 | hb.index;
+        c.generation = (uint64_t)ha.generation << 32 | hb.generation;
+        if (touching) {
+            bodies.intersecting[a] = 1;
+            bodies.intersecting[b] = 1;
+        }
+        count++;
+    }
+
+    // The integrator bounces bodies off the walls, but a body being pressed
+    // into one by the rest of its island needs the wall in the solve too, or
+    // the weight of a whole stack ends up bouncing off the floor every step
+    auto& members = islands.get_bodies();
+    for (uint32_t m = islands.bodyBegin(island); m < islands.bodyEnd(island);
+         m++) {
+        uint32_t body = members[m];
+        uint32_t touching = wallContacts(bodies, body, walls,
+                                         solverSettings.slop, found + count);
+        BodyHandle h = bodies.handleAt(body);
+        for (uint32_t w = 0; w < touching; w++) {
+            Contact& c = found[count++];
+            // Wall keys go after every body key (one per side)
+            uint32_t side = c.normal.x < 0   ? 0
+                            : c.normal.x > 0 ? 1
+                            : c.normal.y < 0 ? 2
+                                             : 3;
+            c.key = (uint64_t)h.index << 32 | (wallBody - side);
+            c.generation = (uint64_t)h.generation << 32;
+        }
+
+        // Statics work the same way, keyed after the walls. They're left
+        // out of CCD, so a thin one can still be skipped past by something
+        // fast enough.
+        if (!anchored || !anchored[body]) {
+            continue;
+        }
+        uint32_t first = count;
+        staticTree.query(staticReach(body), [&](uint32_t proxy) {
+            uint32_t id = staticTree.get_data(proxy);
+            Contact& c = found[count];
+            if (staticContact(bodies, body, statics[id], solverSettings.slop,
+                              c)) {
+                c.key = (uint64_t)h.index << 32 | (wallBody - 4 - id);
+                c.generation = (uint64_t)h.generation << 32;
+                if (c.penetration > 0) {
+                    bodies.intersecting[body] = 1;
+                }
+                count++;
+            }
+            return true;
+        });
+
+        // In id order, so the solve doesn't depend on the tree's shape
+        std::sort(found + first, found + count,
+                  [](const Contact& x, const Contact& y) {
+                      return x.key > y.key;
+                  });
+    }
+    contactCounts[island] = count;
+    solver.solve(bodies, found, count, dt, solverSettings);
+}
+
+void World::findStatics() {
+    uint32_t count = bodies.awakeCount();
+    anchored = scratch.allocate<uint8_t>(count);
+    staticCounts = scratch.allocate<uint32_t>(count);
+    uint32_t chunks = (count + integrateChunk - 1) / integrateChunk;
+    jobs->parallelFor(chunks, [this, count](uint32_t chunk) {
+        uint32_t begin = chunk * integrateChunk;
+        uint32_t end = std::min(begin + integrateChunk, count);
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t near = 0;
+            staticTree.query(staticReach(i), [&](uint32_t) {
+                near++;
+                return true;
+            });
+            staticCounts[i] = near;
+            anchored[i] = near > 0;
+        }
+    });
+}
+
+uint32_t World::addStatic(ShapeType type, Vector center, Vector half,
+                          Color color) {
+    uint32_t id;
+    if (!freeStatics.empty()) {
+        id = freeStatics.back();
+        freeStatics.pop_back();
+    } else {
+        id = (uint32_t)statics.size();
+        statics.emplace_back();
+        staticProxies.push_back(AABBTree::null);
+    }
+    StaticBody& s = statics[id];
+    s.type = type;
+    s.center = center;
+    s.half = half;
+    s.color = color;
+    staticProxies[id] = staticTree.insert(s.bounds(), id);
+
+    // Something asleep where it went wouldn't notice it otherwise
+    wakeInside(s.bounds());
+    return id;
+}
+
+void World::removeStatic(uint32_t id) {
+    if (id >= statics.size() || statics[id].type == ShapeType::Count) {
+        return;
+    }
+    wakeInside(statics[id].bounds());
+    staticTree.remove(staticProxies[id]);
+    staticProxies[id] = AABBTree::null;
+    statics[id].type = ShapeType::Count;
+    freeStatics.push_back(id);
+}
+
+void World::setStatics(const StaticBody* from, uint32_t count) {
+    staticTree.clear();
+    statics.assign(from, from + count);
+    staticProxies.assign(count, AABBTree::null);
+    freeStatics.clear();
+    for (uint32_t id = 0; id < count; id++) {
+        if (statics[id].type < ShapeType::Count) {
+            staticProxies[id] = staticTree.insert(statics[id].bounds(), id);
+        } else {
+            statics[id].type = ShapeType::Count;
+            freeStatics.push_back(id);
+        }
+    }
+}
+
+void World::wakeInside(const AABB& box) {
+    if (bodies.awakeCount() == bodies.size()) {
+        return;
+    }
+
+    // Find them through the query tree rather than checking every sleeping
+    // body, then wake them in order so it goes the same as it always has
+    float slop = solverSettings.slop;
+    AABB grown{Vector(box.min.x - slop, box.min.y - slop),
+               Vector(box.max.x + slop, box.max.y + slop)};
+    syncBodyTree();
+    waking.clear();
+    bodyTree.query(grown, [&](uint32_t proxy) {
+        uint32_t i = bodies.indexOf(BodyHandle{bodyTree.get_data(proxy)});
+        if (bodies.asleep(i) && staticReach(i).overlaps(box)) {
+            waking.push_back(i);
+        }
+        return true;
+    });
+    std::sort(waking.begin(), waking.end());
+    for (uint32_t i : waking) {
+        bodies.wake(i);
+    }
+}
+
+void World::updateSleep(float dt) {
+    uint32_t awake = bodies.awakeCount();
+    if (!sleepSettings.enabled) {
+        for (uint32_t i = awake; i < bodies.size(); i++) {
+            bodies.wake(i);
+        }
+        return;
+    }
+    float limit = sleepSettings.velocity * sleepSettings.velocity;
+    for (uint32_t i = 0; i < awake; i++) {
+        float speed = bodies.vx[i] * bodies.vx[i] + bodies.vy[i] * bodies.vy[i];
+        bodies.sleepTime[i] = speed < limit ? bodies.sleepTime[i] + dt : 0;
+    }
+
+    // Find each island's least rested body, and group the bodies by island
+    // (as handles, since putting one island to sleep moves the others)
+    uint32_t islandCount = islands.get_island_count();
+    float* rested = scratch.allocate<float>(islandCount);
+    uint32_t* start = scratch.allocate<uint32_t>(islandCount + 1);
+    uint32_t* cursor = scratch.allocate<uint32_t>(islandCount);
+    BodyHandle* members = scratch.allocate<BodyHandle>(awake);
+    std::fill(rested, rested + islandCount, sleepSettings.time);
+    std::fill(start, start + islandCount + 1, 0);
+    for (uint32_t i = 0; i < awake; i++) {
+        uint32_t island = islands.islandOf(i);
+        if (island != UINT32_MAX) {
+            rested[island] = std::min(rested[island], bodies.sleepTime[i]);
+            start[island + 1]++;
+        }
+    }
+    for (uint32_t i = 0; i < islandCount; i++) {
+        start[i + 1] += start[i];
+        cursor[i] = start[i];
+    }
+
+    // Bodies touching nothing get to sleep on their own
+    uint32_t loners = start[islandCount];
+    for (uint32_t i = 0; i < awake; i++) {
+        uint32_t island = islands.islandOf(i);
+        if (island != UINT32_MAX) {
+            members[cursor[island]++] = bodies.handleAt(i);
+        } else if (bodies.sleepTime[i] >= sleepSettings.time) {
+            members[loners++] = bodies.handleAt(i);
+        }
+    }
+
+    for (uint32_t i = 0; i < islandCount; i++) {
+        if (rested[i] >= sleepSettings.time) {
+            bodies.sleep(members + start[i], start[i + 1] - start[i]);
+        }
+    }
+    for (uint32_t i = start[islandCount]; i < loners; i++) {
+        bodies.sleep(members + i, 1);
+    }
+}
+
+uint64_t World::hash() const {
+    uint64_t h = 1469598103934665603ull;
+    for (auto array : {&bodies.px, &bodies.py, &bodies.vx, &bodies.vy}) {
+        for (float f : *array) {
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            h = (h ^ bits) * 1099511628211ull;
+        }
+    }
+    if (particles.size() > 0) {
+        h = (h ^ particles.hash()) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Run fixed steps for the elapsed time
+int World::advance(float elapsed) {
+    return fixedStep.advance(elapsed, timestep, [this] { step(timestep); });
+}
+
+// Move every awake body and bounce them off the walls
+void World::integrate(float dt) {
+    uint32_t count = bodies.awakeCount();
+    uint32_t chunks = (count + integrateChunk - 1) / integrateChunk;
+    jobs->parallelFor(chunks, [this, count, dt](uint32_t chunk) {
+        uint32_t begin = chunk * integrateChunk;
+        uint32_t end = std::min(begin + integrateChunk, count);
+        integrateBodies(bodies, begin, end, dt, walls, simdLevel,
+                        integrator);
+    });
+
+    // Reset the intersect flags (set again by the collision pass)
+    std::fill(bodies.intersecting.begin(), bodies.intersecting.begin() + count,
+              0);
+}
+
+// Create a random shape
+BodyHandle createRandomShape(BodyStore& bodies, Random& random, Vector a,
+                             int a_const) {
+    // Randomize the shape type
+    int type = random.below(2);
+    // type = 0;
+    // Randomize the parameters of the shape (one at a time, since the order
+    // arguments get evaluated in isn't fixed and the same seed should give
+    // the same shape everywhere)
+    float radius = 20 + random.below(30);
+    uint8_t r = random.below(256);
+    uint8_t g = random.below(256);
+    uint8_t b = random.below(256);
+    Color color(r, g, b);
+    float width = 40 + random.below(100);
+    float height = 40 + random.below(60);
+    Vector size(width, height);
+
+    // Set the velocity to 0
+    Vector v = Vector(0, 0);
+    Circle circle(Vector(), radius, color, a * a_const, v);
+    Rectangle rectangle(Vector(), size, color, a * a_const, v);
+
+    // Try 5 random positions—if they all overlap something, there are
+    // probably too many shapes
+    for (int attempt = 0; attempt < 5; attempt++) {
+        // Randomize the position
+        float x = random.below(940) + 30;
+        float y = random.below(940) + 30;
+        Vector position(x, y);
+        circle.center = position;
+        rectangle.center = position;
+
+        // Check for overlap with existing shapes
+        ShapeType t = type == 0 ? ShapeType::Circle : ShapeType::Rectangle;
+        Vector half = type == 0 ? Vector(radius, radius) : size / 2;
+        bool overlaps = false;
+        for (uint32_t i = 0; i < bodies.size() && !overlaps; i++) {
+            overlaps = shapesOverlap(bodies.type[i],
+                                     Vector(bodies.px[i], bodies.py[i]),
+                                     Vector(bodies.hx[i], bodies.hy[i]), t,
+                                     position, half);
+        }
+
+        // If there's no overlap, make the shape!
+        if (!overlaps) {
+            return type == 0 ? bodies.add(circle) : bodies.add(rectangle);
+        }
+    }
+    return BodyHandle();
+}
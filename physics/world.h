@@ -0,0 +1,383 @@
+// The simulation itself: owns the bodies and the broad phases and steps them
+// with a fixed timestep. Nothing in here knows about the window, so it runs
+// just as well headless.
+
+#pragma once
+
+#include "aabbtree.h"
+#include "arena.h"
+#include "bodies.h"
+#include "broadphase.h"
+#include "collision.h"
+#include "integrate.h"
+#include "islands.h"
+#include "jobs.h"
+#include "particles.h"
+#include "random.h"
+#include "solver.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Broad phases the world can switch between
+enum class BroadPhaseType { Grid, SweepAndPrune };
+
+// When bodies get put to sleep. An island only sleeps once every body in it
+// has been slow enough for long enough.
+struct SleepSettings {
+    bool enabled = true;
+    float velocity = 10; // Slower than this counts as resting
+    float time = 0.5f;   // Seconds of resting before sleeping
+};
+
+// What World::spawn makes and where it puts it. Sizes are picked uniformly
+// between the min and max.
+struct SpawnSettings {
+    AABB region = AABB{Vector(), Vector()}; // Empty means inside the walls
+    float circles = 0.5f;                   // Chance of each being a circle
+    float minRadius = 20;
+    float maxRadius = 50;
+    Vector minSize = Vector(40, 40); // Rectangles' full size
+    Vector maxSize = Vector(140, 100);
+    float spacing = 0; // Gap to keep between shapes
+    Vector acceleration = Vector(0, -200.0f);
+    Vector velocity;
+    uint32_t attempts = 30; // Spots tried for each shape before skipping it
+};
+
+// Real time built up towards fixed steps (the world, lockstep and chunked
+// worlds all step this way)
+struct FixedTimestep {
+    float accumulator = 0;
+    int maxSteps = 8; // Cap per advance so one slow frame can't snowball
+
+    // Add elapsed time and call step() as many times as dt fits. Leftover
+    // time carries over to the next call, so the results don't depend on the
+    // frame rate. Returns how many steps ran.
+    template <typename Fn>
+    int advance(float elapsed, float dt, Fn step) {
+        accumulator += elapsed;
+        int steps = 0;
+        while (accumulator >= dt && steps < maxSteps) {
+            step();
+            accumulator -= dt;
+            steps++;
+        }
+        // If we fell too far behind, drop the backlog instead of trying to
+        // catch up (which would only make the next frame slower)
+        if (steps == maxSteps) {
+            accumulator = std::min(accumulator, dt);
+        }
+        return steps;
+    }
+};
+
+// Which things a query looks at
+enum class QueryFilter : uint8_t { All, Bodies, Statics };
+
+// Something a query found. Either body is valid, or staticId is the static.
+struct QueryHit {
+    BodyHandle body;
+    uint32_t staticId = UINT32_MAX;
+    Vector point;       // Where a ray hit, or the closest point for nearest
+    Vector normal;      // Surface normal where a ray hit
+    float distance = 0; // Along the ray, or from the point for nearest
+};
+
+class World {
+  public:
+    // Constructor (threads counts the one calling step, 1 means no workers)
+    World(float timestep = 1 / 120.0f,
+          unsigned threads = std::thread::hardware_concurrency())
+        : jobs(new JobSystem(threads)), timestep(timestep) {
+    }
+
+    // Step the simulation forward by exactly dt seconds
+    void step(float dt);
+
+    // Add real elapsed time and run as many fixed steps as fit. Leftover time
+    // carries over to the next call, so the results don't depend on the frame
+    // rate. Returns how many steps ran.
+    int advance(float elapsed);
+
+    // Getters and setters
+    BodyStore& get_bodies() {
+        return bodies;
+    }
+
+    const BodyStore& get_bodies() const {
+        return bodies;
+    }
+
+    BroadPhase& get_broad_phase() {
+        return broadPhaseType == BroadPhaseType::Grid ? (BroadPhase&)grid
+                                                      : (BroadPhase&)sweep;
+    }
+
+    BroadPhaseType get_broad_phase_type() const {
+        return broadPhaseType;
+    }
+
+    void set_broad_phase(BroadPhaseType type) {
+        broadPhaseType = type;
+    }
+
+    const AABB& get_walls() const {
+        return walls;
+    }
+
+    // Move the walls (the grid gets resized to cover everything up to them)
+    void set_walls(const AABB& box) {
+        walls = box;
+        grid = SpatialGrid(box.max.x, box.max.y);
+    }
+
+    float get_timestep() const {
+        return timestep;
+    }
+
+    void set_timestep(float dt) {
+        timestep = dt;
+    }
+
+    uint64_t get_step_count() const {
+        return stepCount;
+    }
+
+    SimdLevel get_simd_level() const {
+        return simdLevel;
+    }
+
+    void set_simd_level(SimdLevel level) {
+        simdLevel = level;
+    }
+
+    Integrator get_integrator() const {
+        return integrator;
+    }
+
+    void set_integrator(Integrator i) {
+        integrator = i;
+    }
+
+    unsigned get_thread_count() const {
+        return jobs->get_thread_count();
+    }
+
+    // Swap out the job system for one with a different number of threads
+    void set_thread_count(unsigned threads) {
+        jobs.reset(new JobSystem(threads));
+    }
+
+    const IslandBuilder& get_islands() const {
+        return islands;
+    }
+
+    const FrameArena& get_scratch() const {
+        return scratch;
+    }
+
+    SolverSettings& get_solver_settings() {
+        return solverSettings;
+    }
+
+    SleepSettings& get_sleep_settings() {
+        return sleepSettings;
+    }
+
+    // Continuous collision for fast bodies (see ccd.h)
+    bool get_ccd() const {
+        return ccd;
+    }
+
+    void set_ccd(bool on) {
+        ccd = on;
+    }
+
+    // Circles that are all the same size, stepped after the bodies and
+    // pushed against them (see particles.h)
+    ParticleSystem& get_particles() {
+        return particles;
+    }
+
+    const ParticleSystem& get_particles() const {
+        return particles;
+    }
+
+    // Contacts found in the last step
+    uint32_t get_contact_count() const {
+        return contactCount;
+    }
+
+    // The world's own random numbers (seed it and spawning is the same every
+    // run)
+    Random& get_random() {
+        return random;
+    }
+
+    // Hash of every body's position and velocity, for checking two runs
+    // came out exactly the same
+    uint64_t hash() const;
+
+    // Try to add count random shapes that don't overlap anything (bodies,
+    // statics or each other), using the world's random numbers. Shapes that
+    // can't find room get skipped, and it gives up once a run of them in a
+    // row can't (as many as the attempts per shape). Returns how many it
+    // placed.
+    uint32_t spawn(uint32_t count,
+                   const SpawnSettings& settings = SpawnSettings());
+
+    // Add a piece of level geometry and get its id. Statics never move, so
+    // they cost nothing while nothing's near them (however many there are).
+    uint32_t addStatic(const Rectangle& r) {
+        return addStatic(ShapeType::Rectangle, r.center,
+                         Vector(r.size.x / 2, r.size.y / 2), r.color);
+    }
+
+    uint32_t addStatic(const Circle& c) {
+        return addStatic(ShapeType::Circle, c.center,
+                         Vector(c.radius, c.radius), c.color);
+    }
+
+    uint32_t addStatic(const StaticBody& s) {
+        return addStatic(s.type, s.center, s.half, s.color);
+    }
+
+    // Remove a static (anything asleep on it wakes up)
+    void removeStatic(uint32_t id);
+
+    // Every static by id (removed ones have type Count)
+    const std::vector<StaticBody>& get_statics() const {
+        return statics;
+    }
+
+    // Spatial queries, through AABB trees over the bodies and the statics.
+    // The body tree catches up with the bodies on the first query after they
+    // change, so queries are meant to be made between steps (from one thread
+    // at a time), and it's cheap to make thousands of them.
+    //
+    // First thing a ray from from to to hits
+    bool raycast(Vector from, Vector to, QueryHit& hit,
+                 QueryFilter filter = QueryFilter::All) const;
+
+    // Something with p inside it (the body on top, if there's more than one)
+    bool pointQuery(Vector p, QueryHit& hit,
+                    QueryFilter filter = QueryFilter::All) const;
+
+    // Everything overlapping a box, added to hits. Returns how many.
+    uint32_t aabbQuery(const AABB& box, std::vector<QueryHit>& hits,
+                       QueryFilter filter = QueryFilter::All) const;
+
+    // Closest thing to p, as long as it's within maxDistance
+    bool nearest(Vector p, float maxDistance, QueryHit& hit,
+                 QueryFilter filter = QueryFilter::All) const;
+
+    // Called at the end of every step, including the ones advance() runs
+    // (for recording and the like)
+    void set_step_listener(std::function<void(const World&)> listener) {
+        stepListener = std::move(listener);
+    }
+
+  private:
+    friend class Snapshot;
+
+    // Move every awake body and bounce them off the walls
+    void integrate(float dt);
+
+    uint32_t addStatic(ShapeType type, Vector center, Vector half,
+                       Color color);
+
+    // Replace every static (for snapshots)
+    void setStatics(const StaticBody* from, uint32_t count);
+
+    // Count the statics each awake body is touching (or close to), and flag
+    // the ones touching any so they get an island to solve them in
+    void findStatics();
+
+    // Box around a body that statics have to overlap to get a contact
+    AABB staticReach(uint32_t i) const {
+        AABB box = bodies.bounds(i);
+        float slop = solverSettings.slop;
+        return AABB{Vector(box.min.x - slop, box.min.y - slop),
+                    Vector(box.max.x + slop, box.max.y + slop)};
+    }
+
+    // Wake anything asleep that overlaps a box
+    void wakeInside(const AABB& box);
+
+    // Bring the body tree up to date with the bodies (if anything changed)
+    void syncBodyTree() const;
+
+    // Find the contacts in an island and solve them
+    void solveIsland(uint32_t island, float dt);
+
+    // Where an island's contacts go (room for every pair, two walls for
+    // every body and every static its bodies are near)
+    Contact* islandContacts(uint32_t island) const {
+        return contacts + islands.islandBegin(island) +
+               2 * islands.bodyBegin(island) +
+               (staticStart ? staticStart[island] : 0);
+    }
+
+    // Step the particles and push them and everything they touch apart
+    void stepParticles(float dt);
+
+    // Track how long each body has been resting and put islands that have
+    // settled to sleep
+    void updateSleep(float dt);
+
+    // World variables
+    BodyStore bodies;
+    SpatialGrid grid = SpatialGrid(1000, 1000);
+    SweepAndPrune sweep;
+    IslandBuilder islands;
+    std::unique_ptr<JobSystem> jobs;
+    FrameArena scratch;          // Reset at the start of every step
+    uint32_t* batches = nullptr; // First island of each solver job
+    Contact* contacts = nullptr; // Laid out by island
+    uint32_t* contactCounts = nullptr; // Contacts found in each island
+    uint32_t contactCount = 0;
+    uint8_t* anchored = nullptr;       // Awake bodies touching a static
+    uint32_t* staticCounts = nullptr;  // Statics near each awake body
+    uint32_t* staticStart = nullptr;   // Room for static contacts per island
+    ContactSolver solver;
+    ParticleSystem particles;
+    Random random;
+    SolverSettings solverSettings;
+    SleepSettings sleepSettings;
+    bool ccd = true;
+    BroadPhaseType broadPhaseType = BroadPhaseType::Grid;
+    SimdLevel simdLevel = detectSimdLevel();
+    Integrator integrator = Integrator::SemiImplicitEuler;
+    // (these y adjustments of 40 I think are caused by the header of the
+    // window of MacOS. Not sure if this is true on other OSes, but this
+    // minimal library doesn't provide a nice way to handle screen size.)
+    AABB walls = AABB{Vector(0, 40), Vector(1000, 1000 - 40)};
+    float timestep;
+    FixedTimestep fixedStep;
+    uint64_t stepCount = 0;
+    std::function<void(const World&)> stepListener;
+
+    // Statics (by id) and a tree over them
+    std::vector<StaticBody> statics;
+    std::vector<uint32_t> staticProxies;
+    std::vector<uint32_t> freeStatics;
+    AABBTree staticTree = AABBTree(0);
+    std::vector<uint32_t> waking; // Bodies wakeInside found
+
+    // Query tree over the bodies, with each handle slot's proxy in it. It's
+    // rebuilt lazily, so it's a cache even on a const world.
+    mutable AABBTree bodyTree = AABBTree(8);
+    mutable std::vector<uint32_t> bodyProxies;
+    mutable std::vector<uint32_t> bodySeen; // Last sync each slot was in
+    mutable uint32_t syncCount = 0;
+    mutable uint64_t syncedStep = UINT64_MAX;
+    mutable uint64_t syncedChanges = UINT64_MAX;
+};
+
+// Create a random shape
+BodyHandle createRandomShape(BodyStore& bodies, Random& random, Vector a,
+                             int a_const);